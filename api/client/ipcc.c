@@ -8,42 +8,22 @@
 int ipcc_request(struct ipc_client *client, 
 			int msg_id, void *data, int size, void *response, int rsplen)
 {
-	int  ret = -1;
-	char buf[1024] = {0};
-	struct ipc_msg *msg = (struct ipc_msg *)buf;
-	size_t bufsize = rsplen > size ? rsplen : size;
-	if (!ipc_msg_space_check(sizeof(buf), bufsize)) {
-		msg = ipc_alloc_msg(bufsize);
-		if (msg == NULL) {
-			fprintf(stderr, "No memory\n");
-			return ret;
-		}
-		bufsize += sizeof(struct ipc_msg);
-	} else
-		bufsize  = sizeof(buf);
-	
-	msg->msg_id = msg_id;
+	struct ipc_msg msg = {0};
+	struct iovec iov = { .iov_base = data, 	   .iov_len = data ? size : 0 };
+	struct iovec rov = { .iov_base = response, .iov_len = response ? rsplen : 0 };
+	/*
+	 * The request is sent from @data and the response is received into @response directly,
+	 * no intermediate message buffer needed.
+	 */
+	msg.msg_id = msg_id;
 	if (response) {
-		msg->flags = IPC_FLAG_REPLY;
+		msg.flags = IPC_FLAG_REPLY;
 	}
-	if (data) {
-		memcpy(msg->data, data, size);
-		msg->data_len = size;
-	}
-	if (IPC_REQUEST_SUCCESS == ipc_client_request(client, msg, bufsize, 5)) {
-		if (response) {
-			if (msg->data_len > rsplen) {
-				msg->data_len = rsplen;
-				fprintf(stderr, "No enough space for response, truncated.\n");
-			}
-			memcpy(response, msg->data, msg->data_len);
-		}
-		ret = 0;
-	}
-	if ((void *)msg != (void *)buf) {
-		ipc_free_msg(msg);
-	}
-	return ret;
+	if (IPC_REQUEST_SUCCESS != ipc_client_requestv(client, &msg, &iov, 1, &rov, 1, 5))
+		return -1;
+	if (response && msg.data_len > rsplen)
+		fprintf(stderr, "No enough space for response, truncated.\n");
+	return 0;
 }
 
 /*
@@ -5,10 +5,13 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>	
+#include <strings.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <sys/sem.h>
 #include <sys/syscall.h>
+#include "generic_log.h"
+#include "generic_logshm.h"
 #define gettid()				syscall(__NR_gettid)
 #define LOG_PATH				"/var/volatile/log"
 #define LOG_FILE_PATH_MAX		255
@@ -35,6 +38,17 @@ static struct logger_struct __logger = {
 #define LOCK_INITING		-2
 static int __lock = LOCK_INVALID;
 #define LOGGER() 	(&__logger)
+#ifndef GENERIC_LOG_LEVEL_DEFAULT
+#define GENERIC_LOG_LEVEL_DEFAULT	3	/* GENERIC_LOG_LEVEL_I */
+#endif
+int generic_log_level = GENERIC_LOG_LEVEL_DEFAULT;
+static void __attribute__((constructor)) generic_log_level_init()
+{
+	const char *env = getenv("GENERIC_LOG_LEVEL");
+	int level = env ? generic_log_parse(env) : -1;
+	if (level >= 0)
+		generic_log_level = level;
+}
 #if 0
 #define lock_get()    ({ __typeof__(*(&__lock)) *_val = (&__lock); (*_val); })
 #define lock_cas(old_val, new_val) ({int __b = __lock == (old_val); if (__b) __lock = (new_val); __b; })
@@ -293,7 +307,22 @@ void GENERIC_LOG(const char *format, ...)
 {
 	va_list ap;
 	va_start(ap, format);
-	if (LOGGER()->file_size > 0)
+	if (logshm_attached())
+		logshm_write(GENERIC_LOG_LEVEL_NONE, format, ap);
+	else if (LOGGER()->file_size > 0)
+		generic_log_print(format, ap);
+	else
+		generic_print(format, ap);
+	va_end(ap);
+}
+
+void GENERIC_LOGL(int level, const char *format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	if (logshm_attached())
+		logshm_write(level, format, ap);
+	else if (LOGGER()->file_size > 0)
 		generic_log_print(format, ap);
 	else
 		generic_print(format, ap);
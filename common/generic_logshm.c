@@ -0,0 +1,731 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "generic_atomic.h"
+#include "generic_logshm.h"
+#define gettid()				syscall(__NR_gettid)
+#define LOGSHM_PATH				"/dev/shm/"
+#define LOGSHM_NAME_MAX			64
+#define LOGSHM_ATTACH_WAIT		1000	/* ms, for the creator to publish the header */
+#define LOGSHM_INTERN_SPINS		1000	/* yields before giving up on a slot being interned */
+#define LOGSHM_READ_SPINS		64		/* yields on an uncommitted record before reporting idle */
+#define LOGSHM_READ_STALLS		(100 * LOGSHM_READ_SPINS)	/* before skipping a record never committed */
+#define LOGSHM_CACHE_SIZE		256		/* Per thread format id cache */
+#define LOGSHM_COMM_CACHE		64
+#define LOGSHM_PRECISION_ARG	(-2)	/* Precision given as '*' */
+
+/* Argument tags in record payload */
+#define ARG_SIGNED				'i'
+#define ARG_UNSIGNED			'u'
+#define ARG_DOUBLE				'f'
+#define ARG_POINTER				'p'
+#define ARG_STRING				's'
+
+enum {
+	LEN_NONE = 0,
+	LEN_HH,
+	LEN_H,
+	LEN_L,
+	LEN_LL,
+	LEN_J,
+	LEN_Z,
+	LEN_T,
+	LEN_LD,
+};
+
+struct logshm {
+	struct logshm_header *header;
+	struct logshm_format *formats;
+	unsigned char *records;
+	uint32_t mask;
+	size_t size;
+};
+
+struct logshm_spec {
+	const char *lenpos;		/* Where the length modifier starts */
+	const char *end;		/* One past the conversion character */
+	int precision;			/* -1: none, LOGSHM_PRECISION_ARG: taken from the arguments */
+	int length;
+	char conv;
+};
+
+struct logshm_reader {
+	struct logshm shm;
+	uint64_t cursor;
+	uint64_t lost;
+	int stalls;
+	time_t sec;
+	char stamp[32];
+	struct {
+		uint32_t pid;
+		char comm[17];
+	} comms[LOGSHM_COMM_CACHE];
+};
+
+static struct logshm __logshm = {NULL};
+static int __logshm_generation = 0;
+static pid_t __logshm_pid = 0;		/* Refreshed in the child after fork() */
+
+#define logshm_record(shm, pos) \
+	((struct logshm_record *)((shm)->records + ((pos) & (shm)->mask) * LOGSHM_RECORD_SIZE))
+
+static uint32_t logshm_hash(const char *text, int len)
+{
+	uint32_t h = 2166136261u;
+	while (len-- > 0)
+		h = (h ^ (unsigned char)*text++) * 16777619u;
+	return h;
+}
+
+static size_t logshm_size(uint32_t records)
+{
+	return sizeof(struct logshm_header)
+		+ LOGSHM_FORMATS * sizeof(struct logshm_format)
+		+ (size_t)records * LOGSHM_RECORD_SIZE;
+}
+
+static void logshm_layout(struct logshm *shm, void *base, size_t size)
+{
+	shm->header  = (struct logshm_header *)base;
+	shm->formats = (struct logshm_format *)((char *)base + sizeof(struct logshm_header));
+	shm->records = (unsigned char *)(shm->formats + LOGSHM_FORMATS);
+	shm->mask    = shm->header->nrecords - 1;
+	shm->size    = size;
+}
+
+/*
+ * logshm_map() -
+ * Create the segment or attach to an existing one.
+ * The creator publishes @magic last, others wait for it before trusting the header.
+ */
+static int logshm_map(struct logshm *shm, const char *name, int records)
+{
+	char path[sizeof(LOGSHM_PATH) + LOGSHM_NAME_MAX];
+	struct logshm_header *header;
+	struct stat st;
+	void *base;
+	size_t size;
+	int fd, wait;
+	if (!name || !name[0] || strchr(name, '/') || strlen(name) >= LOGSHM_NAME_MAX)
+		return -1;
+	sprintf(path, LOGSHM_PATH"%s", name);
+	uint32_t n = 64;
+	while (n < (uint32_t)records && n < (1u << 20))
+		n <<= 1;
+	if (records <= 0)
+		n = LOGSHM_RECORDS;
+
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	if (fd >= 0) {
+		fchmod(fd, 0666);
+		size = logshm_size(n);
+		if (ftruncate(fd, size) < 0)
+			goto err;
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (base == MAP_FAILED)
+			goto err;
+		close(fd);
+		header = (struct logshm_header *)base;
+		header->version  = LOGSHM_VERSION;
+		header->nrecords = n;
+		header->nformats = LOGSHM_FORMATS;
+		aop_barrier();
+		header->magic    = LOGSHM_MAGIC;
+		logshm_layout(shm, base, size);
+		return 0;
+	}
+	if (errno != EEXIST)
+		return -1;
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	for (wait = 0; ; wait++) {
+		if (fstat(fd, &st) < 0)
+			goto err;
+		if (st.st_size >= sizeof(struct logshm_header))
+			break;
+		if (wait >= LOGSHM_ATTACH_WAIT)
+			goto err;
+		usleep(1000);
+	}
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		goto err;
+	header = (struct logshm_header *)base;
+	for (wait = 0; aop_get(&header->magic) != LOGSHM_MAGIC; wait++) {
+		if (wait >= LOGSHM_ATTACH_WAIT)
+			goto unmap;
+		usleep(1000);
+	}
+	size = logshm_size(header->nrecords);
+	if (header->version != LOGSHM_VERSION
+		|| header->nformats != LOGSHM_FORMATS
+		|| header->nrecords & (header->nrecords - 1)
+		|| st.st_size < size)
+		goto unmap;
+	close(fd);
+	logshm_layout(shm, base, size);
+	return 0;
+unmap:
+	munmap(base, st.st_size);
+err:
+	close(fd);
+	return -1;
+}
+
+/*
+ * logshm_intern() -
+ * Find or insert @format in the shared format table, open addressing on its hash.
+ * Slot 0 is reserved for 'no format'.
+ */
+static uint16_t logshm_intern(struct logshm *shm, const char *format)
+{
+	int len = strlen(format);
+	if (len >= LOGSHM_FORMAT_MAX)
+		len = LOGSHM_FORMAT_MAX - 1;
+	uint32_t hash = logshm_hash(format, len);
+	uint32_t i, spins;
+	for (i = 0; i < LOGSHM_FORMATS - 1; i++) {
+		uint32_t idx = 1 + (hash + i) % (LOGSHM_FORMATS - 1);
+		struct logshm_format *f = &shm->formats[idx];
+		uint32_t state = aop_get(&f->state);
+		if (state == 0) {
+			if (aop_cas(&f->state, 0, 1) == 0) {
+				f->hash = hash;
+				memcpy(f->text, format, len);
+				f->text[len] = '\0';
+				aop_barrier();
+				f->state = 2;
+				return (uint16_t)idx;
+			}
+			state = aop_get(&f->state);
+		}
+		for (spins = 0; state == 1 && spins < LOGSHM_INTERN_SPINS; spins++) {
+			sched_yield();
+			state = aop_get(&f->state);
+		}
+		if (state == 2 && f->hash == hash
+			&& !strncmp(f->text, format, len) && f->text[len] == '\0')
+			return (uint16_t)idx;
+	}
+	aop_inc(&shm->header->overflow);
+	return 0;
+}
+
+static uint16_t logshm_format_id(struct logshm *shm, const char *format)
+{
+	static __thread struct {
+		const char *key;
+		uint16_t id;
+	} cache[LOGSHM_CACHE_SIZE];
+	unsigned int h = ((uintptr_t)format >> 2) & (LOGSHM_CACHE_SIZE - 1);
+	if (cache[h].key == format)
+		return cache[h].id;
+	uint16_t id = logshm_intern(shm, format);
+	if (id) {
+		cache[h].key = format;
+		cache[h].id  = id;
+	}
+	return id;
+}
+
+static uint32_t logshm_tid()
+{
+	static __thread uint32_t tid = 0;
+	static __thread int generation = -1;
+	if (generation != __logshm_generation) {
+		tid = gettid();
+		generation = __logshm_generation;
+	}
+	return tid;
+}
+
+/*
+ * logshm_spec_parse() -
+ * Parse one conversion specification, @p points at the character after '%'.
+ * Returns -1 if it is not a conversion we know how to carry.
+ */
+static int logshm_spec_parse(const char *p, struct logshm_spec *spec)
+{
+	while (*p && strchr("-+ #0'", *p))
+		p++;
+	if (*p == '*')
+		p++;
+	else
+		while (*p >= '0' && *p <= '9')
+			p++;
+	spec->precision = -1;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->precision = LOGSHM_PRECISION_ARG;
+			p++;
+		} else {
+			spec->precision = 0;
+			while (*p >= '0' && *p <= '9')
+				spec->precision = spec->precision * 10 + *p++ - '0';
+		}
+	}
+	spec->lenpos = p;
+	spec->length = LEN_NONE;
+	switch (*p) {
+	case 'h':
+		spec->length = p[1] == 'h' ? LEN_HH : LEN_H;
+		p += spec->length == LEN_HH ? 2 : 1;
+		break;
+	case 'l':
+		spec->length = p[1] == 'l' ? LEN_LL : LEN_L;
+		p += spec->length == LEN_LL ? 2 : 1;
+		break;
+	case 'q': spec->length = LEN_LL; p++; break;
+	case 'j': spec->length = LEN_J;  p++; break;
+	case 'z': spec->length = LEN_Z;  p++; break;
+	case 't': spec->length = LEN_T;  p++; break;
+	case 'L': spec->length = LEN_LD; p++; break;
+	}
+	if (!*p || !strchr("diouxXcfFeEgGaAspn", *p))
+		return -1;
+	spec->conv = *p;
+	spec->end  = p + 1;
+	return 0;
+}
+
+#define ARG_PUT(type, tag, value) \
+	do { \
+		type __v = (value); \
+		if (pos + 1 + sizeof(type) > LOGSHM_ARGS_MAX) \
+			goto full; \
+		args[pos++] = (tag); \
+		memcpy(args + pos, &__v, sizeof(type)); \
+		pos += sizeof(type); \
+	} while (0)
+
+/*
+ * logshm_encode() -
+ * Walk @format and copy the arguments it consumes into @args, tagged by type.
+ * Strings are copied by value since the pointer means nothing to the reader.
+ */
+static int logshm_encode(unsigned char args[LOGSHM_ARGS_MAX], const char *format, va_list ap, uint8_t *flags)
+{
+	struct logshm_spec spec;
+	const char *p = format;
+	int pos = 0;
+	while ((p = strchr(p, '%')) != NULL) {
+		if (p[1] == '%') {
+			p += 2;
+			continue;
+		}
+		if (logshm_spec_parse(p + 1, &spec) < 0)
+			break;
+		const char *s;
+		int star, precision = spec.precision;
+		for (s = p + 1; s < spec.lenpos; s++)
+			if (*s == '*') {
+				star = va_arg(ap, int);
+				/* A negative precision is taken as if it were omitted */
+				if (s[-1] == '.')
+					precision = star < 0 ? -1 : star;
+				ARG_PUT(int64_t, ARG_SIGNED, star);
+			}
+		switch (spec.conv) {
+		case 'd':
+		case 'i':
+			switch (spec.length) {
+			case LEN_HH: ARG_PUT(int64_t, ARG_SIGNED, (signed char)va_arg(ap, int)); break;
+			case LEN_H:  ARG_PUT(int64_t, ARG_SIGNED, (short)va_arg(ap, int)); break;
+			case LEN_L:  ARG_PUT(int64_t, ARG_SIGNED, va_arg(ap, long)); break;
+			case LEN_LL: ARG_PUT(int64_t, ARG_SIGNED, va_arg(ap, long long)); break;
+			case LEN_J:  ARG_PUT(int64_t, ARG_SIGNED, va_arg(ap, intmax_t)); break;
+			case LEN_Z:  ARG_PUT(int64_t, ARG_SIGNED, va_arg(ap, ssize_t)); break;
+			case LEN_T:  ARG_PUT(int64_t, ARG_SIGNED, va_arg(ap, ptrdiff_t)); break;
+			default:     ARG_PUT(int64_t, ARG_SIGNED, va_arg(ap, int)); break;
+			}
+			break;
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			switch (spec.length) {
+			case LEN_HH: ARG_PUT(uint64_t, ARG_UNSIGNED, (unsigned char)va_arg(ap, unsigned int)); break;
+			case LEN_H:  ARG_PUT(uint64_t, ARG_UNSIGNED, (unsigned short)va_arg(ap, unsigned int)); break;
+			case LEN_L:  ARG_PUT(uint64_t, ARG_UNSIGNED, va_arg(ap, unsigned long)); break;
+			case LEN_LL: ARG_PUT(uint64_t, ARG_UNSIGNED, va_arg(ap, unsigned long long)); break;
+			case LEN_J:  ARG_PUT(uint64_t, ARG_UNSIGNED, va_arg(ap, uintmax_t)); break;
+			case LEN_Z:  ARG_PUT(uint64_t, ARG_UNSIGNED, va_arg(ap, size_t)); break;
+			case LEN_T:  ARG_PUT(uint64_t, ARG_UNSIGNED, va_arg(ap, ptrdiff_t)); break;
+			default:     ARG_PUT(uint64_t, ARG_UNSIGNED, va_arg(ap, unsigned int)); break;
+			}
+			break;
+		case 'c':
+			ARG_PUT(int64_t, ARG_SIGNED, va_arg(ap, int));
+			break;
+		case 'f': case 'F': case 'e': case 'E':
+		case 'g': case 'G': case 'a': case 'A':
+			if (spec.length == LEN_LD)
+				ARG_PUT(double, ARG_DOUBLE, (double)va_arg(ap, long double));
+			else
+				ARG_PUT(double, ARG_DOUBLE, va_arg(ap, double));
+			break;
+		case 's':
+			if (spec.length == LEN_NONE) {
+				const char *str = va_arg(ap, const char *);
+				if (!str)
+					str = "(null)";
+				int len = precision >= 0 ? strnlen(str, precision) : strlen(str);
+				if (pos + 3 > LOGSHM_ARGS_MAX)
+					goto full;
+				if (len > LOGSHM_ARGS_MAX - pos - 3) {
+					len = LOGSHM_ARGS_MAX - pos - 3;
+					*flags |= LOGSHM_FLAG_TRUNCATED;
+				}
+				uint16_t n = len;
+				args[pos++] = ARG_STRING;
+				memcpy(args + pos, &n, sizeof(n));
+				pos += sizeof(n);
+				memcpy(args + pos, str, len);
+				pos += len;
+				break;
+			}
+			/* Wide strings are carried as pointers */
+		case 'p':
+			ARG_PUT(uint64_t, ARG_POINTER, (uintptr_t)va_arg(ap, void *));
+			break;
+		case 'n':
+			(void)va_arg(ap, void *);
+			break;
+		}
+		p = spec.end;
+	}
+	return pos;
+full:
+	*flags |= LOGSHM_FLAG_TRUNCATED;
+	return pos;
+}
+
+int logshm_attached()
+{
+	return __logshm.header != NULL;
+}
+
+/*
+ * logshm_write() -
+ * Producer path: claim a slot, fill it in place, commit it through @seq.
+ * No lock, no formatting, no system call besides the vDSO clock read.
+ */
+void logshm_write(int level, const char *format, va_list ap)
+{
+	struct logshm *shm = &__logshm;
+	struct logshm_record *rec;
+	struct timespec ts;
+	uint16_t id = logshm_format_id(shm, format);
+	uint64_t pos = aop_fadd(&shm->header->head, 1);
+	rec = logshm_record(shm, pos);
+	rec->seq = 0;
+	aop_barrier();
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec->time   = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	rec->pid    = __logshm_pid;
+	rec->tid    = logshm_tid();
+	rec->format = id;
+	rec->level  = level;
+	rec->flags  = 0;
+	rec->size   = id ? logshm_encode(rec->args, format, ap, &rec->flags) : 0;
+	aop_barrier();
+	rec->seq    = pos + 1;
+}
+
+static void logshm_atfork_child()
+{
+	__logshm_generation++;
+	__logshm_pid = getpid();
+}
+
+int GENERIC_LOG_SHM_INIT(const char *name, int records)
+{
+	struct logshm shm;
+	if (logshm_attached())
+		return 0;
+	if (logshm_map(&shm, name, records) < 0) {
+		printf("Logger shm:%s error:%d.\n", name ? name : "", errno);
+		return -1;
+	}
+	__logshm_pid = getpid();
+	pthread_atfork(NULL, NULL, logshm_atfork_child);
+	__logshm.formats = shm.formats;
+	__logshm.records = shm.records;
+	__logshm.mask    = shm.mask;
+	__logshm.size    = shm.size;
+	aop_barrier();
+	__logshm.header  = shm.header;
+	return 0;
+}
+
+static void __attribute__((constructor)) logshm_env_init()
+{
+	const char *name = getenv("GENERIC_LOG_SHM");
+	if (name && name[0])
+		GENERIC_LOG_SHM_INIT(name, 0);
+}
+
+/*
+ * Reader side.
+ */
+struct logshm_reader *logshm_reader_open(const char *name, int records)
+{
+	struct logshm_reader *reader = calloc(1, sizeof(struct logshm_reader));
+	if (!reader)
+		return NULL;
+	if (logshm_map(&reader->shm, name, records) < 0) {
+		free(reader);
+		return NULL;
+	}
+	/* Start from the oldest record still in the ring */
+	uint64_t head = aop_get(&reader->shm.header->head);
+	uint32_t n = reader->shm.header->nrecords;
+	reader->cursor = head > n ? head - n : 0;
+	reader->sec = -1;
+	return reader;
+}
+
+void logshm_reader_close(struct logshm_reader *reader)
+{
+	munmap(reader->shm.header, reader->shm.size);
+	free(reader);
+}
+
+uint64_t logshm_reader_lost(struct logshm_reader *reader)
+{
+	return reader->lost;
+}
+
+static const char *logshm_comm(struct logshm_reader *reader, uint32_t pid)
+{
+	__typeof__(reader->comms[0]) *c = &reader->comms[pid % LOGSHM_COMM_CACHE];
+	if (c->pid == pid)
+		return c->comm;
+	char path[32];
+	sprintf(path, "/proc/%u/comm", pid);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	int size = fd >= 0 ? read(fd, c->comm, 16) : -1;
+	if (fd >= 0)
+		close(fd);
+	if (size <= 0) {
+		/* Process is gone, do not cache: the pid may come back as someone else */
+		strcpy(c->comm, "?");
+		c->pid = 0;
+		return c->comm;
+	}
+	c->comm[c->comm[size - 1] == '\n' ? size - 1 : size] = '\0';
+	c->pid = pid;
+	return c->comm;
+}
+
+#define ARG_GET(type, tag, var) \
+	({ \
+		int __ok = pos + 1 + sizeof(type) <= rec->size && rec->args[pos] == (tag); \
+		if (__ok) { \
+			memcpy(&(var), rec->args + pos + 1, sizeof(type)); \
+			pos += 1 + sizeof(type); \
+		} \
+		__ok; \
+	})
+
+/*
+ * logshm_render() -
+ * Replay @format against the encoded arguments, one conversion at a time,
+ * rewriting length modifiers to match how the values were widened.
+ */
+static int logshm_render(struct logshm_reader *reader, const struct logshm_record *rec,
+	const char *format, char *buf, int size)
+{
+	struct logshm_spec spec;
+	const char *p = format;
+	char sub[64];
+	int off, pos = 0;
+	time_t sec = rec->time / 1000000000ull;
+	if (sec != reader->sec) {
+		struct tm tm;
+		if (localtime_r(&sec, &tm))
+			strftime(reader->stamp, sizeof(reader->stamp), "%c ", &tm);
+		else
+			reader->stamp[0] = '\0';
+		reader->sec = sec;
+	}
+	off = snprintf(buf, size, "%s%s[%u:%u]: ", reader->stamp, logshm_comm(reader, rec->pid), rec->pid, rec->tid);
+	while (*p && off < size - 1) {
+		if (*p != '%') {
+			buf[off++] = *p++;
+			continue;
+		}
+		if (p[1] == '%') {
+			buf[off++] = '%';
+			p += 2;
+			continue;
+		}
+		if (logshm_spec_parse(p + 1, &spec) < 0 || spec.end - p > sizeof(sub) - 24) {
+			buf[off++] = *p++;
+			continue;
+		}
+		/* Rebuild the specification with '*' resolved */
+		const char *s;
+		int n = 0, ok = 1;
+		sub[n++] = '%';
+		for (s = p + 1; s < spec.lenpos; s++) {
+			if (*s == '*') {
+				int64_t v = 0;
+				ok = ok && ARG_GET(int64_t, ARG_SIGNED, v);
+				if (s[-1] == '.' && v < 0)
+					n--;	/* Negative precision, as if omitted */
+				else
+					n += sprintf(sub + n, "%d", (int)v);
+			} else {
+				sub[n++] = *s;
+			}
+		}
+		int rest = size - off;
+		int len = 0;
+		switch (spec.conv) {
+		case 'd': case 'i': case 'c': {
+			int64_t v;
+			if (!ok || !ARG_GET(int64_t, ARG_SIGNED, v))
+				goto missing;
+			if (spec.conv == 'c') {
+				sprintf(sub + n, "c");
+				len = snprintf(buf + off, rest, sub, (int)v);
+			} else {
+				sprintf(sub + n, "ll%c", spec.conv);
+				len = snprintf(buf + off, rest, sub, (long long)v);
+			}
+			break;
+		}
+		case 'o': case 'u': case 'x': case 'X': {
+			uint64_t v;
+			if (!ok || !ARG_GET(uint64_t, ARG_UNSIGNED, v))
+				goto missing;
+			sprintf(sub + n, "ll%c", spec.conv);
+			len = snprintf(buf + off, rest, sub, (unsigned long long)v);
+			break;
+		}
+		case 'f': case 'F': case 'e': case 'E':
+		case 'g': case 'G': case 'a': case 'A': {
+			double v;
+			if (!ok || !ARG_GET(double, ARG_DOUBLE, v))
+				goto missing;
+			sprintf(sub + n, "%c", spec.conv);
+			len = snprintf(buf + off, rest, sub, v);
+			break;
+		}
+		case 's':
+			if (spec.length == LEN_NONE) {
+				uint16_t slen;
+				if (!ok || pos + 3 > rec->size || rec->args[pos] != ARG_STRING)
+					goto missing;
+				memcpy(&slen, rec->args + pos + 1, sizeof(slen));
+				if (pos + 3 + slen > rec->size)
+					goto missing;
+				char str[LOGSHM_ARGS_MAX];
+				memcpy(str, rec->args + pos + 3, slen);
+				str[slen] = '\0';
+				sprintf(sub + n, "s");
+				len = snprintf(buf + off, rest, sub, str);
+				pos += 3 + slen;
+				break;
+			}
+		case 'p': {
+			uint64_t v;
+			if (!ok || !ARG_GET(uint64_t, ARG_POINTER, v))
+				goto missing;
+			len = snprintf(buf + off, rest, "%p", (void *)(uintptr_t)v);
+			break;
+		}
+		case 'n':
+			break;
+		}
+		off += len < rest ? len : rest - 1;
+		p = spec.end;
+		continue;
+missing:
+		len = snprintf(buf + off, rest, "<?>");
+		off += len < rest ? len : rest - 1;
+		p = spec.end;
+	}
+	if (rec->flags & LOGSHM_FLAG_TRUNCATED && off + sizeof(" <truncated>\n") <= size) {
+		if (off > 0 && buf[off - 1] == '\n')
+			off--;
+		off += sprintf(buf + off, " <truncated>\n");
+	}
+	if (off > 0 && buf[off - 1] != '\n') {
+		if (off >= size - 1)
+			off = size - 2;
+		buf[off++] = '\n';
+	}
+	buf[off] = '\0';
+	return off;
+}
+
+int logshm_reader_next(struct logshm_reader *reader, char *buf, int size)
+{
+	struct logshm *shm = &reader->shm;
+	struct logshm_record rec;
+	uint32_t n = shm->header->nrecords;
+	if (size < 64)
+		return -1;
+	for (;;) {
+		uint64_t head = aop_get(&shm->header->head);
+		if (reader->cursor >= head)
+			return 0;
+		if (head - reader->cursor > n) {
+			reader->lost  += head - n - reader->cursor;
+			reader->cursor = head - n;
+		}
+		struct logshm_record *slot = logshm_record(shm, reader->cursor);
+		uint64_t seq = aop_get(&slot->seq);
+		if (seq != reader->cursor + 1) {
+			/*
+			 * Not committed yet: give the producer a chance unless the ring is
+			 * about to lap us, it may also have died in the middle of the write.
+			 */
+			if (seq < reader->cursor + 1
+				&& head - reader->cursor < n / 2
+				&& ++reader->stalls < LOGSHM_READ_STALLS) {
+				/* Usually a matter of nanoseconds, don't make the caller sleep for it */
+				if (reader->stalls % LOGSHM_READ_SPINS)
+					sched_yield();
+				else
+					return 0;
+				continue;
+			}
+			reader->stalls = 0;
+			reader->lost++;
+			reader->cursor++;
+			continue;
+		}
+		memcpy(&rec, slot, sizeof(rec));
+		aop_barrier();
+		if (aop_get(&slot->seq) != reader->cursor + 1) {
+			/* Overwritten while copying */
+			reader->lost++;
+			reader->cursor++;
+			continue;
+		}
+		reader->stalls = 0;
+		reader->cursor++;
+		if (rec.size > LOGSHM_ARGS_MAX)
+			rec.size = LOGSHM_ARGS_MAX;
+		if (rec.format == 0 || rec.format >= LOGSHM_FORMATS
+			|| aop_get(&shm->formats[rec.format].state) != 2)
+			return logshm_render(reader, &rec, "<format table full>\n", buf, size);
+		return logshm_render(reader, &rec, shm->formats[rec.format].text, buf, size);
+	}
+}
@@ -44,6 +44,15 @@
 #error "can not supported atomic operation."
 #endif
 
+#if ((__GNUC__ * 10000 + __GNUC_MINOR__ * 100 + __GNUC_PATCHLEVEL__) >= 40700)
+/* Acquire load and release store, no full barrier: for single-writer publication of data */
+#define aop_load_acquire(ptr)         (__atomic_load_n((ptr), __ATOMIC_ACQUIRE))
+#define aop_store_release(ptr, value) (__atomic_store_n((ptr), (value), __ATOMIC_RELEASE))
+#else
+#define aop_load_acquire(ptr)         aop_get(ptr)
+#define aop_store_release(ptr, value) do { aop_barrier(); *(ptr) = (value); } while (0)
+#endif
+
 #define aop_inc(ptr)             ((void)aop_addf((ptr), 1))
 #define aop_dec(ptr)             ((void)aop_subf((ptr), 1))
 #define aop_add(ptr, val)        ((void)aop_addf((ptr), (val)))
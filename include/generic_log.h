@@ -1,19 +1,64 @@
 #ifndef __GENERIC_LOG_H__
 #define __GENERIC_LOG_H__
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 int  GENERIC_LOG_INIT(const char *file_path, int file_size, int file_count);
 void GENERIC_LOG(const char *format, ...);
+void GENERIC_LOGL(int level, const char *format, ...);
 void SIMPLE_LOG(const char *file_path, int file_size, const char *format, ...);
+/*
+ * Runtime log level, initialized from environment variable GENERIC_LOG_LEVEL: 
+ * a number or a name - none, error, warn, info, debug.
+ */
+enum {
+	GENERIC_LOG_LEVEL_NONE = 0,
+	GENERIC_LOG_LEVEL_E,
+	GENERIC_LOG_LEVEL_W,
+	GENERIC_LOG_LEVEL_I,
+	GENERIC_LOG_LEVEL_D,
+};
+extern int generic_log_level;
+#define generic_log_enabled(level)	(generic_log_level >= (level))
+/* Only debug lines are expected to be off, @level is a constant */
+#define generic_log_wanted(level)	((level) == GENERIC_LOG_LEVEL_D ? \
+										__builtin_expect(generic_log_enabled(level), 0) : generic_log_enabled(level))
+/*
+ * generic_log_parse - parse log level from a number or a name: none, error, warn, info, debug.
+ * Names may be abbreviated, the levels of ipc log are parsed by it as well.
+ * Return -1 if @level is invalid.
+ */
+static inline int generic_log_parse(const char *level)
+{
+	static const char *names[] = {"none", "error", "warn", "info", "debug"};
+	int i;
+	char *end;
+	long n = strtol(level, &end, 10);
+	if (end != level && *end == '\0')
+		return (n >= GENERIC_LOG_LEVEL_NONE && n <= GENERIC_LOG_LEVEL_D) ? (int)n : -1;
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (level[0] && !strncasecmp(level, names[i], strlen(level)))
+			return i;
+	}
+	return -1;
+}
 #define __GENERIC_DBG 1
 #if __GENERIC_DBG
-#define LOGI(format,...) GENERIC_LOG("I %s: %s(%d): "format"\n", __LOG_TAG, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOGW(format,...) GENERIC_LOG("W %s: %s(%d): "format"\n", __LOG_TAG, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOGE(format,...) GENERIC_LOG("E %s: %s(%d): "format"\n", __LOG_TAG, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOGD(format,...) GENERIC_LOG("D %s: %s(%d): "format"\n", __LOG_TAG, __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define GENERIC_LOGX(level, tag, format,...) \
+	do { \
+		if (generic_log_wanted(level)) \
+			GENERIC_LOGL(level, tag" %s: %s(%d): "format"\n", __LOG_TAG, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
+	} while (0)
 #else
-#define LOGI(format,...) SIMPLE_LOG(__LOG_FILE, __LOG_SIZE, "I %s: %s(%d): "format"\n", __LOG_TAG, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOGW(format,...) SIMPLE_LOG(__LOG_FILE, __LOG_SIZE, "W %s: %s(%d): "format"\n", __LOG_TAG, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOGE(format,...) SIMPLE_LOG(__LOG_FILE, __LOG_SIZE, "E %s: %s(%d): "format"\n", __LOG_TAG, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOGD(format,...) SIMPLE_LOG(__LOG_FILE, __LOG_SIZE, "D %s: %s(%d): "format"\n", __LOG_TAG, __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define GENERIC_LOGX(level, tag, format,...) \
+	do { \
+		if (generic_log_wanted(level)) \
+			SIMPLE_LOG(__LOG_FILE, __LOG_SIZE, tag" %s: %s(%d): "format"\n", __LOG_TAG, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
+	} while (0)
 #endif
+#define LOGI(format,...) GENERIC_LOGX(GENERIC_LOG_LEVEL_I, "I", format, ##__VA_ARGS__)
+#define LOGW(format,...) GENERIC_LOGX(GENERIC_LOG_LEVEL_W, "W", format, ##__VA_ARGS__)
+#define LOGE(format,...) GENERIC_LOGX(GENERIC_LOG_LEVEL_E, "E", format, ##__VA_ARGS__)
+#define LOGD(format,...) GENERIC_LOGX(GENERIC_LOG_LEVEL_D, "D", format, ##__VA_ARGS__)
 #endif
@@ -0,0 +1,90 @@
+#ifndef __GENERIC_LOGSHM_H__
+#define __GENERIC_LOGSHM_H__
+#include <stdint.h>
+#include <stdarg.h>
+/*
+ * Shared memory binary log ring.
+ *
+ * Segment layout in /dev/shm/<name>:
+ *   struct logshm_header | format table | record ring
+ *
+ * Producers never format or touch the disk: a record carries the timestamp,
+ * pid, tid, level, the id of its format string and the raw arguments.
+ * Format strings are interned once into the shared format table, so a reader
+ * renders records of any process attached to the same segment.
+ *
+ * Slots are claimed with one atomic fetch-add on @head, the ring overwrites
+ * the oldest records when the reader falls behind; the reader notices that
+ * through @seq and reports them as lost.
+ */
+#define LOGSHM_MAGIC			0x4c4f4753	/* "LOGS" */
+#define LOGSHM_VERSION			1
+#define LOGSHM_RECORDS			4096		/* Default ring size, power of 2 */
+#define LOGSHM_FORMATS			1024		/* Format table slots */
+#define LOGSHM_FORMAT_MAX		248
+#define LOGSHM_RECORD_SIZE		256
+#define LOGSHM_ARGS_MAX			(LOGSHM_RECORD_SIZE - 32)
+
+#define LOGSHM_FLAG_TRUNCATED	0x01	/* Arguments did not fit into the record */
+
+struct logshm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nrecords;
+	uint32_t nformats;
+	uint64_t overflow;		/* Format table full, record written with format id 0 */
+	uint8_t  __pad[40];
+	uint64_t head;			/* Next position to claim, on its own cache line */
+	uint8_t  __pad1[56];
+};
+
+struct logshm_format {
+	uint32_t state;			/* 0: empty, 1: writing, 2: ready */
+	uint32_t hash;
+	char text[LOGSHM_FORMAT_MAX];
+};
+
+struct logshm_record {
+	uint64_t seq;			/* Position + 1 once committed, 0 while being written */
+	uint64_t time;			/* CLOCK_REALTIME in nanoseconds */
+	uint32_t pid;
+	uint32_t tid;
+	uint16_t format;		/* Index into the format table, 0 means none */
+	uint8_t  level;
+	uint8_t  flags;
+	uint16_t size;			/* Bytes used in @args */
+	uint16_t __pad;
+	uint8_t  args[LOGSHM_ARGS_MAX];
+};
+
+/**
+ * GENERIC_LOG_SHM_INIT - route GENERIC_LOG() of this process into a shared ring.
+ * @name: segment name under /dev/shm, created if it does not exist yet.
+ * @records: ring size used when creating the segment, 0 for LOGSHM_RECORDS.
+ *
+ * Setting environment variable GENERIC_LOG_SHM=<name> has the same effect
+ * without code changes. Returns 0 on success, -1 otherwise, in which case
+ * GENERIC_LOG() keeps writing text files.
+ */
+int GENERIC_LOG_SHM_INIT(const char *name, int records);
+
+int logshm_attached();
+void logshm_write(int level, const char *format, va_list ap);
+
+/*
+ * Reader side, used by the collector.
+ */
+struct logshm_reader;
+struct logshm_reader *logshm_reader_open(const char *name, int records);
+/**
+ * logshm_reader_next - render the next record.
+ * @buf: receives one text line, including the trailing newline.
+ * @size: size of @buf.
+ *
+ * Returns the length of the line, 0 if there is nothing to read yet,
+ * or -1 on error.
+ */
+int  logshm_reader_next(struct logshm_reader *reader, char *buf, int size);
+uint64_t logshm_reader_lost(struct logshm_reader *reader);
+void logshm_reader_close(struct logshm_reader *reader);
+#endif
@@ -1,5 +1,7 @@
 /*
  * Copyright (c) 2020, <-Jason Chen->
+ * Version: 1.2.2 - 20261019
+ *				  - Add recv_packet(), recv_packetv(): receiving of SOCK_SEQPACKET connections.
  * Version: 1.2.1 - 20230316
  *				  - Optimize ipc_server_bind(IPC_COOKIE_ASYNC):
  *					Remove allocating fixed length of ipc_msg for ipc_async in ipc_server_bind(),
@@ -259,6 +261,253 @@ int recv_msg(int sock,  char *buf, unsigned int size, int tmo)
 		return friendly(msg) ? offset : IPC_RECEIVE_EMSG;
 	} while (1);
 }
+/*
+ * recv_full - receive exactly the bytes described by @iov.
+ * @iov is consumed while receiving, callers should pass a scratch copy.
+ * On success, zero is returned.
+ */
+static int recv_full(int sock, struct iovec *iov, int iovcnt, struct timeval *timeout)
+{
+	int len;
+	struct msghdr mh;
+	memset(&mh, 0, sizeof(mh));
+	while (iovcnt > 0) {
+		if (iov->iov_len == 0) {
+			iov++;
+			iovcnt--;
+			continue;
+		}
+		mh.msg_iov 	  = iov;
+		mh.msg_iovlen = iovcnt;
+		len = recvmsg(sock, &mh, MSG_DONTWAIT);
+		if (len > 0) {
+			while (len > 0 && len >= iov->iov_len) {
+				len -= iov->iov_len;
+				iov++;
+				iovcnt--;
+			}
+			if (len > 0) {
+				iov->iov_base = (char *)iov->iov_base + len;
+				iov->iov_len -= len;
+			}
+			continue;
+		}
+		if (len == 0)
+			return IPC_RECEIVE_EOF;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			IPC_LOGE("Recv errno:%d", errno);
+			return IPC_RECEIVE_ERR;
+		}
+		len = recv_wait(sock, timeout);
+		if (len == 0) {
+			IPC_LOGE("Recv wait timedout.");
+			return IPC_RECEIVE_TMO;
+		}
+		if (len < 0) {
+			IPC_LOGE("Recv wait errno:%d", errno);
+			return IPC_RECEIVE_ERR;
+		}
+	}
+	return 0;
+}
+/*
+ * send_vec - send the header @msg followed by the payload pieces vec[1..veccnt-1] in one sendmsg().
+ * vec[0] is reserved for the header and filled here, the caller sizes @vec (at most IPC_BATCH_MAX + 1).
+ * |msg->data_len| must be the total length of the payload pieces.
+ */
+int send_vec(int sock, struct ipc_msg *msg, struct iovec *vec, int veccnt)
+{
+	struct msghdr mh;
+	if (veccnt < 1 || veccnt > IPC_BATCH_MAX + 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	vec[0].iov_base = msg;
+	vec[0].iov_len  = IPC_MSG_HDRLEN;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov 	  = vec;
+	mh.msg_iovlen = veccnt;
+	msg->msg_id |= IPC_MSG_TOKEN;
+	return sendmsg(sock, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+/*
+ * send_msgv - send the header @msg followed by the payload pieces @iov in one sendmsg().
+ * |msg->data_len| must be the total length of @iov.
+ */
+int send_msgv(int sock, struct ipc_msg *msg, const struct iovec *iov, int iovcnt)
+{
+	int i;
+	struct iovec vec[IPC_IOV_MAX + 1];
+	if (iovcnt < 0 || iovcnt > IPC_IOV_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < iovcnt; i++)
+		vec[i + 1] = iov[i];
+	return send_vec(sock, msg, vec, iovcnt + 1);
+}
+/*
+ * recv_msgv - receive one message, the header into @msg and the payload straight into @iov.
+ * Payload exceeding the capacity of @iov is drained and discarded,
+ * |msg->data_len| always keeps the full payload length sent by peer.
+ * On success, the number of payload bytes stored into @iov is returned.
+ */
+int recv_msgv(int sock, struct ipc_msg *msg, const struct iovec *iov, int iovcnt, int tmo)
+{
+	int i, n, rc;
+	char scrap[256];
+	unsigned int left, stored = 0;
+	struct iovec vec[IPC_IOV_MAX];
+	struct timeval tv, *timeout = NULL;
+	if (tmo >= 0) {
+		timeout = &tv;
+		timeout->tv_sec  = tmo;
+		timeout->tv_usec = 0;
+	}
+	if (iovcnt < 0 || iovcnt > IPC_IOV_MAX)
+		return IPC_RECEIVE_EVAL;
+
+	vec[0].iov_base = msg;
+	vec[0].iov_len  = IPC_MSG_HDRLEN;
+	rc = recv_full(sock, vec, 1, timeout);
+	if (rc < 0)
+		return rc;
+	if (!friendly(msg))
+		return IPC_RECEIVE_EMSG;
+
+	left = msg->data_len;
+	for (i = 0, n = 0; i < iovcnt && left > 0; i++, n++) {
+		vec[n] = iov[i];
+		if (vec[n].iov_len > left)
+			vec[n].iov_len = left;
+		left   -= vec[n].iov_len;
+		stored += vec[n].iov_len;
+	}
+	rc = recv_full(sock, vec, n, timeout);
+	if (rc < 0)
+		return rc;
+	if (left > 0)
+		IPC_LOGW("No enough space, msglen:%u, stored:%u.", msg->data_len, stored);
+	while (left > 0) {
+		vec[0].iov_base = scrap;
+		vec[0].iov_len  = left > sizeof(scrap) ? sizeof(scrap) : left;
+		left -= vec[0].iov_len;
+		rc = recv_full(sock, vec, 1, timeout);
+		if (rc < 0)
+			return rc;
+	}
+	return (int)stored;
+}
+/*
+ * recv_packet - receive one message from a SOCK_SEQPACKET socket, one recv() per message.
+ * @tmo: seconds to wait, 0 for no wait, negative for ever.
+ * A message larger than @size is dropped as a whole and IPC_RECEIVE_EMEM returned.
+ * On success, the length of the message is returned.
+ */
+int recv_packet(int sock, char *buf, unsigned int size, int tmo)
+{
+	int len;
+	struct timeval tv;
+	struct ipc_msg *msg = (struct ipc_msg *)buf;
+	if (size < IPC_MSG_HDRLEN)
+		return IPC_RECEIVE_EVAL;
+	for (;;) {
+		len = recv(sock, buf, size, MSG_DONTWAIT | MSG_TRUNC);
+		if (len > 0)
+			break;
+		if (len == 0)
+			return IPC_RECEIVE_EOF;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			IPC_LOGE("Recv errno:%d", errno);
+			return IPC_RECEIVE_ERR;
+		}
+		if (tmo == 0)
+			return IPC_RECEIVE_TMO;
+		tv.tv_sec  = tmo;
+		tv.tv_usec = 0;
+		len = recv_wait(sock, tmo > 0 ? &tv : NULL);
+		if (len == 0) {
+			IPC_LOGE("Recv wait timedout.");
+			return IPC_RECEIVE_TMO;
+		}
+		if (len < 0) {
+			IPC_LOGE("Recv wait errno:%d", errno);
+			return IPC_RECEIVE_ERR;
+		}
+	}
+	if (len > size) {
+		IPC_LOGE("Message truncated, msglen: %d, size: %u", len, size);
+		return IPC_RECEIVE_EMEM;
+	}
+	if (len < IPC_MSG_HDRLEN || len != __data_len(msg)) {
+		IPC_LOGE("Bad message length: %d", len);
+		return IPC_RECEIVE_EMSG;
+	}
+	return friendly(msg) ? len : IPC_RECEIVE_EMSG;
+}
+/*
+ * recv_packetv - recv_msgv() of SOCK_SEQPACKET sockets, one recvmsg() per message.
+ * Payload exceeding the capacity of @iov is discarded by the kernel.
+ */
+int recv_packetv(int sock, struct ipc_msg *msg, const struct iovec *iov, int iovcnt, int tmo)
+{
+	int i, len;
+	unsigned int stored;
+	struct msghdr mh;
+	struct timeval tv;
+	struct iovec vec[IPC_IOV_MAX + 1];
+	if (iovcnt < 0 || iovcnt > IPC_IOV_MAX)
+		return IPC_RECEIVE_EVAL;
+	vec[0].iov_base = msg;
+	vec[0].iov_len	= IPC_MSG_HDRLEN;
+	for (i = 0; i < iovcnt; i++)
+		vec[i + 1] = iov[i];
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov	  = vec;
+	mh.msg_iovlen = iovcnt + 1;
+	for (;;) {
+		len = recvmsg(sock, &mh, MSG_DONTWAIT | MSG_TRUNC);
+		if (len > 0)
+			break;
+		if (len == 0)
+			return IPC_RECEIVE_EOF;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			IPC_LOGE("Recv errno:%d", errno);
+			return IPC_RECEIVE_ERR;
+		}
+		if (tmo == 0)
+			return IPC_RECEIVE_TMO;
+		tv.tv_sec  = tmo;
+		tv.tv_usec = 0;
+		len = recv_wait(sock, tmo > 0 ? &tv : NULL);
+		if (len == 0) {
+			IPC_LOGE("Recv wait timedout.");
+			return IPC_RECEIVE_TMO;
+		}
+		if (len < 0) {
+			IPC_LOGE("Recv wait errno:%d", errno);
+			return IPC_RECEIVE_ERR;
+		}
+	}
+	if (len < IPC_MSG_HDRLEN || len != __data_len(msg) || !friendly(msg)) {
+		IPC_LOGE("Bad message length: %d", len);
+		return IPC_RECEIVE_EMSG;
+	}
+	stored = len - IPC_MSG_HDRLEN;
+	for (i = 0, len = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (stored > (unsigned int)len) {
+		IPC_LOGW("No enough space, msglen:%u, stored:%d.", msg->data_len, len);
+		stored = len;
+	}
+	return (int)stored;
+}
 struct ipc_buf * alloc_buf(unsigned int size)
 {
 	size += IPC_MSG_HDRLEN;
@@ -305,3 +554,139 @@ void ipc_free_msg(struct ipc_msg *msg)
 	IPC_LOGI("free message @%p", msg);
 	free((void *)msg);
 }
+/*
+ * Item posted to several serial queues by ipc_serial_post_join(), one stop queued per serial queue.
+ */
+struct ipc_serial_join;
+struct ipc_serial_stop
+{
+	struct ipc_serial_item item;
+	struct ipc_serial *serial;
+	struct ipc_serial_join *join;
+};
+struct ipc_serial_join
+{
+	struct ipc_serial_item *item;
+	int pending;	/* Stops not reached yet, protected by the shared mutex */
+	int count;
+	struct ipc_serial_stop stops[];
+};
+static void ipc_serial_run(void *arg);
+static void ipc_serial_resume(struct ipc_serial *serial)
+{
+	if (serial->executor->execute(serial->executor->ctx, ipc_serial_run, serial) != 0) {
+		/* Executor refused, drain in the calling context to keep the order */
+		IPC_LOGW("Serial@%p executor refused.", serial);
+		ipc_serial_run(serial);
+	}
+}
+/*
+ * ipc_serial_joint - the last serial queue reaching its stop runs the item,
+ * then hands the other ones, parked at their stops, back to the executor.
+ */
+static void ipc_serial_joint(struct ipc_serial_join *join, struct ipc_serial *self)
+{
+	int i;
+	join->item->func(join->item);
+	for (i = 0; i < join->count; i++) {
+		if (join->stops[i].serial != self)
+			ipc_serial_resume(join->stops[i].serial);
+	}
+	free(join);
+}
+static void ipc_serial_run(void *arg)
+{
+	struct ipc_serial *serial = arg;
+	struct ipc_serial_item *item;
+	struct ipc_serial_stop *stop;
+	pthread_mutex_lock(serial->mutex);
+	while (!list_empty(&serial->head)) {
+		item = list_first_entry(&serial->head, struct ipc_serial_item, list);
+		list_del_init(&item->list);
+		if (!item->func) {
+			stop = container_of(item, struct ipc_serial_stop, item);
+			if (--stop->join->pending > 0) {
+				/* Parked, still running, until the joint item is done */
+				pthread_mutex_unlock(serial->mutex);
+				return;
+			}
+			pthread_mutex_unlock(serial->mutex);
+			ipc_serial_joint(stop->join, serial);
+			pthread_mutex_lock(serial->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(serial->mutex);
+		item->func(item);
+		pthread_mutex_lock(serial->mutex);
+	}
+	serial->running = 0;
+	pthread_cond_broadcast(serial->cond);
+	pthread_mutex_unlock(serial->mutex);
+}
+void ipc_serial_init(struct ipc_serial *serial, const struct ipc_executor *executor, 
+					pthread_mutex_t *mutex, pthread_cond_t *cond)
+{
+	serial->running	 = 0;
+	serial->mutex	 = mutex;
+	serial->cond	 = cond;
+	serial->executor = executor;
+	INIT_LIST_HEAD(&serial->head);
+}
+/*
+ * ipc_serial_post - queue @item, the serial queue is handed to the executor only when it is idle.
+ */
+void ipc_serial_post(struct ipc_serial *serial, struct ipc_serial_item *item)
+{
+	int idle;
+	pthread_mutex_lock(serial->mutex);
+	list_add_tail(&item->list, &serial->head);
+	idle = !serial->running;
+	serial->running = 1;
+	pthread_mutex_unlock(serial->mutex);
+	if (idle)
+		ipc_serial_resume(serial);
+}
+/*
+ * ipc_serial_post_join - queue @item to all of @serials, which must share one mutex:
+ * it runs once, after the items posted before it to any of @serials, 
+ * and before the items posted after it to any of them.
+ * No thread is blocked meanwhile, the serial queues reaching it first stay parked.
+ * Returns -1 if out of memory, @item is not queued.
+ */
+int ipc_serial_post_join(struct ipc_serial *serials[], int count, struct ipc_serial_item *item)
+{
+	int i, idle[count];
+	struct ipc_serial_join *join = 
+		(struct ipc_serial_join *)malloc(sizeof(struct ipc_serial_join) + count * sizeof(struct ipc_serial_stop));
+	if (!join)
+		return -1;
+	join->item	  = item;
+	join->pending = count;
+	join->count	  = count;
+	pthread_mutex_lock(serials[0]->mutex);
+	for (i = 0; i < count; i++) {
+		join->stops[i].item.func = NULL;
+		join->stops[i].serial	 = serials[i];
+		join->stops[i].join		 = join;
+		list_add_tail(&join->stops[i].item.list, &serials[i]->head);
+		idle[i] = !serials[i]->running;
+		serials[i]->running = 1;
+	}
+	pthread_mutex_unlock(serials[0]->mutex);
+	for (i = 0; i < count; i++) {
+		if (idle[i])
+			ipc_serial_resume(serials[i]);
+	}
+	return 0;
+}
+/*
+ * ipc_serial_wait - wait until all the items posted have been done.
+ * Must not be called in the context of an item of @serial.
+ */
+void ipc_serial_wait(struct ipc_serial *serial)
+{
+	pthread_mutex_lock(serial->mutex);
+	while (serial->running)
+		pthread_cond_wait(serial->cond, serial->mutex);
+	pthread_mutex_unlock(serial->mutex);
+}
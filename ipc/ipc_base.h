@@ -11,10 +11,14 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include "list.h"
 #include "ipc_common.h"
 #include "ipc_atomic.h"
 #define UNIX_SOCK_DIR "/tmp/"
+#define IPC_SEQPACKET_SUFFIX ".sp"	/* Path suffix of the SOCK_SEQPACKET listener, see IPC_SEROPT_ENABLE_SEQPACKET */
 
 #define IPC_RECEIVE_TMO			-IPC_ETIMEOUT
 #define IPC_RECEIVE_EOF			-IPC_EOF
@@ -44,12 +48,24 @@ enum IPC_MSG_ID
 	IPC_SDK_MSG_REGISTER,    	/* client send this msg, launch a callback register */
 	IPC_SDK_MSG_SYNC,			/* client send this msg to notify server that client is ready and callback begin to work */
 	IPC_SDK_MSG_UNREGISTER,		/* server push this msg to client, release the callback */
-	IPC_SDK_MSG_NOTIFY			/* server push this msg to client's callback */
+	IPC_SDK_MSG_NOTIFY,			/* server push this msg to client's callback */
+	IPC_SDK_MSG_BATCH,			/* envelope of requests from client, or envelope of their replies from server */
+	IPC_SDK_MSG_LOGLEVEL,		/* client send this msg to query or change log level of server */
+	IPC_SDK_MSG_STATS,			/* client send this msg to read statistics of server, see struct ipc_stats */
+};
+struct ipc_loglevel
+{
+	int module;		/* enum IPC_LOG_MODULE */
+	int level;		/* enum IPC_LOG_LEVEL, negative for query only. Replied with the previous level */
 };
 struct ipc_identity
 {
 	int identity;
 };
+/*
+ * Register message, optional struct ipc_filter array follows |data|, 
+ * the count is calculated from the message length.
+ */
 struct ipc_reg
 {
 	unsigned long 	mask;
@@ -70,8 +86,29 @@ struct ipc_negotiation
 {
 	unsigned int 	buf_size;
 };
+/*
+ * Serial queue on top of struct ipc_executor: 
+ * items posted to the same serial queue run in order and one at a time,
+ * while different serial queues run in parallel.
+ */
+struct ipc_serial_item
+{
+	struct list_head list;
+	void (*func)(struct ipc_serial_item *);	/* NULL for a stop of ipc_serial_post_join() */
+};
+struct ipc_serial
+{
+	int running;
+	pthread_mutex_t *mutex;	/* May be shared among a group of serial queues */
+	pthread_cond_t	*cond;	/* Broadcast when serial queue turns idle */
+	const struct ipc_executor *executor;
+	struct list_head head;
+};
 #define gettid()					syscall(__NR_gettid)
 #define IPC_NOTIFY_MSG_MAX_SIZE 1024
+#define IPC_IOV_MAX				16	/* Max payload pieces of ipc_client_requestv() */
+#define IPC_BATCH_MAX			64	/* Max requests in one envelope of ipc_client_batch() */
+#define IPC_BATCH_SIZE			0xffff		/* Max payload length of the envelope */
 #define server_offset(path)			((path) + sizeof(UNIX_SOCK_DIR) - 1)
 #define users_msg(msg)				((msg)->msg_id < IPC_MSG_SDK)
 #define topic_isset(pr, topic) 		((pr)->mask & (topic))
@@ -92,6 +129,18 @@ static inline int topic_check(unsigned long topic)
 {
 	return !(topic & (topic -1));
 }
+static inline int filter_check(const struct ipc_filter *filter)
+{
+	switch (filter->type) {
+	case IPC_FILTER_MSGID:
+		return filter->count > 0 && filter->count <= IPC_FILTER_MSGIDS;
+	case IPC_FILTER_EQUAL:
+	case IPC_FILTER_MASK:
+		return filter->length > 0 && filter->length <= IPC_FILTER_BYTES;
+	default:
+		return 0;
+	}
+}
 #define ipc_notify_pack(msg, dest, mask, msg_id, data, size) do {\
 	struct ipc_notify *__n = ipc_msg_payload_of(msg, struct ipc_notify);\
 	__n->topic = mask;\
@@ -131,5 +180,19 @@ struct ipc_msg * find_msg(struct ipc_buf *buf, struct ipc_msg *clone);
 int recv_wait(int sock, struct timeval *timeout);
 int recv_stream(int sock, void *buffer, unsigned int size, struct timeval *timeout);
 int recv_msg(int sock,  char *buf, unsigned int size, int tmo);
+int send_vec(int sock, struct ipc_msg *msg, struct iovec *vec, int veccnt);
+int send_msgv(int sock, struct ipc_msg *msg, const struct iovec *iov, int iovcnt);
+int recv_msgv(int sock, struct ipc_msg *msg, const struct iovec *iov, int iovcnt, int tmo);
+int recv_packet(int sock, char *buf, unsigned int size, int tmo);
+int recv_packetv(int sock, struct ipc_msg *msg, const struct iovec *iov, int iovcnt, int tmo);
+/* In-process loopback of ipc_client_request(), implemented by the server core */
+#define IPC_LOOPBACK_NONE	1
+int ipc_loopback_request(const char *path, int from, struct ipc_msg *msg, unsigned int size, int tmo);
+unsigned int ipc_loopback_size(const char *path);
 int sock_opts(int sock, int tmo);
+void ipc_serial_init(struct ipc_serial *serial, const struct ipc_executor *executor, 
+					pthread_mutex_t *mutex, pthread_cond_t *cond);
+void ipc_serial_post(struct ipc_serial *serial, struct ipc_serial_item *item);
+int  ipc_serial_post_join(struct ipc_serial *serials[], int count, struct ipc_serial_item *item);
+void ipc_serial_wait(struct ipc_serial *serial);
 #endif
\ No newline at end of file
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2017, <-Jason Chen->
+ * Version: 1.0.0 - 20261019
+ *				  - IPC traffic capture: messages in both directions with timestamps and connections.
+ * Author: Jie Chen <jasonchen0720@163.com>
+ *
+ * Brief : Traffic capture of IPC server core, replayed by sample/ipc-replay.
+ * Date  : Created at 2026/10/19
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "ipc_base.h"
+#include "ipc_capture.h"
+#include "ipc_trace.h"
+#include "ipc_log.h"
+#define __LOGTAG__ "CAPTURE"
+
+struct ipc_capture {
+	int fd;
+	unsigned int used;
+	uint64_t base;			/* CLOCK_MONOTONIC nanoseconds when capture started */
+	uint64_t flushed;		/* CLOCK_MONOTONIC nanoseconds of last flush */
+	pthread_mutex_t mutex;
+	char buf[IPC_CAPTURE_BUF_SIZE];
+};
+
+static void capture_flush(struct ipc_capture *capture, uint64_t now)
+{
+	unsigned int off = 0;
+	while (off < capture->used) {
+		ssize_t n = write(capture->fd, capture->buf + off, capture->used - off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			IPC_LOGE("capture write error: %s, %u bytes lost.", strerror(errno), capture->used - off);
+			break;
+		}
+		off += n;
+	}
+	capture->used	 = 0;
+	capture->flushed = now;
+}
+/**
+ * ipc_capture_open - create capture file @path, truncated if it exists.
+ * @server: name of server, recorded in the file header.
+ */
+struct ipc_capture *ipc_capture_open(const char *path, const char *server)
+{
+	struct timespec ts;
+	struct ipc_capture_header *hdr;
+	struct ipc_capture *capture = calloc(1, sizeof(struct ipc_capture));
+	if (!capture)
+		return NULL;
+	capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (capture->fd < 0) {
+		IPC_LOGE("open %s error: %s.", path, strerror(errno));
+		free(capture);
+		return NULL;
+	}
+	pthread_mutex_init(&capture->mutex, NULL);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	hdr = (struct ipc_capture_header *)capture->buf;
+	hdr->magic	 = IPC_CAPTURE_MAGIC;
+	hdr->version = IPC_CAPTURE_VERSION;
+	hdr->start	 = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	snprintf(hdr->server, sizeof(hdr->server), "%s", server);
+	capture->used	 = sizeof(*hdr);
+	capture->base	 = ipc_trace_now();
+	capture->flushed = capture->base;
+	return capture;
+}
+/**
+ * ipc_capture_write - record @msg exchanged with a peer, may be called from any thread.
+ */
+void ipc_capture_write(struct ipc_capture *capture, int identity, int sock, int clazz, int dir, const struct ipc_msg *msg)
+{
+	struct ipc_capture_record rec;
+	uint64_t now = ipc_trace_now();
+	unsigned int len = __data_len(msg);
+	rec.time	 = now - capture->base;
+	rec.identity = identity;
+	rec.sock	 = sock;
+	rec.len		 = len;
+	rec.dir		 = dir;
+	rec.clazz	 = clazz;
+	rec.__pad	 = 0;
+	pthread_mutex_lock(&capture->mutex);
+	if (capture->used + sizeof(rec) + len > IPC_CAPTURE_BUF_SIZE)
+		capture_flush(capture, now);
+	memcpy(capture->buf + capture->used, &rec, sizeof(rec));
+	memcpy(capture->buf + capture->used + sizeof(rec), msg, len);
+	capture->used += sizeof(rec) + len;
+	if (now - capture->flushed >= IPC_CAPTURE_FLUSH_NS)
+		capture_flush(capture, now);
+	pthread_mutex_unlock(&capture->mutex);
+}
+
+void ipc_capture_flush(struct ipc_capture *capture)
+{
+	pthread_mutex_lock(&capture->mutex);
+	capture_flush(capture, ipc_trace_now());
+	pthread_mutex_unlock(&capture->mutex);
+}
+
+void ipc_capture_close(struct ipc_capture *capture)
+{
+	ipc_capture_flush(capture);
+	close(capture->fd);
+	pthread_mutex_destroy(&capture->mutex);
+	free(capture);
+}
@@ -0,0 +1,41 @@
+#ifndef __IPC_CAPTURE_H__
+#define __IPC_CAPTURE_H__
+#include <stdint.h>
+#include "ipc_common.h"
+/*
+ * IPC traffic capture.
+ * File layout: struct ipc_capture_header, then one struct ipc_capture_record
+ * per message, each followed by the whole ipc_msg (header and data) as it
+ * went through the socket. Records are in the order they were written, which
+ * is the time order except for sends from publishing and async threads.
+ */
+#define IPC_CAPTURE_MAGIC		0x43435049	/* "IPCC" */
+#define IPC_CAPTURE_VERSION		1
+#define IPC_CAPTURE_BUF_SIZE	(128 * 1024)	/* Holds the largest message */
+#define IPC_CAPTURE_FLUSH_NS	100000000ull	/* Buffered records are written out at least this often */
+
+enum IPC_CAPTURE_DIR {
+	IPC_CAPTURE_IN = 0,		/* Client to server */
+	IPC_CAPTURE_OUT,		/* Server to client */
+};
+struct ipc_capture_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t start;			/* CLOCK_REALTIME nanoseconds when capture started */
+	char	 server[64];
+};
+struct ipc_capture_record {
+	uint64_t time;			/* Nanoseconds since start */
+	int32_t  identity;		/* Identity of peer, -1 for the server itself */
+	int32_t  sock;			/* Connection of peer, identity and sock together tell connections apart */
+	uint32_t len;			/* Length of the ipc_msg following */
+	uint8_t  dir;			/* enum IPC_CAPTURE_DIR */
+	uint8_t  clazz;			/* enum IPC_CLASS of peer */
+	uint16_t __pad;
+};
+struct ipc_capture;
+struct ipc_capture *ipc_capture_open(const char *path, const char *server);
+void ipc_capture_write(struct ipc_capture *capture, int identity, int sock, int clazz, int dir, const struct ipc_msg *msg);
+void ipc_capture_flush(struct ipc_capture *capture);
+void ipc_capture_close(struct ipc_capture *capture);
+#endif
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2017, <-Jason Chen->
+ * Version: 1.0.0 - 20261019
+ *				  - Shared memory broadcast channel, seqlock slots and futex wake-up on demand.
+ * Author: Jie Chen <jasonchen0720@163.com>
+ *
+ * Brief : Broadcast channel of high fan-out topics, see IPC_SEROPT_SET_CHANNEL.
+ * Date  : Created at 2026/10/19
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "ipc_channel.h"
+#include "ipc_common.h"
+#include "ipc_atomic.h"
+#include "ipc_log.h"
+#define __LOGTAG__ "CHANNEL"
+#define IPC_CHANNEL_SLOTS_MAX	(1 << 20)
+#define IPC_CHANNEL_SIZE_MAX	(1 << 20)
+#define IPC_CHANNEL_SPINS		64		/* Yields on a slot being written before giving up */
+
+struct ipc_channel {
+	struct ipc_channel_header *header;
+	char	*ring;
+	size_t	 length;
+	uint32_t mask;
+	int		 writer;
+	uint64_t pos;			/* Reader: next position to read */
+	unsigned long long lost;
+	char	 path[PATH_MAX];
+};
+#define channel_slot(ch, pos)	((struct ipc_channel_slot *)((ch)->ring + ((pos) & (ch)->mask) * (ch)->header->stride))
+
+static inline int futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *ts)
+{
+	return syscall(SYS_futex, uaddr, op, val, ts, NULL, 0);
+}
+static int channel_path(char *path, const char *name)
+{
+	return snprintf(path, PATH_MAX, "/dev/shm/"IPC_CHANNEL_PREFIX"%s", name) < PATH_MAX ? 0 : -1;
+}
+/**
+ * ipc_channel_create - create the segment of channel @name, replacing a stale one.
+ * @slots: ring size, rounded up to a power of 2, 0 for IPC_CHANNEL_SLOTS.
+ * @size: max payload of a value, 0 for IPC_CHANNEL_SIZE.
+ * Readers attached to a replaced segment keep reading the old one until they reopen.
+ */
+struct ipc_channel *ipc_channel_create(const char *name, unsigned int slots, unsigned int size)
+{
+	int fd;
+	unsigned int n = 2, stride;
+	struct ipc_channel_header *header;
+	struct ipc_channel *ch = calloc(1, sizeof(struct ipc_channel));
+	if (!ch)
+		return NULL;
+	if (!slots)
+		slots = IPC_CHANNEL_SLOTS;
+	if (!size)
+		size = IPC_CHANNEL_SIZE;
+	if (size > IPC_CHANNEL_SIZE_MAX || channel_path(ch->path, name) < 0)
+		goto err;
+	while (n < slots && n < IPC_CHANNEL_SLOTS_MAX)
+		n <<= 1;
+	stride = (sizeof(struct ipc_channel_slot) + size + 63) & ~63u;
+	ch->length = sizeof(struct ipc_channel_header) + (size_t)n * stride;
+	unlink(ch->path);
+	fd = open(ch->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		IPC_LOGE("create %s error: %s.", ch->path, strerror(errno));
+		goto err;
+	}
+	if (ftruncate(fd, ch->length) < 0) {
+		close(fd);
+		unlink(ch->path);
+		goto err;
+	}
+	header = mmap(NULL, ch->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		unlink(ch->path);
+		goto err;
+	}
+	header->version = IPC_CHANNEL_VERSION;
+	header->nslots	= n;
+	header->size	= size;
+	header->stride	= stride;
+	ch->header = header;
+	ch->ring   = (char *)(header + 1);
+	ch->mask   = n - 1;
+	ch->writer = 1;
+	ATOMIC_SET(&header->magic, IPC_CHANNEL_MAGIC);
+	IPC_LOGI("channel %s: %u slots of %u bytes.", name, n, size);
+	return ch;
+err:
+	free(ch);
+	return NULL;
+}
+/**
+ * ipc_channel_publish - write one value, O(1) whatever the number of readers.
+ * Returns 0 on success, -1 if @size is over the slot size.
+ */
+int ipc_channel_publish(struct ipc_channel *ch, int msg_id, const void *data, unsigned int size)
+{
+	struct ipc_channel_header *header = ch->header;
+	if (size > header->size)
+		return -1;
+	uint64_t pos = ATOMIC_FADD(&header->head, 1);
+	struct ipc_channel_slot *slot = channel_slot(ch, pos);
+	/* The publisher of the previous lap may still be writing this slot */
+	uint64_t prev = pos >= header->nslots ? 2 * (pos - header->nslots + 1) : 0;
+	while (ATOMIC_GET(&slot->seq) != prev)
+		sched_yield();
+	ATOMIC_SET(&slot->seq, 2 * pos + 1);
+	__sync_synchronize();
+	slot->msg_id = msg_id;
+	slot->size	 = size;
+	if (size)
+		memcpy(slot->data, data, size);
+	__sync_synchronize();
+	ATOMIC_SET(&slot->seq, 2 * (pos + 1));
+	__sync_synchronize();
+	if (ATOMIC_GET(&header->waiters)) {
+		ATOMIC_FADD(&header->futex, 1);
+		futex(&header->futex, FUTEX_WAKE, INT_MAX, NULL);
+	}
+	return 0;
+}
+
+void ipc_channel_destroy(struct ipc_channel *ch)
+{
+	munmap(ch->header, ch->length);
+	unlink(ch->path);
+	free(ch);
+}
+/**
+ * ipc_channel_open - attach to channel @name, reading starts with values published from now on.
+ */
+struct ipc_channel *ipc_channel_open(const char *name)
+{
+	int fd;
+	struct stat st;
+	struct ipc_channel_header *header;
+	struct ipc_channel *ch = calloc(1, sizeof(struct ipc_channel));
+	if (!ch)
+		return NULL;
+	if (channel_path(ch->path, name) < 0)
+		goto err;
+	/* Read-write mapping for the futex and waiters words only */
+	fd = open(ch->path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		goto err;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct ipc_channel_header)) {
+		close(fd);
+		goto err;
+	}
+	header = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED)
+		goto err;
+	ch->header = header;
+	ch->length = st.st_size;
+	if (ATOMIC_GET(&header->magic) != IPC_CHANNEL_MAGIC || header->version != IPC_CHANNEL_VERSION ||
+		sizeof(struct ipc_channel_header) + (size_t)header->nslots * header->stride > ch->length) {
+		munmap(header, ch->length);
+		goto err;
+	}
+	ch->ring = (char *)(header + 1);
+	ch->mask = header->nslots - 1;
+	ch->pos	 = ATOMIC_GET(&header->head);
+	return ch;
+err:
+	free(ch);
+	return NULL;
+}
+/*
+ * Copy the value at @pos.
+ * Returns its size, -1 if not published yet, -2 if overwritten.
+ */
+static int channel_copy(struct ipc_channel *ch, uint64_t pos, int *msg_id, void *buf, unsigned int size)
+{
+	int spins = 0;
+	struct ipc_channel_slot *slot = channel_slot(ch, pos);
+	for (;;) {
+		uint64_t seq = ATOMIC_GET(&slot->seq);
+		if (seq > 2 * (pos + 1))
+			return -2;
+		if (seq != 2 * (pos + 1)) {
+			/* Claimed but being written, or a publisher stalled */
+			if (pos < ATOMIC_GET(&ch->header->head) && spins++ < IPC_CHANNEL_SPINS) {
+				sched_yield();
+				continue;
+			}
+			return -1;
+		}
+		__sync_synchronize();
+		int id = slot->msg_id;
+		unsigned int len = slot->size;
+		if (len > ch->header->size)
+			return -2;	/* Torn */
+		memcpy(buf, slot->data, len < size ? len : size);
+		__sync_synchronize();
+		if (ATOMIC_GET(&slot->seq) != seq)
+			return -2;
+		if (msg_id)
+			*msg_id = id;
+		return len;
+	}
+}
+/**
+ * ipc_channel_read - read the next value.
+ * @msg_id: receives message ID of value, may be null.
+ * @buf: receives the payload, truncated to @size.
+ * @tmo: milliseconds to wait if there is nothing new, 0 for no wait, negative for ever.
+ * Returns the payload size, IPC_REQUEST_TMO (-IPC_ETIMEOUT) if nothing new,
+ * -IPC_EMEM if the payload was truncated.
+ */
+int ipc_channel_read(struct ipc_channel *ch, int *msg_id, void *buf, unsigned int size, int tmo)
+{
+	int len;
+	struct timespec ts, *tp = NULL;
+	struct ipc_channel_header *header = ch->header;
+	for (;;) {
+		uint64_t head = ATOMIC_GET(&header->head);
+		if (head - ch->pos > header->nslots) {
+			ch->lost += head - header->nslots - ch->pos;
+			ch->pos	  = head - header->nslots;
+		}
+		if (ch->pos < head) {
+			len = channel_copy(ch, ch->pos, msg_id, buf, size);
+			if (len == -2) {
+				ch->lost++;
+				ch->pos++;
+				continue;
+			}
+			if (len >= 0) {
+				ch->pos++;
+				return (unsigned int)len > size ? -IPC_EMEM : len;
+			}
+		}
+		if (!tmo)
+			return -IPC_ETIMEOUT;
+		uint32_t word = ATOMIC_GET(&header->futex);
+		ATOMIC_FADD(&header->waiters, 1);
+		__sync_synchronize();
+		/*
+		 * Sleep only if nothing is readable yet: neither a new claim, nor the commit of
+		 * a slot claimed already, which is not woken up if it saw no waiters.
+		 */
+		if (ATOMIC_GET(&header->head) == head &&
+			(ch->pos >= head || ATOMIC_GET(&channel_slot(ch, ch->pos)->seq) < 2 * (ch->pos + 1))) {
+			if (tmo > 0) {
+				ts.tv_sec  = tmo / 1000;
+				ts.tv_nsec = (tmo % 1000) * 1000000;
+				tp = &ts;
+			}
+			int rc = futex(&header->futex, FUTEX_WAIT, word, tp);
+			ATOMIC_FSUB(&header->waiters, 1);
+			if (rc < 0 && errno == ETIMEDOUT)
+				return -IPC_ETIMEOUT;
+			if (tmo > 0)
+				tmo = 0;	/* One wait only, next pass reads or times out */
+			continue;
+		}
+		ATOMIC_FSUB(&header->waiters, 1);
+	}
+}
+/**
+ * ipc_channel_latest - read the latest value, for topics carrying states rather than events.
+ * Does not move the read position. Returns as ipc_channel_read() with no wait.
+ */
+int ipc_channel_latest(struct ipc_channel *ch, int *msg_id, void *buf, unsigned int size)
+{
+	int len;
+	uint64_t head = ATOMIC_GET(&ch->header->head);
+	while (head) {
+		len = channel_copy(ch, head - 1, msg_id, buf, size);
+		if (len >= 0)
+			return (unsigned int)len > size ? -IPC_EMEM : len;
+		if (len == -2)
+			head = ATOMIC_GET(&ch->header->head);
+		else if (!--head)
+			break;
+	}
+	return -IPC_ETIMEOUT;
+}
+/**
+ * ipc_channel_lost - values overwritten before being read, since open.
+ */
+unsigned long long ipc_channel_lost(struct ipc_channel *ch)
+{
+	return ch->lost;
+}
+
+void ipc_channel_close(struct ipc_channel *ch)
+{
+	munmap(ch->header, ch->length);
+	free(ch);
+}
@@ -0,0 +1,62 @@
+#ifndef __IPC_CHANNEL_H__
+#define __IPC_CHANNEL_H__
+#include <stdint.h>
+/*
+ * Shared memory broadcast channel.
+ *
+ * Segment layout in /dev/shm/<IPC_CHANNEL_PREFIX><name>:
+ *   struct ipc_channel_header | slot ring
+ *
+ * A publisher claims a position with one atomic fetch-add on @head and writes
+ * the value into slot (position & mask), which works as a seqlock: @seq is odd
+ * while being written, then 2 * (position + 1) once committed. A publisher waits
+ * for the one a lap ahead of it to commit the same slot first. Readers never
+ * write the ring, they only touch the @futex and @waiters words of the header:
+ * they copy a slot and check @seq again, so publishing costs the same whatever
+ * the number of readers. A reader that falls more than one ring behind
+ * skips to the oldest value still there and counts the rest as lost.
+ *
+ * Readers sleep on the @futex word of the header only when they ask to wait,
+ * publishers touch it only when someone is waiting.
+ */
+#define IPC_CHANNEL_MAGIC		0x4e484349	/* "ICHN" */
+#define IPC_CHANNEL_VERSION		1
+#define IPC_CHANNEL_PREFIX		"ipcch."
+#define IPC_CHANNEL_SLOTS		256			/* Default ring size, power of 2 */
+#define IPC_CHANNEL_SIZE		512			/* Default max payload of a slot */
+
+struct ipc_channel_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nslots;
+	uint32_t size;			/* Max payload of a slot */
+	uint32_t stride;		/* Bytes between slots, cache line aligned */
+	uint8_t  __pad[44];
+	uint64_t head;			/* Next position to claim, on its own cache line */
+	uint8_t  __pad1[56];
+	uint32_t futex;			/* Bumped on publish when @waiters is not 0 */
+	uint32_t waiters;
+	uint8_t  __pad2[56];
+};
+struct ipc_channel_slot {
+	uint64_t seq;
+	int32_t  msg_id;
+	uint32_t size;
+	char	 data[0];
+};
+struct ipc_channel;
+/*
+ * Publisher side, one publisher process creates the channel, any of its threads may publish.
+ */
+struct ipc_channel *ipc_channel_create(const char *name, unsigned int slots, unsigned int size);
+int ipc_channel_publish(struct ipc_channel *channel, int msg_id, const void *data, unsigned int size);
+void ipc_channel_destroy(struct ipc_channel *channel);
+/*
+ * Reader side.
+ */
+struct ipc_channel *ipc_channel_open(const char *name);
+int ipc_channel_read(struct ipc_channel *channel, int *msg_id, void *buf, unsigned int size, int tmo);
+int ipc_channel_latest(struct ipc_channel *channel, int *msg_id, void *buf, unsigned int size);
+unsigned long long ipc_channel_lost(struct ipc_channel *channel);
+void ipc_channel_close(struct ipc_channel *channel);
+#endif
@@ -1,5 +1,17 @@
 /*
  * Copyright (c) 2017, <-Jason Chen->
+ * Version: 1.2.2 - 20261019
+ *				  - ipc_client_request() to a server of the same process skips sockets, see ipc_loopback_request().
+ *				  - Add SOCK_SEQPACKET transport, see ipc_client_seqpacket(), falls back to stream sockets
+ *					if the server does not support it.
+ *				  - Add ipc_client_stats(), read statistics of server.
+ *				  - Add ipc_client_batch(), N requests in one round trip.
+ *				  - Accept notifications published to several topics.
+ *				  - Add content filters option of ipc_subscriber_registerx(), evaluated by broker.
+ *				  - Add ipc_client_loglevel(), query or change log levels of server at runtime.
+ *				  - Add ipc_subscriber_registerx(), subscriber handlers can be dispatched to an executor,
+ *					ordered per topic or per msg_id, so that the receive thread is never stalled by a slow handler.
+ *				  - Add ipc_client_requestv(), scatter/gather request without intermediate copies.
  * Version: 1.2.1 - 20230316
  *				  - Modify log tag, using comm instead.
  * Version: 1.2.0 - 20220216
@@ -41,6 +53,7 @@
 static pthread_once_t __client_once = PTHREAD_ONCE_INIT;
 static pid_t 		__client_pid  = 0;
 static const char * __client_name = DUMMY_NAME;
+static int			__client_seqpacket = -1;	/* Unset: taken from environment IPC_SEQPACKET */
 #define client_valid(client) (get_state(client) == IPC_S_CONNECTED && \
 							  (client)->sock >= 0 && \
 							  (client)->identity > 0 && \
@@ -53,8 +66,50 @@ static void client_init(void)
 {
 	__client_pid   = getpid();
 	__client_name  = self_name();
+	if (__client_seqpacket < 0) {
+		const char *env = getenv("IPC_SEQPACKET");
+		__client_seqpacket = env && atoi(env) > 0;
+	}
 	pthread_atfork(NULL, NULL, client_back);
 }
+/**
+ * ipc_client_seqpacket - connect servers with SOCK_SEQPACKET sockets,
+ * which need no re-framing of messages on either side.
+ * Applies to connections made afterwards, and is only used if the server enabled
+ * IPC_SEROPT_ENABLE_SEQPACKET, otherwise stream sockets are used as before.
+ * Environment variable IPC_SEQPACKET=1 has the same effect without code changes.
+ * @enable: Boolean Type
+ */
+void ipc_client_seqpacket(int enable)
+{
+	__client_seqpacket = !!enable;
+}
+/**
+ * ipc_connect_packet - try the SOCK_SEQPACKET listener of server, no retry.
+ * Returns the connected socket, or -1 if the server does not listen on it.
+ */
+static int ipc_connect_packet(struct ipc_client *client)
+{
+	int sock;
+	struct sockaddr_un server_addr = {0};
+	server_addr.sun_family = AF_UNIX;
+	if (snprintf(server_addr.sun_path, sizeof(server_addr.sun_path), "%s"IPC_SEQPACKET_SUFFIX, client->server)
+			>= sizeof(server_addr.sun_path))
+		return -1;
+	sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (sock < 0)
+		return -1;
+	if (sock_opts(sock, 0) < 0)
+		goto __error;
+	while (connect(sock, (struct sockaddr *)&server_addr,  (socklen_t)sizeof(struct sockaddr_un)) < 0) {
+		if (errno != EINTR)
+			goto __error;
+	}
+	return sock;
+__error:
+	close(sock);
+	return -1;
+}
 
 /**
  * ipc_connect - connect to server
@@ -65,6 +120,16 @@ static int ipc_connect(struct ipc_client *client)
 	int sock;
 	struct sockaddr_un server_addr = {0};
 
+	if (__client_seqpacket > 0) {
+		sock = ipc_connect_packet(client);
+		if (sock >= 0) {
+			client->sock = sock;
+			client->type = SOCK_SEQPACKET;
+			IPC_LOGD("connect to %s, sk:%d, seqpacket", server_offset(client->server), client->sock);
+			return 0;
+		}
+	}
+	client->type = SOCK_STREAM;
 	sock = socket(AF_UNIX, SOCK_STREAM, 0);
 	if (sock < 0) {
         IPC_LOGE("Unable to create socket: %s", strerror(errno));
@@ -98,6 +163,30 @@ __retry:
 	IPC_LOGD("connect to %s, sk:%d", server_offset(client->server), client->sock);
 	return 0;
 }
+/**
+ * ipc_reply_error - translate receiving errors to request errors.
+ * @rc: value returned by recv_msg() or recv_msgv().
+ */
+static int ipc_reply_error(int rc)
+{
+	switch (rc) {
+	case IPC_RECEIVE_TMO:
+		return IPC_REQUEST_TMO;
+	case IPC_RECEIVE_EOF:
+		return IPC_REQUEST_EOF;
+	case IPC_RECEIVE_EMEM:
+		return IPC_REQUEST_EMEM;
+	case IPC_RECEIVE_ERR:
+		return IPC_REQUEST_EMT;
+	case IPC_RECEIVE_EMSG:
+		IPC_LOGE("Received error msg.");
+		return IPC_REQUEST_EMSG;
+	case IPC_RECEIVE_EVAL:
+		return IPC_REQUEST_EVAL;
+	default:
+		return IPC_REQUEST_SUCCESS;
+	}
+}
 static int ipc_request(struct ipc_client* client, struct ipc_msg *msg, unsigned int size, int tmo)
 {
 	msg->from = client->identity;
@@ -108,30 +197,11 @@ static int ipc_request(struct ipc_client* client, struct ipc_msg *msg, unsigned
 		return IPC_REQUEST_EMO;
 	}
 	if (msg->flags & __bit(IPC_BIT_REPLY)) {
-		int rc;
-		switch (recv_msg(client->sock, (char *)msg, size, tmo)) {
-		case IPC_RECEIVE_TMO:
-			rc = IPC_REQUEST_TMO;
-			break;
-		case IPC_RECEIVE_EOF:
-			rc = IPC_REQUEST_EOF;
-			break;
-		case IPC_RECEIVE_EMEM:
-			rc = IPC_REQUEST_EMEM;
-			break;
-		case IPC_RECEIVE_ERR:
-			rc = IPC_REQUEST_EMT;
-			break;
-		case IPC_RECEIVE_EMSG:
-			IPC_LOGE("Received error msg.");
-			rc = IPC_REQUEST_EMSG;
-			break;
-		case IPC_RECEIVE_EVAL:
-			rc = IPC_REQUEST_EVAL;
-			break;
-		default:
+		int rc = ipc_reply_error(client->type == SOCK_SEQPACKET ? 
+									recv_packet(client->sock, (char *)msg, size, tmo) :
+									recv_msg(client->sock, (char *)msg, size, tmo));
+		if (rc == IPC_REQUEST_SUCCESS)
 			return IPC_REQUEST_SUCCESS;
-		}
 		
 		IPC_LOGE("receive from %s error: %s, messages ID: %04x", server_offset(client->server), strerr(-rc), msg->msg_id);
 		return rc;
@@ -250,7 +320,10 @@ int ipc_client_request(struct ipc_client* client, struct ipc_msg *msg, unsigned
 	 */
 	else if (!users_msg(msg))
 		rc = IPC_REQUEST_EMSG;
-	else
+	/*
+	 * Server running in this process, hand the request to its core directly.
+	 */
+	else if ((rc = ipc_loopback_request(client->server, client->identity, msg, size, tmo)) == IPC_LOOPBACK_NONE)
 		rc = ipc_request(client, msg, size, tmo);
 
 	if (rc)
@@ -258,6 +331,293 @@ int ipc_client_request(struct ipc_client* client, struct ipc_msg *msg, unsigned
 
 	return rc;
 }
+/*
+ * ipc_loopback_requestv - ipc_client_requestv() to a server running in this process.
+ * The core takes one message: the request is flattened into a buffer of the server's size,
+ * and the response is scattered into @riov, like recv_msgv() does.
+ */
+static int ipc_loopback_requestv(struct ipc_client *client, struct ipc_msg *msg, unsigned int bufsize,
+		const struct iovec *iov, int iovcnt, const struct iovec *riov, int riovcnt, int tmo)
+{
+	int i, rc;
+	unsigned int n, off = 0;
+	unsigned int len = bufsize > msg->data_len ? bufsize : msg->data_len;
+	struct ipc_msg *flat = ipc_alloc_msg(len);
+	if (!flat)
+		return IPC_REQUEST_EMEM;
+	memcpy(flat, msg, IPC_MSG_HDRLEN);
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(flat->data + off, iov[i].iov_base, iov[i].iov_len);
+		off += iov[i].iov_len;
+	}
+	rc = ipc_loopback_request(client->server, client->identity, flat, ipc_msg_buffer_size(len), tmo);
+	if (rc == IPC_REQUEST_SUCCESS && (msg->flags & IPC_FLAG_REPLY)) {
+		memcpy(msg, flat, IPC_MSG_HDRLEN);
+		for (i = 0, off = 0; i < riovcnt && off < flat->data_len; i++) {
+			n = flat->data_len - off;
+			if (n > riov[i].iov_len)
+				n = riov[i].iov_len;
+			memcpy(riov[i].iov_base, flat->data + off, n);
+			off += n;
+		}
+	}
+	ipc_free_msg(flat);
+	return rc;
+}
+/**
+ * ipc_client_requestv - the same as ipc_client_request(), but without any intermediate copies.
+ * To a server running in this process, the request goes to its core as one message instead.
+ * The request payload is sent from @iov via one sendmsg(), the response header is received into @msg,
+ * then the response payload is received straight into @riov.
+ * @client: client handle
+ * @msg: message header only - |msg_id| and |flags| filled by caller, |data_len| is calculated from @iov.
+ *       On success with a response, it holds the response header, |data_len| is the full length of the response payload,
+ *       if it is larger than the capacity of @riov, the rest is discarded.
+ * @iov: request payload pieces, at most IPC_IOV_MAX.
+ * @iovcnt: count of @iov
+ * @riov: response payload buffers, at most IPC_IOV_MAX.
+ * @riovcnt: count of @riov
+ * @tmo: time of receive timeout
+ */
+int ipc_client_requestv(struct ipc_client* client, struct ipc_msg *msg,
+		const struct iovec *iov, int iovcnt, 
+		const struct iovec *riov, int riovcnt, int tmo)
+{
+	int i, rc = 0;
+	size_t len = 0;
+	unsigned int bufsize;
+	/*
+	 * Client handle sanity check.
+	 */
+	if (!client_valid(client)) {
+		rc = IPC_REQUEST_EVAL;
+		goto out;
+	}
+	/*
+	 * Users's messages ID should be smaller than IPC_MSG_SDK
+	 */
+	if (!users_msg(msg)) {
+		rc = IPC_REQUEST_EMSG;
+		goto out;
+	}
+	if (iovcnt < 0 || iovcnt > IPC_IOV_MAX ||
+		riovcnt < 0 || riovcnt > IPC_IOV_MAX) {
+		rc = IPC_REQUEST_EVAL;
+		goto out;
+	}
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (len > (unsigned short)~0u) {
+		rc = IPC_REQUEST_EVAL;
+		goto out;
+	}
+	msg->from 	  = client->identity;
+	msg->flags   &= IPC_FLAG_CLIENT_MASK;
+	msg->data_len = len;
+	if ((bufsize = ipc_loopback_size(client->server)) > 0) {
+		rc = ipc_loopback_requestv(client, msg, bufsize, iov, iovcnt, riov, riovcnt, tmo);
+		if (rc != IPC_LOOPBACK_NONE)
+			goto out;
+		rc = 0;
+	}
+	if (send_msgv(client->sock, msg, iov, iovcnt) != (int)__data_len(msg)) {
+		IPC_LOGE("request to %s error: %d, msg: %04x", server_offset(client->server), errno, msg->msg_id);
+		rc = IPC_REQUEST_EMO;
+		goto out;
+	}
+	if (msg->flags & __bit(IPC_BIT_REPLY))
+		rc = ipc_reply_error(client->type == SOCK_SEQPACKET ?
+								recv_packetv(client->sock, msg, riov, riovcnt, tmo) :
+								recv_msgv(client->sock, msg, riov, riovcnt, tmo));
+out:
+	if (rc)
+		IPC_LOGE("Client requestv to %s error: %s, messages ID: %04x", server_offset(client->server), strerr(-rc), msg->msg_id);
+
+	return rc;
+}
+/**
+ * ipc_client_batch - send requests in one envelope, and receive their replies in one envelope.
+ * The server handles them back to back, one reply per request is returned into the request buffer.
+ * A reply with IPC_FLAG_FAILED set has no payload, it means that the handler failed or went asynchronous.
+ * The whole envelope must fit the server's IPC buffer, see IPC_SEROPT_SET_BUF_SIZE.
+ * To a server running in this process, the envelope goes to its core directly,
+ * it may not be sent from a handler of that server.
+ * @client: client handle
+ * @msgs: requests - must be users' messages, replies are stored into them on success.
+ * @count: count of @msgs, at most IPC_BATCH_MAX.
+ * @size: buffer size of each of @msgs
+ * @tmo: time of receive timeout
+ * If a reply is larger than @size, it is truncated and IPC_REQUEST_EMEM is returned.
+ */
+int ipc_client_batch(struct ipc_client* client, struct ipc_msg *msgs[], int count, unsigned int size, int tmo)
+{
+	int i, rc = 0;
+	unsigned int len = 0, offset = 0;
+	struct iovec iov[IPC_BATCH_MAX + 1];	/* iov[0] is for the envelope header */
+	struct ipc_msg envelope, *reply = NULL, *rsp;
+	/*
+	 * Client handle sanity check.
+	 */
+	if (!client_valid(client) || count <= 0 || count > IPC_BATCH_MAX || size < IPC_MSG_HDRLEN) {
+		rc = IPC_REQUEST_EVAL;
+		goto out;
+	}
+	for (i = 0; i < count; i++) {
+		/*
+		 * Users's messages ID should be smaller than IPC_MSG_SDK
+		 */
+		if (!users_msg(msgs[i])) {
+			rc = IPC_REQUEST_EMSG;
+			goto out;
+		}
+		msgs[i]->from	= client->identity;
+		msgs[i]->flags &= IPC_FLAG_CLIENT_MASK;
+		iov[i + 1].iov_base = msgs[i];
+		iov[i + 1].iov_len	= __data_len(msgs[i]);
+		len += iov[i + 1].iov_len;
+	}
+	if (len > IPC_BATCH_SIZE) {
+		rc = IPC_REQUEST_EVAL;
+		goto out;
+	}
+	reply = ipc_alloc_msg(IPC_BATCH_SIZE);
+	if (!reply) {
+		rc = IPC_REQUEST_EMEM;
+		goto out;
+	}
+	envelope.msg_id   = IPC_SDK_MSG_BATCH;
+	envelope.from	  = client->identity;
+	envelope.flags	  = IPC_FLAG_REPLY;
+	envelope.data_len = len;
+	rc = IPC_LOOPBACK_NONE;
+	if (ipc_loopback_size(client->server) > 0) {
+		/* Server running in this process, the envelope is built in the reply buffer */
+		memcpy(reply, &envelope, IPC_MSG_HDRLEN);
+		for (i = 0, len = 0; i < count; i++) {
+			memcpy(reply->data + len, msgs[i], __data_len(msgs[i]));
+			len += __data_len(msgs[i]);
+		}
+		rc = ipc_loopback_request(client->server, client->identity, reply, ipc_msg_buffer_size(IPC_BATCH_SIZE), tmo);
+	}
+	if (rc == IPC_LOOPBACK_NONE) {
+		if (send_vec(client->sock, &envelope, iov, count + 1) != (int)__data_len(&envelope)) {
+			IPC_LOGE("batch to %s error: %d", server_offset(client->server), errno);
+			rc = IPC_REQUEST_EMO;
+			goto out;
+		}
+		rc = ipc_reply_error(client->type == SOCK_SEQPACKET ?
+								recv_packet(client->sock, (char *)reply, ipc_msg_buffer_size(IPC_BATCH_SIZE), tmo) :
+								recv_msg(client->sock, (char *)reply, ipc_msg_buffer_size(IPC_BATCH_SIZE), tmo));
+	}
+	if (rc)
+		goto out;
+	if (reply->msg_id != IPC_SDK_MSG_BATCH) {
+		rc = IPC_REQUEST_EMSG;
+		goto out;
+	}
+	for (i = 0; i < count; i++) {
+		rsp = (struct ipc_msg *)(reply->data + offset);
+		if (offset + IPC_MSG_HDRLEN > reply->data_len ||
+			offset + __data_len(rsp) > reply->data_len) {
+			IPC_LOGE("batch reply corrupted, %d/%d.", i, count);
+			rc = IPC_REQUEST_EMSG;
+			goto out;
+		}
+		offset += __data_len(rsp);
+		if (__data_len(rsp) > size) {
+			memcpy(msgs[i], rsp, size);
+			msgs[i]->data_len = size - IPC_MSG_HDRLEN;
+			rc = IPC_REQUEST_EMEM;
+		} else
+			memcpy(msgs[i], rsp, __data_len(rsp));
+	}
+out:
+	if (reply)
+		ipc_free_msg(reply);
+	if (rc)
+		IPC_LOGE("Client batch to %s error: %s, count: %d", server_offset(client->server), strerr(-rc), count);
+	return rc;
+}
+/**
+ * ipc_client_loglevel - query or change the log level of a module of server.
+ * @client: client handle
+ * @module: enum IPC_LOG_MODULE
+ * @level: enum IPC_LOG_LEVEL, negative for query only.
+ * @tmo: time of receive timeout
+ * On success, the previous level is returned, otherwise negative error code.
+ */
+int ipc_client_loglevel(struct ipc_client* client, int module, int level, int tmo)
+{
+	int rc;
+	char buffer[IPC_MSG_MINI_SIZE] = {0};
+	struct ipc_msg *msg = (struct ipc_msg *)buffer;
+	struct ipc_loglevel *ll = (struct ipc_loglevel *)msg->data;
+	if (!client_valid(client))
+		return IPC_REQUEST_EVAL;
+	msg->msg_id   = IPC_SDK_MSG_LOGLEVEL;
+	msg->flags	  = IPC_FLAG_REPLY;
+	msg->data_len = sizeof(struct ipc_loglevel);
+	ll->module	  = module;
+	ll->level	  = level;
+	rc = ipc_request(client, msg, sizeof(buffer), tmo);
+	if (rc)
+		return rc;
+	if (msg->msg_id != IPC_SDK_MSG_SUCCESS || msg->data_len < sizeof(struct ipc_loglevel))
+		return IPC_REQUEST_EVAL;
+	return ll->level;
+}
+/**
+ * ipc_client_stats - read the statistics of server.
+ * @client: client handle
+ * @stats: buffer receiving struct ipc_stats, followed by clients and message IDs.
+ * @size: size of @stats, entries not fitting are left out and IPC_STATS_TRUNCATED is set.
+ * @flags: IPC_STATS_RESET to reset the counters of server once read.
+ * @tmo: time of receive timeout
+ */
+int ipc_client_stats(struct ipc_client* client, struct ipc_stats *stats, unsigned int size, int flags, int tmo)
+{
+	int rc;
+	unsigned int nclients, nmsgs;
+	struct ipc_stats *reply;
+	struct ipc_msg *msg;
+	if (!client_valid(client) || size < sizeof(struct ipc_stats))
+		return IPC_REQUEST_EVAL;
+	msg = ipc_alloc_msg(IPC_STATS_SIZE);
+	if (!msg)
+		return IPC_REQUEST_EMEM;
+	msg->msg_id   = IPC_SDK_MSG_STATS;
+	msg->flags	  = IPC_FLAG_REPLY;
+	msg->data_len = sizeof(unsigned int);
+	memcpy(msg->data, &flags, sizeof(unsigned int));
+	rc = ipc_request(client, msg, ipc_msg_buffer_size(IPC_STATS_SIZE), tmo);
+	if (rc)
+		goto out;
+	reply = (struct ipc_stats *)msg->data;
+	if (msg->msg_id != IPC_SDK_MSG_SUCCESS || msg->data_len < sizeof(struct ipc_stats) ||
+		msg->data_len < sizeof(struct ipc_stats) + reply->nclients * sizeof(struct ipc_stat_client)
+												 + reply->nmsgs * sizeof(struct ipc_stat_msg)) {
+		rc = IPC_REQUEST_EMSG;
+		goto out;
+	}
+	size -= sizeof(struct ipc_stats);
+	nclients = reply->nclients;
+	nmsgs	 = reply->nmsgs;
+	if (nclients * sizeof(struct ipc_stat_client) > size)
+		nclients = size / sizeof(struct ipc_stat_client);
+	size -= nclients * sizeof(struct ipc_stat_client);
+	if (nmsgs * sizeof(struct ipc_stat_msg) > size)
+		nmsgs = size / sizeof(struct ipc_stat_msg);
+	memcpy(stats, reply, sizeof(struct ipc_stats));
+	memcpy(ipc_stats_clients(stats), ipc_stats_clients(reply), nclients * sizeof(struct ipc_stat_client));
+	stats->nclients = nclients;
+	memcpy(ipc_stats_msgs(stats), ipc_stats_msgs(reply), nmsgs * sizeof(struct ipc_stat_msg));
+	stats->nmsgs = nmsgs;
+	if (nclients < reply->nclients || nmsgs < reply->nmsgs)
+		stats->flags |= IPC_STATS_TRUNCATED;
+out:
+	ipc_free_msg(msg);
+	return rc;
+}
 /**
  * ipc_client_close - shutdown a connection
  * @client: client handle
@@ -307,7 +667,7 @@ int ipc_client_repair(struct ipc_client *client)
  * ipc_client_publish - publisher/client publish notification message
  * @client: client handle
  * @to: indicate who the notify message is sent to. 
- * @topic: message type
+ * @topic: message type, several bits may be set, each subscriber matching any of them gets the message once.
  * @msg_id: message id
  * @data: message data, if no data carried, set NULL
  * @size: the length of message data
@@ -419,6 +779,103 @@ int ipc_subscriber_request(struct ipc_subscriber *subscriber, struct ipc_msg *ms
 		IPC_LOGE("Subscriber request error: %s, messages ID: %04x", strerr(-rc), msg->msg_id);
 	return rc;
 }
+/*
+ * Dispatcher of subscriber handlers, one serial lane per topic bit or per msg_id hash.
+ */
+#define IPC_DISPATCH_LANES	(sizeof(unsigned long) * 8)
+struct ipc_dispatcher
+{
+	int order;
+	struct ipc_executor executor;
+	pthread_mutex_t mutex;
+	pthread_cond_t	cond;
+	struct ipc_serial lanes[IPC_DISPATCH_LANES];
+};
+struct ipc_event
+{
+	struct ipc_serial_item item;
+	struct ipc_subscriber *subscriber;
+	int msg_id;
+	int data_len;
+	char data[];
+};
+static struct ipc_dispatcher *ipc_dispatcher_create(const struct ipc_sopts *opts)
+{
+	int i;
+	struct ipc_dispatcher *dispatcher = (struct ipc_dispatcher *)malloc(sizeof(struct ipc_dispatcher));
+	if (!dispatcher) {
+		IPC_LOGE("None Memory.");
+		return NULL;
+	}
+	dispatcher->order	 = opts->order;
+	dispatcher->executor = *opts->executor;
+	pthread_mutex_init(&dispatcher->mutex, NULL);
+	pthread_cond_init(&dispatcher->cond, NULL);
+	for (i = 0; i < IPC_DISPATCH_LANES; i++)
+		ipc_serial_init(&dispatcher->lanes[i], &dispatcher->executor, &dispatcher->mutex, &dispatcher->cond);
+	return dispatcher;
+}
+static void ipc_dispatcher_destroy(struct ipc_dispatcher *dispatcher)
+{
+	int i;
+	for (i = 0; i < IPC_DISPATCH_LANES; i++)
+		ipc_serial_wait(&dispatcher->lanes[i]);
+	pthread_cond_destroy(&dispatcher->cond);
+	pthread_mutex_destroy(&dispatcher->mutex);
+	free(dispatcher);
+}
+static void ipc_event_handle(struct ipc_serial_item *item)
+{
+	struct ipc_event *event = container_of(item, struct ipc_event, item);
+	struct ipc_subscriber *subscriber = event->subscriber;
+	subscriber->handler(event->msg_id, event->data, event->data_len, subscriber->arg);
+	free(event);
+}
+/**
+ * ipc_subscriber_dispatch - copy the notification and queue it to the lane of its topic or msg_id.
+ * @subscriber: subscriber handle
+ * @notify: notification received, @notify->topic matches the subscriber mask.
+ * With IPC_ORDER_TOPIC, a notification of several topics is joint in the lanes of all its matching topics,
+ * so it is ordered with the notifications of each of them.
+ */
+static void ipc_subscriber_dispatch(struct ipc_subscriber *subscriber, struct ipc_notify *notify)
+{
+	int state, count = 0;
+	unsigned int lane;
+	unsigned long topic;
+	struct ipc_serial *lanes[IPC_DISPATCH_LANES];
+	struct ipc_dispatcher *dispatcher = subscriber->dispatcher;
+	struct ipc_event *event = (struct ipc_event *)malloc(sizeof(struct ipc_event) + notify->data_len);
+	if (!event) {
+		IPC_LOGE("None Memory, handle msg:%04x inline.", notify->msg_id);
+		subscriber->handler(notify->msg_id, notify->data, notify->data_len, subscriber->arg);
+		return;
+	}
+	event->item.func  = ipc_event_handle;
+	event->subscriber = subscriber;
+	event->msg_id	  = notify->msg_id;
+	event->data_len	  = notify->data_len;
+	memcpy(event->data, notify->data, notify->data_len);
+	if (dispatcher->order == IPC_ORDER_MSGID)
+		lanes[count++] = &dispatcher->lanes[(unsigned int)notify->msg_id % IPC_DISPATCH_LANES];
+	else {
+		for (topic = notify->topic & subscriber->mask; topic; topic &= topic - 1) {
+			lane = __builtin_ctzl(topic);
+			lanes[count++] = &dispatcher->lanes[lane];
+		}
+	}
+	/*
+	 * No cancellation while the lane is locked or the executor is being called.
+	 */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+	if (count > 1 && ipc_serial_post_join(lanes, count, &event->item) < 0) {
+		IPC_LOGE("None Memory, msg:%04x ordered in lane of topic %d only.", notify->msg_id, __builtin_ctzl(notify->topic & subscriber->mask));
+		count = 1;
+	}
+	if (count == 1)
+		ipc_serial_post(lanes[0], &event->item);
+	pthread_setcancelstate(state, NULL);
+}
 /**
  * ipc_subscriber_destroy - shutdown a connection and free the memory occupied by ipc_subscriber structure 
  * @subscriber: subscriber handle to be destroyed
@@ -432,6 +889,10 @@ static void ipc_subscriber_destroy(struct ipc_subscriber *subscriber)
 			barrier();
 			close(subscriber->client.sock);
 		}
+		if (subscriber->dispatcher)
+			ipc_dispatcher_destroy(subscriber->dispatcher);
+		if (subscriber->filters)
+			free(subscriber->filters);
 		if (subscriber->buf)
 			free(subscriber->buf);
 		free(subscriber);
@@ -446,7 +907,8 @@ static int ipc_subscriber_connect(struct ipc_subscriber *subscriber)
 	int dynamic = 0;
 	char buffer[1024] = {0};
 	unsigned int sbuf = sizeof(buffer);
-	unsigned int size = sizeof(struct ipc_reg) + subscriber->data_len;
+	unsigned int flen = subscriber->nfilters * sizeof(struct ipc_filter);
+	unsigned int size = sizeof(struct ipc_reg) + subscriber->data_len + flen;
 	struct ipc_msg *ipc_msg = (struct ipc_msg *)buffer;
 	if (ipc_msg_space_check(sbuf, size) == 0) {
 		ipc_msg = ipc_alloc_msg(size);
@@ -468,6 +930,9 @@ static int ipc_subscriber_connect(struct ipc_subscriber *subscriber)
 	reg->data_len = subscriber->data_len;
 	if (subscriber->data_len > 0)
 		memcpy(reg->data, subscriber->data, subscriber->data_len);
+	/* Content filters follow the register data */
+	if (flen > 0)
+		memcpy(reg->data + subscriber->data_len, subscriber->filters, flen);
 	ipc_msg->data_len = size;
 
 	if (IPC_REQUEST_SUCCESS != ipc_request(&subscriber->client, ipc_msg, sbuf, IPC_MSG_SDK_TIMEOUT))
@@ -531,6 +996,33 @@ static int ipc_subscriber_repair(struct ipc_subscriber *subscriber)
 	IPC_LOGE("subscriber @%p repair failure, sk: %d", subscriber, subscriber->client.sock);
 	return -1;
 }
+/**
+ * ipc_subscriber_handle - subscriber handle one asynchronous message from server
+ * @subscriber: subscriber handle
+ * @msg: asynchronous message
+ * Returns -1 if the message is unexpected.
+ */
+static int ipc_subscriber_handle(struct ipc_subscriber *subscriber, struct ipc_msg *msg)
+{
+	struct ipc_notify *notify;
+	if (msg->msg_id == IPC_SDK_MSG_NOTIFY) {
+		notify = (struct ipc_notify *)msg->data;
+		if (topic_isset(subscriber, notify->topic)) {
+			if (subscriber->dispatcher)
+				ipc_subscriber_dispatch(subscriber, notify);
+			else
+				subscriber->handler(notify->msg_id, notify->data, notify->data_len, subscriber->arg);
+		}
+	} else if (msg->msg_id == IPC_SDK_MSG_UNREGISTER) {
+		IPC_LOGI("subscriber task exit");
+		subscriber->mask = 0ul;
+		pthread_exit(NULL);
+	} else {
+		IPC_LOGE("unexpected msg:%04x", msg->msg_id);
+		return -1;
+	}
+	return 0;
+}
 /**
  * ipc_subscriber_process - subscriber process asynchronous messages from server
  * @subscriber: subscriber handle
@@ -540,7 +1032,6 @@ static int ipc_subscriber_repair(struct ipc_subscriber *subscriber)
 static void ipc_subscriber_process(struct ipc_subscriber *subscriber, struct ipc_buf *buf)
 {
 	struct ipc_msg *msg;
-	struct ipc_notify *notify;
 	do {
 		msg = find_msg(buf, NULL);
 		if (!msg) {
@@ -550,17 +1041,8 @@ static void ipc_subscriber_process(struct ipc_subscriber *subscriber, struct ipc
 			}
 			return;
 		}
-		if (msg->msg_id == IPC_SDK_MSG_NOTIFY) {
-			notify = (struct ipc_notify *)msg->data;
-			if (topic_isset(subscriber, notify->topic) && 
-				topic_check(notify->topic))
-				subscriber->handler(notify->msg_id, notify->data, notify->data_len, subscriber->arg);
-		} else if (msg->msg_id == IPC_SDK_MSG_UNREGISTER) {
-			IPC_LOGI("subscriber task exit");
-			subscriber->mask = 0ul;
-			pthread_exit(NULL);
-		} else {
-			IPC_LOGE("unexpected msg:%04x, %d:%d",msg->msg_id, buf->head, buf->tail);
+		if (ipc_subscriber_handle(subscriber, msg) < 0) {
+			IPC_LOGE("unexpected msg at %d:%d", buf->head, buf->tail);
 			break;
 		}
 	} while (ipc_buf_pending(buf));
@@ -583,9 +1065,18 @@ static void * ipc_subscriber_task(void *arg)
 		struct timeval timeout;
 		timeout.tv_sec 	= 30;
 		timeout.tv_usec = 0;
-		rc = recv_stream(subscriber->client.sock, 
-						buf->data + buf->tail, 
-						buf->size - buf->tail, &timeout);
+		if (subscriber->client.type == SOCK_SEQPACKET) {
+			/* One message per receive, nothing to re-frame */
+			rc = recv_packet(subscriber->client.sock, buf->data, buf->size, 30);
+			if (rc > 0) {
+				ipc_subscriber_handle(subscriber, (struct ipc_msg *)buf->data);
+				continue;
+			}
+		} else {
+			rc = recv_stream(subscriber->client.sock, 
+							buf->data + buf->tail, 
+							buf->size - buf->tail, &timeout);
+		}
 		if (rc > 0) {
 			IPC_LOGD("receive %d bytes, offset: %u.", rc, buf->head);
 			buf->tail += rc;
@@ -623,7 +1114,7 @@ static int ipc_subscriber_run(struct ipc_subscriber *subscriber)
  */
 static struct ipc_subscriber *ipc_subscriber_create(const char *broker, 
 													unsigned long mask, const void *data, unsigned int size,
-													ipc_subscriber_handler handler, void *arg)
+													ipc_subscriber_handler handler, void *arg, const struct ipc_sopts *opts)
 {
 	if (handler == NULL || mask == 0ul || data == NULL)
 		size = 0u;
@@ -649,6 +1140,15 @@ static struct ipc_subscriber *ipc_subscriber_create(const char *broker,
 		memcpy(subscriber->data, data, size);
 	} else
 		subscriber->data_len = 0u;
+	if (opts && opts->nfilters > 0) {
+		subscriber->filters = (struct ipc_filter *)malloc(opts->nfilters * sizeof(struct ipc_filter));
+		if (!subscriber->filters) {
+			IPC_LOGE("None Memory.");
+			goto err;
+		}
+		memcpy(subscriber->filters, opts->filters, opts->nfilters * sizeof(struct ipc_filter));
+		subscriber->nfilters = opts->nfilters;
+	}
     if (ipc_subscriber_connect(subscriber) < 0)
 		goto err;
 	
@@ -656,6 +1156,8 @@ static struct ipc_subscriber *ipc_subscriber_create(const char *broker,
 	subscriber->handler = handler;
 	return subscriber;
 err:
+	if (subscriber->filters)
+		free(subscriber->filters);
 	free(subscriber);
 	return NULL;
 }
@@ -671,15 +1173,52 @@ err:
 struct ipc_subscriber *ipc_subscriber_register(const char *broker, 
 										unsigned long mask, const void *data, unsigned int size,
 										ipc_subscriber_handler handler, void *arg)
+{
+	return ipc_subscriber_registerx(broker, mask, data, size, handler, arg, NULL);
+}
+/**
+ * ipc_subscriber_registerx - 
+ * Function: the same as ipc_subscriber_register()
+ * Differences: @opts->executor, if provided, runs @handler off the receive thread.
+ *				Handlers are serialized per topic or per msg_id according to @opts->order,
+ *				the data passed to @handler is a copy owned by the dispatched work.
+ *				Note: in this mode, ipc_subscriber_unregister() must not be called in @handler context,
+ *				and the executor must outlive the subscriber.
+ *				@opts->filters, if provided, are registered to broker, only notifications matching them are sent,
+ *				they are kept and registered again when the connection is repaired.
+ */
+struct ipc_subscriber *ipc_subscriber_registerx(const char *broker, 
+										unsigned long mask, const void *data, unsigned int size,
+										ipc_subscriber_handler handler, void *arg, const struct ipc_sopts *opts)
 {
 	assert(pthread_once(&__client_once, client_init) == 0);
 	
+	int i;
 	struct ipc_subscriber *subscriber;
-	subscriber = ipc_subscriber_create(broker, mask, data, size, handler, arg);
+	if (opts && opts->nfilters) {
+		if (opts->nfilters < 0 || opts->nfilters > IPC_FILTER_MAX || !opts->filters) {
+			IPC_LOGE("subscriber filters error[%d]", opts->nfilters);
+			return NULL;
+		}
+		for (i = 0; i < opts->nfilters; i++) {
+			if (!filter_check(&opts->filters[i])) {
+				IPC_LOGE("subscriber filter %d error[type %u]", i, opts->filters[i].type);
+				return NULL;
+			}
+		}
+	}
+	subscriber = ipc_subscriber_create(broker, mask, data, size, handler, arg, opts);
 	if (!subscriber) {
 		IPC_LOGE("subscriber init error[mask %lx]", mask);
 		return NULL;
 	}
+	if (subscriber->mask && opts && opts->executor && opts->executor->execute) {
+		subscriber->dispatcher = ipc_dispatcher_create(opts);
+		if (!subscriber->dispatcher) {
+			ipc_subscriber_destroy(subscriber);
+			return NULL;
+		}
+	}
 	if (subscriber->mask) {
 		if (ipc_subscriber_run(subscriber) != 0) {
 			IPC_LOGE("subscriber run error");
@@ -1,5 +1,6 @@
 #ifndef __IPC_CLIENT_H__
 #define __IPC_CLIENT_H__
+#include <sys/uio.h>
 #include "ipc_common.h"
 
 
@@ -19,7 +20,23 @@ struct ipc_client
 	int sock;
 	int identity;
 	volatile int state;
+	int type;		/* SOCK_STREAM or SOCK_SEQPACKET, decided on connecting */
 };
+enum {
+	IPC_ORDER_TOPIC = 0,	/* Handlers of the same topic run in order, different topics run in parallel */
+	IPC_ORDER_MSGID,		/* Handlers of the same msg_id run in order, different msg_ids run in parallel */
+};
+/*
+ * Subscriber options, see ipc_subscriber_registerx().
+ */
+struct ipc_sopts
+{
+	const struct ipc_executor *executor;
+	int order;
+	const struct ipc_filter *filters;	/* Content filters evaluated by broker, see struct ipc_filter */
+	int nfilters;						/* Count of |filters|, at most IPC_FILTER_MAX */
+};
+struct ipc_dispatcher;
 struct ipc_subscriber
 {
 	unsigned long task_id;
@@ -28,15 +45,25 @@ struct ipc_subscriber
 	void *arg;
 	void *buf;
 	struct ipc_client client;
+	struct ipc_dispatcher *dispatcher;
+	struct ipc_filter *filters;
+	int nfilters;
 	unsigned int  data_len;
 	char 		  data[];
 };
 typedef	int (*ipc_subscriber_handler)(int, void *, int, void *);
 int ipc_client_init(const char *server, struct ipc_client *client);
 int ipc_client_request(struct ipc_client* client, struct ipc_msg *msg, unsigned int size, int tmo);
+int ipc_client_requestv(struct ipc_client* client, struct ipc_msg *msg,
+		const struct iovec *iov, int iovcnt, 
+		const struct iovec *riov, int riovcnt, int tmo);
+int ipc_client_batch(struct ipc_client* client, struct ipc_msg *msgs[], int count, unsigned int size, int tmo);
+int ipc_client_loglevel(struct ipc_client* client, int module, int level, int tmo);
+int ipc_client_stats(struct ipc_client* client, struct ipc_stats *stats, unsigned int size, int flags, int tmo);
 struct ipc_client* ipc_client_create(const char *server);
 void ipc_client_close(struct ipc_client* client);
 void ipc_client_destroy(struct ipc_client* client);
+void ipc_client_seqpacket(int enable);
 int ipc_client_repair(struct ipc_client *client);
 int ipc_client_publish(struct ipc_client *client, int to, unsigned long topic, int msg_id, const void *data, int size, int tmo);
 int ipc_client_publishx(struct ipc_client *client, struct ipc_msg *msg,
@@ -44,6 +71,9 @@ int ipc_client_publishx(struct ipc_client *client, struct ipc_msg *msg,
 struct ipc_subscriber *ipc_subscriber_register(const char *broker, 
 										unsigned long mask, const void *data, unsigned int size,
 										ipc_subscriber_handler handler, void *arg);
+struct ipc_subscriber *ipc_subscriber_registerx(const char *broker, 
+										unsigned long mask, const void *data, unsigned int size,
+										ipc_subscriber_handler handler, void *arg, const struct ipc_sopts *opts);
 void ipc_subscriber_unregister(struct ipc_subscriber *subscriber);
 int ipc_subscriber_report(struct ipc_subscriber *subscriber, struct ipc_msg *msg);
 int ipc_subscriber_request(struct ipc_subscriber *subscriber, struct ipc_msg *msg, unsigned int size, int tmo);
@@ -58,12 +58,17 @@ enum {
  	*/
 	IPC_BIT_REQUESTER 	= IPC_BIT_SERVER,
 	IPC_BIT_SUBSCRIBER	= 9,
+   /*
+ 	* Set by server in a reply of batched request, indicates no reply produced by handler.
+ 	*/
+	IPC_BIT_FAILED		= 14,
 	
 	IPC_BIT_ASYNC		= 15,
 	IPC_BIT_MAX 		= 16
 };
 #define IPC_FLAG_EXPECT_REPLY	(1u << IPC_BIT_REPLY)
 #define IPC_FLAG_REPLY			(1u << IPC_BIT_REPLY)
+#define IPC_FLAG_FAILED			(1u << IPC_BIT_FAILED)
 #define IPC_FLAG_CLIENT_MASK	((1u << IPC_BIT_SERVER) - 1)
 
 #define ipc_msg_buffer_size(len) (IPC_MSG_HDRLEN + (len)) /* @len: msg payload length. */
@@ -82,6 +87,116 @@ enum {
 #define ipc_notify_space_check(max, size) ipc_msg_space_check(max, ipc_notify_length(size))
 #define ipc_notify_payload_of(buf, type) ((type *)((char *)buf + IPC_MSG_HDRLEN + sizeof(struct ipc_notify)))
 
+/*
+ * Log levels, a line is printed if its level is not greater than the current level of its module.
+ * Initial levels can be set via environment variables: IPC_LOG_LEVEL and GENERIC_LOG_LEVEL,
+ * and changed at runtime via ipc_client_loglevel().
+ */
+enum IPC_LOG_LEVEL
+{
+	IPC_LOG_LEVEL_NONE = 0,
+	IPC_LOG_LEVEL_E,
+	IPC_LOG_LEVEL_W,
+	IPC_LOG_LEVEL_I,
+	IPC_LOG_LEVEL_D,
+};
+enum IPC_LOG_MODULE
+{
+	IPC_LOG_MODULE_IPC = 0,		/* libipc:  IPC_LOGx() */
+	IPC_LOG_MODULE_GENERIC,		/* liblog:  LOGx() of common libraries */
+};
+/*
+ * Content filter of notifications, evaluated by broker before sending to the subscriber.
+ * All filters of a subscriber applying to the topic of a notification must match.
+ */
+enum {
+	IPC_FILTER_MSGID = 1,	/* |msg_id| of notification is one of |msg_ids[0, count)| */
+	IPC_FILTER_EQUAL,		/* payload bytes [offset, offset + length) equal |bytes.value| */
+	IPC_FILTER_MASK,		/* payload bytes [offset, offset + length) & |bytes.mask| equal |bytes.value| */
+};
+#define IPC_FILTER_MAX		8	/* Max filters of a subscriber */
+#define IPC_FILTER_BYTES	8	/* Max |length| of IPC_FILTER_EQUAL/IPC_FILTER_MASK */
+#define IPC_FILTER_MSGIDS	4	/* Max |count| of IPC_FILTER_MSGID */
+struct ipc_filter
+{
+	unsigned long 	topic;		/* Topics this filter applies to, 0 for all topics */
+	unsigned short 	type;
+	unsigned short 	offset;		/* Payload offset, for IPC_FILTER_EQUAL/IPC_FILTER_MASK */
+	unsigned short 	length;		/* Bytes to compare, for IPC_FILTER_EQUAL/IPC_FILTER_MASK */
+	unsigned short 	count;		/* Count of |msg_ids|, for IPC_FILTER_MSGID */
+	union {
+		int msg_ids[IPC_FILTER_MSGIDS];
+		struct {
+			unsigned char value[IPC_FILTER_BYTES];
+			unsigned char mask[IPC_FILTER_BYTES];
+		} bytes;
+	};
+}__attribute__((packed));
+/*
+ * Server statistics, see ipc_client_stats().
+ * Histogram bucket 0 counts [0, 1us), bucket b counts [2^(b-1), 2^b) us, the last one is open-ended.
+ */
+#define IPC_STATS_HIST		16
+#define IPC_STATS_SIZE		0xffff	/* Max payload of statistics reply */
+#define IPC_STATS_RESET		0x1		/* Request flag: reset counters once read */
+#define IPC_STATS_TRUNCATED	0x1		/* Reply flag: not all the entries fit in the reply */
+struct ipc_stat_counter
+{
+	unsigned long long msgs_in;
+	unsigned long long bytes_in;
+	unsigned long long msgs_out;
+	unsigned long long bytes_out;
+	unsigned long long errors;		/* Sends failed */
+	unsigned long long drops;		/* Sends dropped for socket buffer of client full */
+};
+struct ipc_stat_client
+{
+	int identity;
+	int clazz;						/* enum IPC_CLASS, IPC_CLASS_DUMMY for temporary clients */
+	struct ipc_stat_counter counter;
+};
+struct ipc_stat_msg
+{
+	int msg_id;
+	unsigned int hist[IPC_STATS_HIST];	/* Handler time */
+	unsigned long long count;
+	unsigned long long failed;		/* Handler returned error */
+	unsigned long long time_sum;	/* Handler time in ns */
+	unsigned long long time_max;
+};
+struct ipc_stat_timing
+{
+	unsigned int hist[IPC_STATS_HIST];	/* Lateness of timings, expiry to handler call */
+	unsigned long long fired;
+	unsigned long long late_sum;	/* Lateness in us */
+	unsigned long long late_max;
+};
+struct ipc_stats
+{
+	unsigned long long uptime;		/* Milliseconds since ipc_server_init() or last reset */
+	unsigned int flags;
+	unsigned int nclients;
+	unsigned int nmsgs;
+	unsigned int nclients_total;	/* Clients connected, may be more than |nclients| if truncated */
+	struct ipc_stat_counter total;	/* All clients, including the ones gone */
+	struct ipc_stat_timing  timing;
+	char data[0];					/* struct ipc_stat_client[nclients], then struct ipc_stat_msg[nmsgs] */
+};
+#define ipc_stats_clients(stats)	((struct ipc_stat_client *)(stats)->data)
+#define ipc_stats_msgs(stats)		((struct ipc_stat_msg *)(ipc_stats_clients(stats) + (stats)->nclients))
+/*
+ * Executor used to run IPC work off the calling thread, e.g. an application's thread pool,
+ * through an adapter rather than a cast of the function pointer:
+ *   static int pool_execute(void *p, void (*fn)(void *), void *a) { return thread_pool_execute(p, fn, a); }
+ *   struct ipc_executor executor = { &pool, pool_execute };
+ * execute() should return 0 if @func has been accepted. Otherwise subscriber handlers run in the calling thread,
+ * and async requests of a server are refused, see struct ipc_sopts and struct ipc_aopts.
+ */
+struct ipc_executor
+{
+	void *ctx;
+	int (*execute)(void *ctx, void (*func)(void *), void *arg);
+};
 struct ipc_msg * ipc_clone_msg(const struct ipc_msg *msg, unsigned int size);
 struct ipc_msg * ipc_alloc_msg(unsigned int size);
 void ipc_free_msg(struct ipc_msg *msg);
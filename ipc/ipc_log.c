@@ -1,5 +1,13 @@
 /*
  * Copyright (c) 2017, <-Jason Chen->
+ * Version: 1.1.0 - 20261019
+ *            - Asynchronous logging:
+ *              Each thread formats its lines into its own lock-free ring, and never does any file I/O.
+ *              A background writer drains all the rings through a persistent fd, 
+ *              it sleeps while all the rings are empty and is woken up by the first line written then.
+ *              Rotation is serialized among processes by flock() on the log file, and only done by the writer.
+ *              SysV semaphore is removed.
+ *            - Runtime log level: ipc_log_level, initialized from environment variable IPC_LOG_LEVEL.
  * Issue fix: - 20211126
  *            - (1). Mult-thread-safe: localtime() -> localtime_r() in ipc_log_time().
  *            - (2). Risk of null pointer: directly use the returning of localtime() in ipc_log_time().
@@ -15,31 +23,72 @@
 #include <time.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/sem.h>
+#include <sys/file.h>
 #include "ipc_atomic.h"
 #include "ipc_base.h"
 #include "ipc_log.h"
+#include "generic_log.h"
 #define IPC_LOG_PATH		"/tmp"
 #define IPC_LOG_FILE		IPC_LOG_PATH"/ipclog"
 #define IPC_LOG_SIZE 		128 * 1024
 #define IPC_LOG_NUM 		2
 #define IPC_LOG_LINE		256
+#define IPC_LOG_RING		128		/* Lines buffered per thread, must be power of 2 */
 
-#define IPC_LOCK_INVALID		-1
-#define IPC_LOCK_INITING		-2
-static int lock = IPC_LOCK_INVALID;
-union semun {
-	    int              val;    /* Value for SETVAL */
-	    struct semid_ds *buf;    /* Buffer for IPC_STAT, IPC_SET */
-	    unsigned short  *array;  /* Array for GETALL, SETALL */
-	    struct seminfo  *__buf;  /* Buffer for IPC_INFO
-	                                (Linux specific) */
+#define RING_ACTIVE			0
+#define RING_DEAD			1
+/*
+ * Single producer - single consumer ring of formatted lines.
+ * Producer is the thread owning it, consumer is whoever holds __log_mutex.
+ */
+struct log_ring
+{
+	struct log_ring 	 *next;
+	volatile unsigned int head;		/* Written by producer only */
+	volatile unsigned int tail;		/* Written by consumer only */
+	volatile unsigned int dropped;	/* Lines dropped by producer while ring is full */
+	unsigned int 		  reported;	/* Dropped lines reported by consumer */
+	volatile int 		  state;	/* RING_DEAD after its thread exits, then recycled by a new thread */
+	unsigned short 		  len[IPC_LOG_RING];
+	char 				  line[IPC_LOG_RING][IPC_LOG_LINE];
 };
-#define lock_compare_and_swap(old_val, new_val)	ATOMIC_BCS(&lock, old_val, new_val)
+static struct log_ring * volatile __rings = NULL;	/* Registration list, push only */
+static __thread struct log_ring *__ring = NULL;
+static __thread time_t __stamp_time = -1;
+static __thread int    __stamp_len  = 0;
+static __thread char   __stamp[32];
+static pthread_key_t   __ring_key;
+static pthread_once_t  __log_once  = PTHREAD_ONCE_INIT;
+static pthread_mutex_t __log_mutex = PTHREAD_MUTEX_INITIALIZER;	/* Consumer side */
+static pthread_mutex_t __log_wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  __log_wake = PTHREAD_COND_INITIALIZER;
+static volatile int    __log_writer = 0;
+static volatile int    __log_idle = 0;	/* Writer is sleeping on __log_wake, or about to */
+static int 			   __log_fd = -1;
+int ipc_log_level = IPC_LOG_LEVEL_DEFAULT;
+/*
+ * ipc_log_parse - parse log level from a number or a name: none, error, warn, info, debug.
+ * Return -1 if @level is invalid.
+ */
+int ipc_log_parse(const char *level)
+{
+	/* Levels of ipc log are numbered the same as the generic ones */
+	return generic_log_parse(level);
+}
+static void __attribute__((constructor)) log_level_init()
+{
+	const char *env = getenv("IPC_LOG_LEVEL");
+	int level = env ? ipc_log_parse(env) : -1;
+	if (level >= 0)
+		ipc_log_level = level;
+}
 
 static int log_format(char buf[IPC_LOG_LINE], const char *format, va_list ap)
 {
@@ -47,10 +96,16 @@ static int log_format(char buf[IPC_LOG_LINE], const char *format, va_list ap)
 	struct tm tm;
 	time_t now_time;
 	now_time = time(NULL);
-	if (localtime_r(&now_time, &tm))
-		offs = strftime(buf, 32, "%b %d %H:%M:%S ", &tm);
-	else
-		offs = snprintf(buf, 32, "%s ", "");
+	/* Time prefix is formatted once per second per thread */
+	if (now_time != __stamp_time) {
+		if (localtime_r(&now_time, &tm))
+			__stamp_len = strftime(__stamp, sizeof(__stamp), "%b %d %H:%M:%S ", &tm);
+		else
+			__stamp_len = snprintf(__stamp, sizeof(__stamp), "%s ", "");
+		__stamp_time = now_time;
+	}
+	memcpy(buf, __stamp, __stamp_len);
+	offs = __stamp_len;
 
 	offs += vsnprintf(buf + offs, IPC_LOG_LINE - offs, format, ap);
 	if (offs >= IPC_LOG_LINE) {
@@ -59,154 +114,238 @@ static int log_format(char buf[IPC_LOG_LINE], const char *format, va_list ap)
 	}
 	return offs;
 }
+static void log_rotate()
+{
+	struct stat sf, st;
+	/*
+	 * Processes logging to the same file are serialized by the lock on the file,
+	 * the file is rotated only if it has not been rotated by others.
+	 */
+	if (flock(__log_fd, LOCK_EX) < 0)
+		return;
+	if (fstat(__log_fd, &sf) == 0 && stat(IPC_LOG_FILE, &st) == 0 &&
+		sf.st_ino == st.st_ino && sf.st_dev == st.st_dev && sf.st_size > IPC_LOG_SIZE) {
+		const char *log_file = IPC_LOG_FILE;
+		char file[2][PATH_MAX + 1];
+		int i = IPC_LOG_NUM - 1;
+		int n = i & 1;
 
-static void log_output(const char *format, ...)
+		sprintf(file[n], "%s.%d", log_file, i);
+		for (i--; i >= 0; i--) {
+			n = i & 1;
+			sprintf(file[n], "%s.%d", log_file, i);
+			if (access(file[n], F_OK) == 0)
+				rename(file[n], file[!n]);
+		}
+		rename(log_file, file[n]);
+	}
+	flock(__log_fd, LOCK_UN);
+	close(__log_fd);
+	__log_fd = -1;
+}
+static void log_write(const char *buf, int size)
 {
-	FILE *fp = fopen(IPC_LOG_PATH"/ipclog.lk", "a+");
-	if (fp == NULL)
+	int len;
+	struct stat sf, st;
+	/* Reopen if the file has been rotated by other processes */
+	if (__log_fd >= 0 && (stat(IPC_LOG_FILE, &st) < 0 || fstat(__log_fd, &sf) < 0 ||
+		sf.st_ino != st.st_ino || sf.st_dev != st.st_dev)) {
+		close(__log_fd);
+		__log_fd = -1;
+	}
+	if (__log_fd < 0)
+		__log_fd = open(IPC_LOG_FILE, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+	if (__log_fd < 0)
 		return;
-	
-	if (ftell(fp) < IPC_LOG_SIZE) {
-		va_list ap;
-		va_start(ap, format);
-		char buf[IPC_LOG_LINE];
-		int size = log_format(buf, format, ap);
-		fwrite(buf, size, 1, fp);
-		fflush(fp);
-		va_end(ap);
+	while (size > 0) {
+		len = write(__log_fd, buf, size);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		buf  += len;
+		size -= len;
 	}
-	fclose(fp);
+	if (fstat(__log_fd, &sf) == 0 && sf.st_size > IPC_LOG_SIZE)
+		log_rotate();
 }
-#define LOG(format,...) log_output("%s(%d) "format"\n", self_name(), gettid(), ##__VA_ARGS__)
-
-int lock_init()
+/*
+ * log_drain - write out all the lines buffered in the rings, caller must hold __log_mutex.
+ * Return the number of lines written.
+ */
+static int log_drain()
 {
-	int doing = !lock_compare_and_swap(IPC_LOCK_INVALID, IPC_LOCK_INITING);
-	if (doing) {
-		LOG("init:%d", EINPROGRESS);
-		return -1;
+	char buf[4096];
+	int n = 0, lines = 0;
+	unsigned int h, t, slot;
+	struct log_ring *r;
+	for (r = __rings; r; r = r->next) {
+		if (r->dropped != r->reported) {
+			if (n + IPC_LOG_LINE > sizeof(buf)) {
+				log_write(buf, n);
+				n = 0;
+			}
+			n += snprintf(buf + n, IPC_LOG_LINE, "W [%s] %u log lines dropped\n", self_name(), r->dropped - r->reported);
+			r->reported = r->dropped;
+		}
+		t = r->tail;
+		h = ATOMIC_GET(&r->head);
+		for (; t != h; t++, lines++) {
+			slot = t & (IPC_LOG_RING - 1);
+			if (n + r->len[slot] > sizeof(buf)) {
+				log_write(buf, n);
+				n = 0;
+			}
+			memcpy(buf + n, r->line[slot], r->len[slot]);
+			n += r->len[slot];
+		}
+		barrier();
+		r->tail = t;
 	}
-	int sem = -1;
-    key_t key = ftok(IPC_LOG_PATH, 0x96);
-    if (key == -1) {
-		LOG("ftok:%d", errno);
-        goto out;
-    }
-    sem = semget(key, 1, IPC_CREAT | IPC_EXCL | 0666);
-    if (sem == -1) {
-		if (errno == EEXIST) {
-			sem = semget(key, 1, 0666);
-			LOG("key:0x%x sem:%d", key, sem);
-		} else 
-			LOG("semget:%d", errno);
-		goto out;
-    }
-	union semun arg = {.val = 1};
-	if (semctl(sem, 0, SETVAL, arg) == -1) {
-		LOG("semctl:%d", errno);
-	    sem = -1;
-	} else
-		LOG("key:0x%x sem:%d", key, sem);
-out:
-	(void)lock_compare_and_swap(IPC_LOCK_INITING, sem);
-	LOG("lock:%d", lock);
-    return sem;
+	if (n > 0)
+		log_write(buf, n);
+	return lines;
 }
-
-static int lock_hold()
+/*
+ * log_pending - whether any ring has something for the writer.
+ */
+static int log_pending()
 {
-	if (lock < 0) {
-		if (lock_init() == -1)
-			return -1;
+	struct log_ring *r;
+	for (r = __rings; r; r = r->next) {
+		if (r->head != r->tail || r->dropped != r->reported)
+			return 1;
 	}
-	struct sembuf sop[1];
-	sop[0].sem_num = 0;
-	sop[0].sem_op = -1;
-	sop[0].sem_flg = SEM_UNDO;
-	int ret = 0;
-	/*
-	 * If an operation specifies SEM_UNDO, it will be automatically undone when the process terminates.
-	 */
-#if 1
-	do {
-		ret = semop(lock, sop, 1);
-	} while (ret < 0 && errno == EINTR);
-#else
-	struct timespec ts;
-	ts.tv_sec	= 1; 
-	ts.tv_nsec	= 0; 
-	do {
-		ret = semtimedop(lock, sop, 1, &ts);
-	} while (ret < 0 && errno == EINTR);
-#endif
-	
-	return ret;
+	return 0;
 }
-
-static int lock_relase()
+static void *log_writer(void *arg)
 {
-	if (lock < 0)
-		return -1;
-	
-	struct sembuf sop[1];
-
-	sop[0].sem_num = 0;
-	sop[0].sem_op = 1;
-	sop[0].sem_flg = SEM_UNDO;
-	int ret = 0;
-
-	do {
-		ret = semop(lock, sop, 1);
-	} while (ret < 0 && errno == EINTR);
-	
-	return ret;
+	int lines;
+	while (1) {
+		pthread_mutex_lock(&__log_mutex);
+		lines = log_drain();
+		pthread_mutex_unlock(&__log_mutex);
+		if (lines)
+			continue;
+		/*
+		 * Announce idle before the final check of the rings,
+		 * pairs with the check of __log_idle after a line is published in log_print().
+		 */
+		pthread_mutex_lock(&__log_wake_mutex);
+		__log_idle = 1;
+		barrier();
+		while (__log_idle && !log_pending())
+			pthread_cond_wait(&__log_wake, &__log_wake_mutex);
+		__log_idle = 0;
+		pthread_mutex_unlock(&__log_wake_mutex);
+	}
+	return NULL;
 }
-static void log_backup(int fd)
+static void log_writer_run()
 {
-	if (lock_hold() == -1)
-		return;
-	const char *log_file = IPC_LOG_FILE;
-	char s[32];
-	char file[2][PATH_MAX + 1] = {{0}, {0}};
-	
-	sprintf(s, "/proc/self/fd/%d", fd);
-	/* File may by renamed by other process, get its link first */
-	readlink(s, file[0], PATH_MAX);
-	/* Get its absolute pathname */
-	realpath(log_file, file[1]);
-	
-	if (strcmp(file[0], file[1])) {
-		goto out;
+	pthread_t tid;
+	pthread_attr_t attr;
+	sigset_t set, oset;
+	sigfillset(&set);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_sigmask(SIG_SETMASK, &set, &oset);
+	if (pthread_create(&tid, &attr, log_writer, NULL) != 0)
+		ATOMIC_SET(&__log_writer, 0);	/* Retry with the next line */
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
+	pthread_attr_destroy(&attr);
+}
+/*
+ * Lines buffered are written out at exit.
+ */
+static void log_exit()
+{
+	pthread_mutex_lock(&__log_mutex);
+	log_drain();
+	pthread_mutex_unlock(&__log_mutex);
+}
+/*
+ * The child has no writer, and the lines buffered belong to parent.
+ */
+static void log_atfork_child()
+{
+	struct log_ring *r;
+	pthread_mutex_init(&__log_mutex, NULL);
+	pthread_mutex_init(&__log_wake_mutex, NULL);
+	pthread_cond_init(&__log_wake, NULL);
+	for (r = __rings; r; r = r->next) {
+		r->tail 	= r->head;
+		r->reported = r->dropped;
+		if (r != __ring)
+			r->state = RING_DEAD;
 	}
-	
-	int i = IPC_LOG_NUM - 1;
-	int n = i & 1;
-	
-	sprintf(file[n], "%s.%d", log_file, i);
-	for (i--; i >= 0; i--) {
-		n = i & 1;
-		sprintf(file[n], "%s.%d", log_file, i);
-		if (access(file[n], F_OK) == 0)
-			rename(file[n], file[!n]);
+	__log_writer = 0;
+	__log_idle 	 = 0;
+}
+static void log_ring_put(void *arg)
+{
+	struct log_ring *r = (struct log_ring *)arg;
+	__ring = NULL;
+	ATOMIC_SET(&r->state, RING_DEAD);
+}
+static void log_setup()
+{
+	pthread_key_create(&__ring_key, log_ring_put);
+	pthread_atfork(NULL, NULL, log_atfork_child);
+	atexit(log_exit);
+}
+static struct log_ring *log_ring_get()
+{
+	struct log_ring *r;
+	pthread_once(&__log_once, log_setup);
+	/* Recycle the ring of an exited thread */
+	for (r = __rings; r; r = r->next) {
+		if (r->state == RING_DEAD && ATOMIC_BCS(&r->state, RING_DEAD, RING_ACTIVE))
+			goto out;
 	}
-	rename(log_file, file[n]);
+	r = (struct log_ring *)calloc(1, sizeof(struct log_ring));
+	if (!r)
+		return NULL;
+	r->state = RING_ACTIVE;
+	do {
+		r->next = __rings;
+	} while (!ATOMIC_BCS(&__rings, r->next, r));
 out:
-	lock_relase();
+	__ring = r;
+	pthread_setspecific(__ring_key, r);
+	return r;
 }
-
 static void log_print(const char *format, va_list ap)
 {
-	FILE *fp = fopen(IPC_LOG_FILE, "a+");
-	if (fp == NULL)
+	unsigned int h, slot;
+	struct log_ring *r = __ring;
+	if (!r && !(r = log_ring_get()))
 		return;
-	char buf[IPC_LOG_LINE];
-	int size = log_format(buf, format, ap);
-	fwrite(buf, size, 1, fp);
-	fflush(fp);
-	if (ftell(fp) > IPC_LOG_SIZE)
-		log_backup(fileno(fp));
-	
-	fclose(fp);
+	if (!__log_writer && ATOMIC_BCS(&__log_writer, 0, 1))
+		log_writer_run();
+	h = r->head;
+	if (h - ATOMIC_GET(&r->tail) >= IPC_LOG_RING) {
+		r->dropped++;
+		return;
+	}
+	slot = h & (IPC_LOG_RING - 1);
+	r->len[slot] = log_format(r->line[slot], format, ap);
+	barrier();
+	r->head = h + 1;
+	/*
+	 * The writer sleeps only when all the rings are empty,
+	 * so this is the first line since then, wake it up.
+	 */
+	barrier();
+	if (__log_idle) {
+		pthread_mutex_lock(&__log_wake_mutex);
+		if (__log_idle) {
+			__log_idle = 0;
+			pthread_cond_signal(&__log_wake);
+		}
+		pthread_mutex_unlock(&__log_wake_mutex);
+	}
 }
 static void log_debug(const char *format, va_list ap)
 {
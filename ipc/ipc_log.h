@@ -1,9 +1,22 @@
 #ifndef __IPC_LOG_H__
 #define __IPC_LOG_H__
 #include <stdio.h>
+#include "ipc_common.h"
 
 void ipc_log(const char *format, ...);
 void ipc_dbg(const char *format, ...);
+int  ipc_log_parse(const char *level);
+
+#ifndef IPC_LOG_LEVEL_DEFAULT
+#define IPC_LOG_LEVEL_DEFAULT	IPC_LOG_LEVEL_I
+#endif
+extern int ipc_log_level;
+/*
+ * One branch before any formatting, only debug lines are expected to be off.
+ */
+#define ipc_log_enabled(level)	(ipc_log_level >= (level))
+#define ipc_log_wanted(level)	((level) == IPC_LOG_LEVEL_D ? \
+									__builtin_expect(ipc_log_enabled(level), 0) : ipc_log_enabled(level))
 
 #define IPC_LOG_CONSOLE 	0
 #define IPC_LOG_DEBUG 		0
@@ -15,11 +28,16 @@ void ipc_dbg(const char *format, ...);
 #endif
 
 
-#define IPC_LOGI(format,...) IPC_LOG("I [%s] %s(%d): "format"\n", __LOGTAG__, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define IPC_LOGW(format,...) IPC_LOG("W [%s] %s(%d): "format"\n", __LOGTAG__, __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define IPC_LOGE(format,...) IPC_LOG("E [%s] %s(%d): "format"\n", __LOGTAG__, __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define IPC_LOGX(level, tag, format,...) \
+	do { \
+		if (ipc_log_wanted(level)) \
+			IPC_LOG(tag" [%s] %s(%d): "format"\n", __LOGTAG__, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
+	} while (0)
+#define IPC_LOGI(format,...) IPC_LOGX(IPC_LOG_LEVEL_I, "I", format, ##__VA_ARGS__)
+#define IPC_LOGW(format,...) IPC_LOGX(IPC_LOG_LEVEL_W, "W", format, ##__VA_ARGS__)
+#define IPC_LOGE(format,...) IPC_LOGX(IPC_LOG_LEVEL_E, "E", format, ##__VA_ARGS__)
 #if IPC_LOG_DEBUG
-#define IPC_LOGD(format,...) IPC_LOG("D [%s] %s(%d): "format"\n", __LOGTAG__, __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define IPC_LOGD(format,...) IPC_LOGX(IPC_LOG_LEVEL_D, "D", format, ##__VA_ARGS__)
 #else
 #define IPC_LOGD(format,...)
 #endif
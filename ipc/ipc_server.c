@@ -1,5 +1,23 @@
 /*
  * Copyright (c) 2017, <-Jason Chen->
+ * Version: 1.2.4 - 20261019
+ *				  - Add ipc_aopts.executor: async requests may run on an application's thread pool,
+ *					requests of one connection are queued and served in order instead of refused as busy.
+ *				  - Add ipc_aopts.cpuset, async tasks are named ipc-async/<n>.
+ *				  - Add in-process loopback: ipc_client_request() to a server running in the same process
+ *					is handed to the core through a lock-free stack, no sockets, see IPC_SEROPT_SET_LOOPBACK.
+ *				  - Add SOCK_SEQPACKET transport: IPC_SEROPT_ENABLE_SEQPACKET, one message per receive,
+ *					negotiated per connection, stream clients are served as before.
+ *				  - Add flight recorder: IPC_SEROPT_SET_TRACE, ipc_server_trace_dump().
+ *				  - Add shared memory broadcast channels of topics: IPC_SEROPT_SET_CHANNEL.
+ *				  - Add traffic capture: IPC_SEROPT_SET_CAPTURE, replayed by sample/ipc-replay.
+ *				  - Add IPC_SDK_MSG_STATS: traffic of clients, handler time per message ID and lateness of timings.
+ *				  - Support multi-bit topic publish: delivered once to every subscriber matching any bit, 
+ *					see ipc_topic_dispatch().
+ *				  - Evaluate content filters registered by subscribers before sending notifications.
+ *				  - Add IPC_SDK_MSG_LOGLEVEL: query or change log levels of server at runtime.
+ *				  - Add IPC_SDK_MSG_BATCH: requests in one envelope are handled back to back,
+ *					and their replies are returned in one envelope.
  * Version: 1.2.3 - 20230410
  *				  - Add epoll support.
  * Version: 1.2.2 - 20230406
@@ -40,6 +58,7 @@
  * Brief : This program is the implementation of IPC server core.
  * Date  : Created at 2017/11/01
  */
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,12 +66,19 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <signal.h>
+#include <sched.h>
 #include <pthread.h>
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "ipc_server.h"
 #include "ipc_log.h"
 #include "ipc_base.h"
+#include "ipc_trace.h"
+#include "ipc_capture.h"
+#include "ipc_channel.h"
 #define IPC_PERF	1
 #define IPC_EPOLL	0
 #define IPC_DEBUG	1
@@ -66,6 +92,7 @@ struct ipc_task
 {
 	pthread_t tid;
 	struct ipc_async 	*async;
+	struct ipc_async_req *req;	/* Request being run */
 	struct ipc_pool 	*pool;
 	struct list_head 	list;
 };
@@ -77,6 +104,8 @@ struct ipc_pool
 	int idletasks;
 	int linger;	
 	int flags;
+	int scheduled;			/* Jobs handed to |executor| and not done yet */
+	struct ipc_executor executor;	/* External executor, execute() NULL if none, see struct ipc_aopts */
 	struct list_head async_head;	
 	struct list_head active_task_head;
 	pthread_attr_t attr;
@@ -89,19 +118,26 @@ struct ipc_pool
 #define	ASYNC_PENDING	1
 #define ASYNC_EXECUTING	2
 #define ASYNC_EXITED	4
+struct ipc_async_req
+{
+	void 	*arg;
+	void (*func)(struct ipc_msg *, void *);
+	void (*release)(struct ipc_msg *, void *);
+	struct ipc_msg 	*msg;
+	struct list_head list;
+};
 /* 
  * Cookie type, provide an ability for server to process request asynchronously.
  * Set through ipc_server_bind(const struct ipc_server *sevr, int type, void *cookie).
+ * Also the serial queue of the connection: its requests run one at a time, in order,
+ * whichever task or executor thread picks it up.
  */
 struct ipc_async
 {
 	int		type;	/* Cookie type: Keep at the first field */
-	void 	*arg;
-	void (*func)(struct ipc_msg *, void *);
-	void (*release)(struct ipc_msg *, void *);
 	volatile int state;
 	const struct ipc_server *sevr;
-	struct ipc_msg 	*msg;
+	struct list_head reqs;	/* Requests not done yet, the running one is out of it */
 	struct list_head list;
 };
 enum {
@@ -109,6 +145,16 @@ enum {
 };
 #define BACKLOG 5
 #define IPC_MSG_BUFFER_SIZE 8192
+#define IPC_STATS_MSGS		256		/* Message IDs tracked, the ones beyond share one entry */
+#define IPC_CHANNELS_MAX	8
+#define IPC_PACKET_BURST	16		/* Messages handled per wakeup of a SOCK_SEQPACKET connection */
+/* States of a loopback request */
+#define IPC_LB_PENDING		0
+#define IPC_LB_COPYIN		1	/* Request being copied into the clone, caller may not leave */
+#define IPC_LB_HANDLING		2
+#define IPC_LB_COPYING		3	/* Response being copied back, caller may not leave */
+#define IPC_LB_DONE			4
+#define IPC_LB_CANCELED		5
 struct ipc_node
 {
 	struct list_head list;
@@ -118,6 +164,9 @@ struct ipc_peer
 {
 	struct ipc_node 	*node;
 	unsigned long 		 mask;
+	unsigned long 		 stamp;	/* Stamp of the last dispatch delivered, protected by IPC Lock */
+	int 				 nfilters;
+	struct ipc_filter	*filters;	/* Content filters registered by subscriber */
 	struct ipc_server	 sevr;
 };
 struct ipc_proxy
@@ -126,6 +175,19 @@ struct ipc_proxy
 	int (*handler)(int, void *);
 	struct ipc_server	sevr;
 };
+/*
+ * Request of a client in the server process itself, see ipc_loopback_request().
+ * Owned by both the caller and the core, the last one to drop it frees it.
+ */
+struct ipc_loopback
+{
+	struct ipc_loopback *next;
+	struct ipc_msg *msg;	/* Caller's message, or the copy following this node if no reply is expected */
+	unsigned int size;		/* Size of caller's buffer */
+	int rc;
+	uint32_t state;			/* IPC_LB_XXX, futex word of the caller */
+	int refs;
+};
 struct ipc_core {
 	struct list_head timing;
 #if IPC_EPOLL
@@ -158,9 +220,36 @@ struct ipc_core {
 	struct ipc_server *dummy;
 	struct ipc_buf	  *buf;
 	struct ipc_msg 	  *clone;
+	struct ipc_msg 	  *batch;	/* Envelope of batched replies, allocated on demand */
+	struct ipc_msg 	  *bclone;	/* Batched request being handled, allocated on demand */
 	struct ipc_pool	  *pool;
 	/* IPC Lock */
 	void   *mutex;
+	/* Dispatch stamp, protected by IPC Lock */
+	unsigned long stamp;
+	/* Statistics, see IPC_SDK_MSG_STATS */
+	struct ipc_stat_counter  total;
+	struct ipc_stat_timing	 lateness;
+	struct ipc_stat_msg		*stat_msgs;	/* Per message ID, allocated on demand */
+	struct ipc_stat_msg		 stat_other;
+	uint64_t 				 stat_start;
+	/* Flight recorder, null if not enabled */
+	struct ipc_trace  *trace;
+	/* Broadcast channels, topics in |channel_mask| are published through them instead of sockets */
+	struct ipc_channel *channels[IPC_CHANNELS_MAX];
+	unsigned long		channel_topics[IPC_CHANNELS_MAX];
+	unsigned long		channel_mask;
+	int					nchannels;
+	/* In-process loopback, requests pushed by other threads, woken through |lb_efd| */
+	struct ipc_loopback *lb_head;
+	struct ipc_msg		*lb_clone;	/* Queued request being handled, if caller's buffer is short */
+	int					 lb_efd;
+	int					 lb_off;
+	/* Traffic capture, null if not enabled */
+	struct ipc_capture *capture;
+	struct ipc_timing	capture_timing;	/* Flushes capture while server is idle */
+	const char		  *trace_path;
+	int 			   trace_signo;
 	
 	const char *path;
 	const char *server;
@@ -176,12 +265,121 @@ static struct ipc_server	__ipc_dummy = {
 	.cookie 	= NULL,
 	.identity	= -1,
 };	 	
+/* Handle of in-process loopback requests, no socket behind */
+static struct ipc_server	__ipc_loopback = {
+	.clazz 	 	= IPC_CLASS_DUMMY,
+	.handler 	= NULL,
+	.cookie 	= NULL,
+	.identity	= -1,
+	.sock		= -1,
+};
 static struct ipc_core 		__ipc_core =
 {
 	.flags = 0,
 };
+static int __ipc_trace_wfd = -1;	/* Write end of self-pipe, dump on signal */
 #define current_core() 	(&__ipc_core)
 #define __LOGTAG__ (current_core()->server)
+static inline int stat_bucket(unsigned long long us)
+{
+	int b = us ? 64 - __builtin_clzll(us) : 0;
+	return b < IPC_STATS_HIST ? b : IPC_STATS_HIST - 1;
+}
+/**
+ * stat_recv - account a message received from @s, IPC core context only.
+ * Messages are captured here as well, see IPC_SEROPT_SET_CAPTURE.
+ */
+static inline void stat_recv(struct ipc_core *core, struct ipc_server *s, const struct ipc_msg *msg)
+{
+	if (core->capture)
+		ipc_capture_write(core->capture, s->identity, s->sock, s->clazz, IPC_CAPTURE_IN, msg);
+	s->counter.msgs_in++;
+	s->counter.bytes_in += __data_len(msg);
+	core->total.msgs_in++;
+	core->total.bytes_in += __data_len(msg);
+}
+/**
+ * stat_send - account a message sent to @s, @rc is the result of sending.
+ * Sends happen in publishing and async threads as well, counters are updated atomically.
+ */
+static inline void stat_send(struct ipc_core *core, const struct ipc_server *s, const struct ipc_msg *msg, int rc)
+{
+	unsigned int len = __data_len(msg);
+	struct ipc_stat_counter *c = (struct ipc_stat_counter *)&s->counter;
+	if (rc >= 0) {
+		if (core->capture)
+			ipc_capture_write(core->capture, s->identity, s->sock, s->clazz, IPC_CAPTURE_OUT, msg);
+		ATOMIC_FADD(&c->msgs_out, 1);
+		ATOMIC_FADD(&c->bytes_out, len);
+		ATOMIC_FADD(&core->total.msgs_out, 1);
+		ATOMIC_FADD(&core->total.bytes_out, len);
+	} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+		ATOMIC_FADD(&c->drops, 1);
+		ATOMIC_FADD(&core->total.drops, 1);
+	} else {
+		ATOMIC_FADD(&c->errors, 1);
+		ATOMIC_FADD(&core->total.errors, 1);
+	}
+}
+/**
+ * stat_handler - account a handler call of @msg_id which took @ns, IPC core context only.
+ */
+static void stat_handler(struct ipc_core *core, int msg_id, uint64_t ns, int failed)
+{
+	unsigned int i;
+	struct ipc_stat_msg *m = &core->stat_other;
+	if (!core->stat_msgs)
+		core->stat_msgs = calloc(IPC_STATS_MSGS, sizeof(struct ipc_stat_msg));
+	if (core->stat_msgs) {
+		for (i = 0; i < IPC_STATS_MSGS; i++) {
+			struct ipc_stat_msg *slot = &core->stat_msgs[(msg_id + i) & (IPC_STATS_MSGS - 1)];
+			if (!slot->count || slot->msg_id == msg_id) {
+				m = slot;
+				break;
+			}
+		}
+	}
+	m->msg_id = m == &core->stat_other ? -1 : msg_id;
+	m->count++;
+	if (failed)
+		m->failed++;
+	m->time_sum += ns;
+	if (ns > m->time_max)
+		m->time_max = ns;
+	m->hist[stat_bucket(ns / 1000)]++;
+}
+/**
+ * stat_timing - account lateness of @timing expired at @now, IPC core context only.
+ */
+static inline void stat_timing(struct ipc_core *core, const struct ipc_timing *timing, const struct timeval *now)
+{
+	long long late = (now->tv_sec - timing->expire.tv_sec) * 1000000LL;
+#if IPC_EPOLL
+	late += (now->tv_usec - timing->expire.tv_usec) * 1000LL;	/* |tv_usec| holds milliseconds */
+#else
+	late += now->tv_usec - timing->expire.tv_usec;
+#endif
+	if (late < 0)
+		late = 0;
+	core->lateness.fired++;
+	core->lateness.late_sum += late;
+	if (late > core->lateness.late_max)
+		core->lateness.late_max = late;
+	core->lateness.hist[stat_bucket(late)]++;
+}
+static void stat_reset(struct ipc_core *core)
+{
+	struct ipc_server *s;
+	list_for_each_entry(s, &core->head, list)
+		memset(&s->counter, 0, sizeof(s->counter));
+	memset(&core->dummy->counter, 0, sizeof(core->dummy->counter));
+	memset(&core->total, 0, sizeof(core->total));
+	memset(&core->lateness, 0, sizeof(core->lateness));
+	memset(&core->stat_other, 0, sizeof(core->stat_other));
+	if (core->stat_msgs)
+		memset(core->stat_msgs, 0, IPC_STATS_MSGS * sizeof(struct ipc_stat_msg));
+	core->stat_start = ipc_trace_now();
+}
 #define ipc_core_inited(c)	((c) && ((c)->flags & IPC_CORE_F_INITED))
 #define ipc_core_running(c)	((c) && ((c)->flags & IPC_CORE_F_RUN))
 #define ipc_core_context(c)	((c)->tid == gettid())
@@ -219,33 +417,107 @@ static void ipc_async_task_cleanup(void *arg)
 	pthread_mutex_unlock(pool->mutex);
 	IPC_LOGI("Task exit cleanup ntasks:%d.", pool->ntasks);
 }
+/* Drop a request that is not going to run, with |pool->mutex| held */
+static void ipc_async_drop(struct ipc_async_req *req)
+{
+	list_delete(&req->list);
+	if (req->release)
+		req->release(req->msg, req->arg);
+	ipc_free_msg(req->msg);
+	free(req);
+}
+/**
+ * ipc_async_schedule - queue @async to run its first request, called with |pool->mutex| held.
+ * The mutex is dropped around execute() of an external executor, which may block or run the job inline.
+ * Returns -1 on failure, with @async back to ASYNC_IDLE. If the connection is released meanwhile,
+ * its requests are dropped and @async is freed, 0 is returned as there is nothing left to schedule.
+ */
+static int ipc_async_schedule(struct ipc_pool *pool, struct ipc_async *async);
 static void ipc_async_cleanup(void *arg)
 {
 	struct ipc_task *task = arg;
-	pthread_mutex_lock(task->pool->mutex);
+	struct ipc_async *async = task->async;
+	struct ipc_async_req *req = task->req;
+	struct ipc_pool *pool = task->pool;
+	pthread_mutex_lock(pool->mutex);
 	list_delete(&task->list);
-	IPC_LOGI("IPC async state:%d", task->async->state);
+	IPC_LOGI("IPC async state:%d", async->state);
 	
-	if (task->async->state & ASYNC_EXITED) {
-		ipc_free_msg(task->async->msg);
-		free(task->async);
-		IPC_LOGI("IPC async free:%p", task->async);
+	if (async->state & ASYNC_EXITED) {
+		ipc_free_msg(req->msg);
+		free(req);
+		/* Requests queued behind were dropped on release */
+		IPC_LOGI("IPC async free:%p", async);
+		free(async);
 	} else {
-		IPC_LOGI("IPC async proc msg:%d, flags:%04x.", task->async->msg->msg_id, task->async->msg->flags);
-		if (task->async->msg->flags & IPC_FLAG_REPLY)
-			send_msg(task->async->sevr->sock, task->async->msg);
+		IPC_LOGI("IPC async proc msg:%d, flags:%04x.", req->msg->msg_id, req->msg->flags);
+		if (req->msg->flags & IPC_FLAG_REPLY)
+			stat_send(current_core(), async->sevr, req->msg,
+				send_msg(async->sevr->sock, req->msg));
 		
-		ipc_free_msg(task->async->msg);
-		task->async->msg 	 = NULL;
-		task->async->state 	 = ASYNC_IDLE;
-		task->async->func	 = NULL;
-		task->async->release = NULL;
+		ipc_free_msg(req->msg);
+		free(req);
+		async->state = ASYNC_IDLE;
+		/* Next request of the connection, behind the ones of others */
+		if (!list_empty(&async->reqs) && ipc_async_schedule(pool, async) < 0) {
+			struct ipc_async_req *r, *tmp;
+			list_for_each_entry_safe(r, tmp, &async->reqs, list)
+				ipc_async_drop(r);
+		}
+	}
+	if (pool->executor.execute && --pool->scheduled == 0 && (pool->flags & __bit(TASK_POOL_DESTROY)))
+		pthread_cond_broadcast(&pool->exit_cond);
+}
+/**
+ * ipc_async_run - run the first request of @async, called with |pool->mutex| held, returns with it held.
+ * @task: the running thread
+ */
+static void ipc_async_run(struct ipc_task *task, struct ipc_async *async)
+{
+	struct ipc_async_req *req = list_first_entry(&async->reqs, struct ipc_async_req, list);
+	list_del_init(&req->list);
+	task->async = async;
+	task->req	= req;
+	async->state = ASYNC_EXECUTING;
+	pthread_mutex_unlock(task->pool->mutex);
+
+	pthread_cleanup_push(ipc_async_cleanup, task);
+	req->func(req->msg, req->arg);
+	pthread_cleanup_pop(1);
+}
+static void ipc_async_unlock(void *mutex)
+{
+	pthread_mutex_unlock((pthread_mutex_t *)mutex);
+}
+/* Job handed to the external executor */
+static void ipc_async_job(void *arg)
+{
+	struct ipc_async *async = arg;
+	struct ipc_pool *pool = &__ipc_async_pool;
+	struct ipc_task task;
+
+	task.tid  = pthread_self();
+	task.pool = pool;
+	INIT_LIST_HEAD(&task.list);
+
+	pthread_mutex_lock(pool->mutex);
+	if (async->state & ASYNC_EXITED) {
+		/* Connection released before the executor got to it */
+		free(async);
+		if (--pool->scheduled == 0 && (pool->flags & __bit(TASK_POOL_DESTROY)))
+			pthread_cond_broadcast(&pool->exit_cond);
+		pthread_mutex_unlock(pool->mutex);
+		return;
 	}
+	pthread_cleanup_push(ipc_async_unlock, pool->mutex);
+	ipc_async_run(&task, async);
+	pthread_cleanup_pop(1);
 }
 static void *ipc_async_task(void *arg)
 {
 	int timedout = 0;
 	struct ipc_pool *pool = arg;
+	char name[32];
 
 	struct ipc_task task;
 
@@ -259,6 +531,10 @@ static void *ipc_async_task(void *arg)
 	
 	pthread_mutex_lock(pool->mutex);
 	pthread_cleanup_push(ipc_async_task_cleanup, pool);
+	/* Counted by creator under the lock */
+	snprintf(name, sizeof(name), "ipc-async/%d", pool->ntasks);
+	name[15] = '\0';
+	pthread_setname_np(task.tid, name);
 	while (1) {
 
 		pool->idletasks++;			
@@ -288,15 +564,9 @@ static void *ipc_async_task(void *arg)
 		
 		if (!list_empty(&pool->async_head)) {
 			struct ipc_async *async = list_first_entry(&pool->async_head, struct ipc_async, list);
-			task.async = async;
-			async->state = ASYNC_EXECUTING;
 			list_del_init(&async->list);	
 			list_add_tail(&task.list, &pool->active_task_head);
-			pthread_mutex_unlock(pool->mutex);
-			
-			pthread_cleanup_push(ipc_async_cleanup, &task);
-			async->func(async->msg, async->arg);
-			pthread_cleanup_pop(1);
+			ipc_async_run(&task, async);
 		}
 
 		if (timedout && (pool->ntasks > pool->mintasks))
@@ -317,6 +587,39 @@ static int ipc_async_task_create(struct ipc_pool *pool)
 
 	return error;
 }
+static int ipc_async_schedule(struct ipc_pool *pool, struct ipc_async *async)
+{
+	int rc;
+	if (pool->executor.execute) {
+		/* Claimed before unlocking: requests arriving meanwhile queue behind, release leaves it to the job */
+		async->state = ASYNC_PENDING;
+		pool->scheduled++;
+		pthread_mutex_unlock(pool->mutex);
+		rc = pool->executor.execute(pool->executor.ctx, ipc_async_job, async);
+		pthread_mutex_lock(pool->mutex);
+		if (rc >= 0)
+			return 0;	/* @async may be done and gone already */
+		IPC_LOGE("IPC async executor refused.");
+		if (--pool->scheduled == 0 && (pool->flags & __bit(TASK_POOL_DESTROY)))
+			pthread_cond_broadcast(&pool->exit_cond);
+		if (async->state & ASYNC_EXITED) {
+			IPC_LOGI("IPC async free:%p", async);
+			free(async);
+			return 0;
+		}
+		async->state = ASYNC_IDLE;
+		return -1;
+	} else {
+		list_add_tail(&async->list, &pool->async_head);
+		if (pool->idletasks > 0) {
+			pthread_cond_signal(&pool->work_cond);
+		} else if (pool->ntasks < pool->maxtasks && ipc_async_task_create(pool) == 0) {
+			pool->ntasks++;
+		}
+	}
+	async->state = ASYNC_PENDING;
+	return 0;
+}
 static void ipc_async_setup(struct ipc_pool * pool)
 {
 	assert(!pthread_condattr_init(&__ipc_cond_attr));
@@ -324,6 +627,7 @@ static void ipc_async_setup(struct ipc_pool * pool)
 	pool->flags 		= 0;
 	pool->ntasks		= 0;
 	pool->idletasks 	= 0;
+	pool->scheduled 	= 0;
 	pool->mutex 		= &__ipc_async_mutex;
 
 	assert(!pthread_cond_init(&pool->work_cond, &__ipc_cond_attr));
@@ -332,7 +636,6 @@ static void ipc_async_setup(struct ipc_pool * pool)
 	assert(!pthread_attr_setdetachstate(&pool->attr, PTHREAD_CREATE_DETACHED));
 	INIT_LIST_HEAD(&pool->async_head);
 	INIT_LIST_HEAD(&pool->active_task_head);
-	IPC_LOGI("Task pool create done<%d-%d>.", pool->mintasks, pool->maxtasks);
 }
 static void ipc_async_exit(struct ipc_pool * pool)
 {
@@ -356,6 +659,9 @@ static void ipc_async_exit(struct ipc_pool * pool)
 	
 	while (pool->ntasks > 0)
 		pthread_cond_wait(&pool->exit_cond, pool->mutex);
+	/* Jobs handed to an executor are not ours to cancel, they refer to |pool| until done */
+	while (pool->scheduled > 0)
+		pthread_cond_wait(&pool->exit_cond, pool->mutex);
 
 	pthread_mutex_unlock(pool->mutex);
 
@@ -364,6 +670,11 @@ static void ipc_async_exit(struct ipc_pool * pool)
 	pthread_attr_destroy(&pool->attr);
 	pthread_condattr_destroy(&__ipc_cond_attr);
 }
+/**
+ * ipc_async_execute - finish the request @msg out of the handler, in an async task or the executor.
+ * Requests of one connection are served one at a time in order: a request arriving while an earlier
+ * one is still pending or running waits behind it.
+ */
 int ipc_async_execute(void *cookie,	/* @cookie: We assert that it  is type of struct ipc_async */
 				struct ipc_msg *msg,		/* @msg : IPC request to execute asynchronously */
 				unsigned int size,			/* @size: Max size of response */
@@ -385,35 +696,32 @@ int ipc_async_execute(void *cookie,	/* @cookie: We assert that it  is type of st
 	}
 	struct ipc_pool *pool = core->pool;
 	struct ipc_async *async = cookie;
-	pthread_mutex_lock(pool->mutex);
-	if (async->state != ASYNC_IDLE) {
-		IPC_LOGE("IPC async busy state:%d.", async->state);
-		goto err;
+	struct ipc_async_req *req = malloc(sizeof(struct ipc_async_req));
+	if (!req) {
+		IPC_LOGE("IPC async none memory.");
+		return -1;
 	}
-	assert(async->msg == NULL);
-	async->func 	= func;
-	async->release	= release;
-	async->arg		= arg;
-	async->state	= ASYNC_PENDING;
-	async->msg = ipc_clone_msg(msg, size);
-	if (!async->msg) {
+	req->func 	 = func;
+	req->release = release;
+	req->arg	 = arg;
+	req->msg = ipc_clone_msg(msg, size);
+	if (!req->msg) {
 		IPC_LOGE("IPC async none memory.");
-		goto err;
+		free(req);
+		return -1;
 	}
-	msg->flags |= __bit(IPC_BIT_ASYNC);
-
-	list_add_tail(&async->list, &pool->async_head);
-
-	if (pool->idletasks > 0) {
-		pthread_cond_signal(&pool->work_cond);
-	} else if (pool->ntasks < pool->maxtasks && ipc_async_task_create(pool) == 0) {
-		pool->ntasks++;
+	pthread_mutex_lock(pool->mutex);
+	list_add_tail(&req->list, &async->reqs);
+	if (async->state == ASYNC_IDLE && ipc_async_schedule(pool, async) < 0) {
+		list_delete(&req->list);
+		pthread_mutex_unlock(pool->mutex);
+		ipc_free_msg(req->msg);
+		free(req);
+		return -1;
 	}
 	pthread_mutex_unlock(pool->mutex);
+	msg->flags |= __bit(IPC_BIT_ASYNC);
 	return 0;
-err:
-	pthread_mutex_unlock(pool->mutex);
-	return -1;
 }
 static struct ipc_async * ipc_async_alloc(const struct ipc_server *sevr)
 {
@@ -423,7 +731,7 @@ static struct ipc_async * ipc_async_alloc(const struct ipc_server *sevr)
 		memset(async, 0, sizeof(*async));	
 
 		INIT_LIST_HEAD(&async->list);
-		async->msg 		= NULL;
+		INIT_LIST_HEAD(&async->reqs);
 		async->sevr 	= sevr;
 		async->state	= ASYNC_IDLE;
 		async->type 	= IPC_COOKIE_ASYNC;
@@ -434,20 +742,30 @@ static struct ipc_async * ipc_async_alloc(const struct ipc_server *sevr)
 }
 static void ipc_async_release(struct ipc_pool *pool, struct ipc_async *async)
 {
+	struct ipc_async_req *req, *tmp;
 	pthread_mutex_lock(pool->mutex);
 	IPC_LOGI("IPC async state:%d.", async->state);
 	switch (async->state) {
 	case ASYNC_PENDING:
+		if (pool->executor.execute) {
+			/* Already handed to the executor, the job frees it */
+			list_for_each_entry_safe(req, tmp, &async->reqs, list)
+				ipc_async_drop(req);
+			async->state |= ASYNC_EXITED;
+			async->sevr = NULL;
+			break;
+		}
 		list_delete(&async->list);
 	case ASYNC_IDLE:
 		IPC_LOGI("IPC async free:%p.", async);
-		if (async->release)
-			async->release(async->msg, async->arg);
-		if (async->msg)
-			ipc_free_msg(async->msg);
+		list_for_each_entry_safe(req, tmp, &async->reqs, list)
+			ipc_async_drop(req);
 		free(async);
 		break;
 	case ASYNC_EXECUTING:
+		/* The running request is out of |reqs|, ipc_async_cleanup() frees it with |async| */
+		list_for_each_entry_safe(req, tmp, &async->reqs, list)
+			ipc_async_drop(req);
 		async->state |= ASYNC_EXITED;
 		async->sevr = NULL;
 		break;
@@ -463,19 +781,6 @@ static inline int ipc_server_manager(
 {
 	return core->manager ? core->manager(sevr, cmd, data, core->arg, sevr->cookie) : 0;
 }
-/* bit_index - calculate the index of the highest bit 1 with the mask
- * @mask: mask to calculate
- */
-static inline int bit_index(unsigned long mask)
-{
-    int i;
-    i = -1;
-    do {
-        mask >>= 1;
-        i++;
-    } while (mask);
-    return i;
-}
 /* bit_count - calculate how many bits of 1 with the mask
  * @mask: mask to calculate
  */
@@ -564,6 +869,7 @@ static inline void sevr_init(struct ipc_core *core, struct ipc_server *sevr,
 	sevr->identity	= identity;
 	sevr->handler	= handler;
 	sevr->cookie 	= NULL;
+	memset(&sevr->counter, 0, sizeof(sevr->counter));
 	list_add_tail(&sevr->list, &core->head);
 #if IPC_EPOLL
 	epoll_add(sevr, core);
@@ -675,9 +981,11 @@ static void timing_insert(struct ipc_core *core, struct ipc_timing *timing)
 	}
 	list_add_tail(&timing->list, p);
 }
-static int ipc_handler_invoke(struct ipc_core *core, struct ipc_server *s, struct ipc_msg *msg)
+/**
+ * ipc_msg_classify - mark the class of @s in the server bits of @msg
+ */
+static inline int ipc_msg_classify(struct ipc_server *s, struct ipc_msg *msg)
 {
-	struct ipc_peer *peer = NULL;
 	msg->flags &= IPC_FLAG_CLIENT_MASK;
 	switch (s->clazz) {
 	case IPC_CLASS_DUMMY:
@@ -687,7 +995,6 @@ static int ipc_handler_invoke(struct ipc_core *core, struct ipc_server *s, struc
 		break;
 	case IPC_CLASS_SUBSCRIBER:
 		msg->flags |= __bit(IPC_BIT_SUBSCRIBER);
-		peer = container_of(s, struct ipc_peer, sevr);
 		break;
 	case IPC_CLASS_MASTER:
 	case IPC_CLASS_PROXY:
@@ -695,51 +1002,248 @@ static int ipc_handler_invoke(struct ipc_core *core, struct ipc_server *s, struc
 		return -1;
 	}
 	assert(s->clazz == ipc_class(msg));
+	return 0;
+}
+static int ipc_handler_invoke(struct ipc_core *core, struct ipc_server *s, struct ipc_msg *msg)
+{
+	int rc, msg_id = msg->msg_id;
+	uint64_t start;
+	if (ipc_msg_classify(s, msg) < 0)
+		return -1;
 	/* invoke the user's specific ipc message process handler */
-	if (core->handler(msg, core->arg, s->cookie) < 0)
+	ipc_trace_stamp(IPC_TRACE_ENTER);
+	start = ipc_trace_now();
+	rc = core->handler(msg, core->arg, s->cookie);
+	stat_handler(core, msg_id, ipc_trace_now() - start, rc < 0);
+	ipc_trace_stamp(IPC_TRACE_LEAVE);
+	if (rc < 0)
 		return 0;
 	if (msg->flags & __bit(IPC_BIT_ASYNC)) {
 		IPC_LOGI("IPC async message:%d.", msg->msg_id);
 		return 0;
 	}
-	/* check if this message with a response */
-	if (!(msg->flags & __bit(IPC_BIT_REPLY)) || peer)
+	/* check if this message with a response, subscribers never get a response */
+	if (!(msg->flags & __bit(IPC_BIT_REPLY)) || s->clazz == IPC_CLASS_SUBSCRIBER)
 		return 0;
-	if (send_msg(s->sock, msg) < 0) {
+	rc = send_msg(s->sock, msg);
+	stat_send(core, s, msg, rc);
+	if (rc < 0) {
 		IPC_LOGE("reply error: %s.", strerror(errno));
 		return -1;
 	}
+	ipc_trace_stamp(IPC_TRACE_SEND);
+	return 0;
+}
+/**
+ * ipc_batch_handle - handle the requests carried by envelope @msg back to back, 
+ * and build the envelope core->batch with one reply per request, in the same order.
+ * A request without IPC_FLAG_REPLY gets an empty reply.
+ * A reply is marked with IPC_FLAG_FAILED if the handler failed, went asynchronous, 
+ * or the reply envelope is out of space, its payload is empty.
+ * Batched requests are handled with IPC_FLAG_REPLY cleared, so asynchronous work never replies.
+ * @core: ipc core of server
+ * @s: ipc handle the envelope is from
+ * @msg: envelope
+ */
+static int ipc_batch_handle(struct ipc_core *core, struct ipc_server *s, struct ipc_msg *msg)
+{
+	int rc, reply, msg_id;
+	uint64_t start;
+	unsigned int len, offset = 0;
+	struct ipc_msg *req, *rsp;
+	if (!core->batch)
+		core->batch = ipc_alloc_msg(IPC_BATCH_SIZE);
+	if (!core->bclone)
+		core->bclone = ipc_alloc_msg(core->buf->size);
+	if (!core->batch || !core->bclone) {
+		IPC_LOGE("batch none memory.");
+		return -1;
+	}
+	core->batch->msg_id   = IPC_SDK_MSG_BATCH;
+	core->batch->from	  = msg->from;
+	core->batch->flags	  = 0;
+	core->batch->data_len = 0;
+	ipc_trace_stamp(IPC_TRACE_ENTER);
+	while (offset + IPC_MSG_HDRLEN <= msg->data_len) {
+		req = (struct ipc_msg *)(msg->data + offset);
+		len = __data_len(req);
+		if (offset + len > msg->data_len) {
+			IPC_LOGE("batch corrupted, offset:%u, len:%u, total:%u.", offset, len, msg->data_len);
+			return -1;
+		}
+		offset += len;
+		/* Always in the clone, handler may write a reply of the buffer size */
+		memcpy(core->bclone, req, len);
+		req = core->bclone;
+		reply = req->flags & __bit(IPC_BIT_REPLY);
+		if (users_msg(req) && ipc_msg_classify(s, req) == 0) {
+			__clr_bit(IPC_BIT_REPLY, req->flags);
+			msg_id = req->msg_id;
+			start  = ipc_trace_now();
+			rc = core->handler(req, core->arg, s->cookie);
+			stat_handler(core, msg_id, ipc_trace_now() - start, rc < 0);
+			if (rc < 0 || (req->flags & __bit(IPC_BIT_ASYNC)))
+				req->flags |= IPC_FLAG_FAILED;
+		} else
+			req->flags |= IPC_FLAG_FAILED;
+		if (reply)
+			req->flags |= __bit(IPC_BIT_REPLY);
+		if (!reply || (req->flags & IPC_FLAG_FAILED))
+			req->data_len = 0;
+		if (core->batch->data_len + __data_len(req) > IPC_BATCH_SIZE) {
+			IPC_LOGW("batch reply out of space, msg:%04x, len:%u.", req->msg_id, req->data_len);
+			req->flags |= IPC_FLAG_FAILED;
+			req->data_len = 0;
+			if (core->batch->data_len + IPC_MSG_HDRLEN > IPC_BATCH_SIZE)
+				return -1;
+		}
+		rsp = (struct ipc_msg *)(core->batch->data + core->batch->data_len);
+		memcpy(rsp, req, __data_len(req));
+		core->batch->data_len += __data_len(req);
+	}
+	ipc_trace_stamp(IPC_TRACE_LEAVE);
+	return 0;
+}
+/**
+ * ipc_batch_invoke - handle the envelope @msg of a client, and send the envelope of replies back.
+ * @core: ipc core of server
+ * @s: ipc handle the envelope is from
+ * @msg: envelope
+ */
+static int ipc_batch_invoke(struct ipc_core *core, struct ipc_server *s, struct ipc_msg *msg)
+{
+	int rc;
+	if (s->clazz == IPC_CLASS_SUBSCRIBER) {
+		IPC_LOGE("batch not allowed for subscriber %d.", s->identity);
+		return 0;
+	}
+	if (ipc_batch_handle(core, s, msg) < 0)
+		return -1;
+	rc = send_msg(s->sock, core->batch);
+	stat_send(core, s, core->batch, rc);
+	if (rc < 0) {
+		IPC_LOGE("batch reply error: %s.", strerror(errno));
+		return -1;
+	}
+	ipc_trace_stamp(IPC_TRACE_SEND);
 	return 0;
 }
 #define msg_report(sevr, msg) 	\
 do {							\
-	if (send((sevr)->sock, (void *)(msg),  __data_len(msg), MSG_NOSIGNAL | MSG_DONTWAIT) < 0)	\
+	int __rc = send((sevr)->sock, (void *)(msg),  __data_len(msg), MSG_NOSIGNAL | MSG_DONTWAIT);	\
+	stat_send(current_core(), sevr, msg, __rc);						\
+	if (__rc < 0)														\
 		IPC_LOGE("send error:%s[%d],sk:%d,errno:%d.", peer_name(sevr), (sevr)->identity, (sevr)->sock, errno);	 \
-} while (0)
-#define msg_broadcast(head, msg)		\
- do {										\
- 	struct ipc_node *__node;\
-	(msg)->msg_id |= IPC_MSG_TOKEN;			\
-	list_for_each_entry(__node, head, list) {\
-		msg_report(__node->sevr, msg);		\
-	}										\
-} while (0)
-#define msg_unicast(head, msg, to)	\
-do {										\
-	struct ipc_node *__node;\
-	(msg)->msg_id |= IPC_MSG_TOKEN;			\
-	list_for_each_entry(__node, head, list) {\
-		if (__node->sevr->identity == (to)) {\
-			msg_report(__node->sevr, msg);	\
-			break;							\
-		}									\
-	}										\
+	else																\
+		ipc_trace_stamp(IPC_TRACE_SEND);								\
 } while (0)
 #define msg_notify(sevr, msg)		\
 do {								\
 	(msg)->msg_id |= IPC_MSG_TOKEN;	\
 	msg_report(sevr, msg);			\
 } while (0)
+/**
+ * ipc_filter_match - check if @notify matches all the filters of @peer applying to its topic.
+ */
+static int ipc_filter_match(const struct ipc_peer *peer, const struct ipc_notify *notify)
+{
+	int i, j;
+	const struct ipc_filter *f;
+	const unsigned char *p;
+	for (i = 0, f = peer->filters; i < peer->nfilters; i++, f++) {
+		if (f->topic && !(f->topic & notify->topic))
+			continue;
+		switch (f->type) {
+		case IPC_FILTER_MSGID:
+			for (j = 0; j < f->count; j++) {
+				if (f->msg_ids[j] == notify->msg_id)
+					break;
+			}
+			if (j == f->count)
+				return 0;
+			break;
+		case IPC_FILTER_EQUAL:
+		case IPC_FILTER_MASK:
+			if (notify->data_len < f->offset + f->length)
+				return 0;
+			p = (const unsigned char *)notify->data + f->offset;
+			for (j = 0; j < f->length; j++) {
+				if ((f->type == IPC_FILTER_MASK ? p[j] & f->bytes.mask[j] : p[j]) != f->bytes.value[j])
+					return 0;
+			}
+			break;
+		}
+	}
+	return 1;
+}
+/**
+ * ipc_topic_dispatch - deliver @msg once to every subscriber of any bit of @topic, in one pass over the buckets.
+ * A subscriber registered to several bits of @topic is stamped when it gets @msg, and skipped in the other buckets.
+ * Subscribers whose content filters do not match are skipped as well.
+ * Caller must hold IPC Lock.
+ * @core: ipc core of server
+ * @msg: notify message
+ * @topic: topic mask, may have several bits
+ * @to: IPC_TO_BROADCAST or identity of the only client the message is sent to
+ */
+static void ipc_topic_dispatch(struct ipc_core *core, struct ipc_msg *msg, unsigned long topic, int to)
+{
+	struct ipc_node *node;
+	struct ipc_peer *peer;
+	struct ipc_notify *notify = (struct ipc_notify *)msg->data;
+	unsigned long stamp = ++core->stamp;
+	msg->msg_id |= IPC_MSG_TOKEN;
+	for (; topic; topic &= topic - 1) {
+		list_for_each_entry(node, &core->node_hb[__builtin_ctzl(topic)], list) {
+			peer = container_of(node->sevr, struct ipc_peer, sevr);
+			if (peer->stamp == stamp)
+				continue;
+			peer->stamp = stamp;
+			if (peer->nfilters && !ipc_filter_match(peer, notify))
+				continue;
+			if (to == IPC_TO_BROADCAST) {
+				msg_report(node->sevr, msg);
+			} else if (node->sevr->identity == to) {
+				msg_report(node->sevr, msg);
+				return;
+			}
+		}
+	}
+}
+/**
+ * ipc_channel_dispatch - write a broadcast of @topic into the channels bound to it.
+ * Returns the bits of @topic left to be dispatched to subscribers through sockets,
+ * including the ones whose channel refused the message, e.g. too long for it.
+ */
+static unsigned long ipc_channel_dispatch(struct ipc_core *core, const struct ipc_notify *notify, unsigned long topic, int to)
+{
+	int i;
+	unsigned long failed = 0;
+	if (!(topic & core->channel_mask) || to != IPC_TO_BROADCAST)
+		return topic;
+	for (i = 0; i < core->nchannels; i++) {
+		if (!(topic & core->channel_topics[i]))
+			continue;
+		if (ipc_channel_publish(core->channels[i], notify->msg_id, notify->data, notify->data_len) < 0) {
+			IPC_LOGE("channel publish error, msg:%04x, len:%d, sent to sockets.", notify->msg_id, notify->data_len);
+			failed |= core->channel_topics[i];
+		}
+	}
+	ipc_trace_stamp(IPC_TRACE_SEND);
+	return topic & (~core->channel_mask | failed);
+}
+/**
+ * ipc_trace_publish - open a recorder entry for a message published by server itself.
+ * Inside a handler the sends are accounted to the message being handled instead.
+ * Returns 1 if an entry was opened, to be completed with ipc_trace_end().
+ */
+static inline int ipc_trace_publish(struct ipc_core *core, const struct ipc_msg *msg)
+{
+	if (!core->trace || __ipc_trace_current)
+		return 0;
+	ipc_trace_begin(core->trace, msg, -1);
+	return 1;
+}
 /**
  * ipc_release - release resources occupied by ipc handle
  * @core: ipc core
@@ -779,6 +1283,8 @@ static void ipc_release(struct ipc_core *core, struct ipc_server *sevr)
 		
 		if (peer->node)
 			free(peer->node);
+		if (peer->filters)
+			free(peer->filters);
 		
 		ipc_mutex_unlock(core->mutex);
 		p = peer;
@@ -828,6 +1334,119 @@ static struct ipc_server * ipc_server_create(struct ipc_core *core,
 	IPC_LOGI("Alloc ipc: %p.", sevr);
 	return sevr;
 }
+/* Log level of common libraries, available if liblog is linked */
+extern int generic_log_level __attribute__((weak));
+/**
+ * ipc_server_loglevel - handler for the log level message from client
+ * @core: ipc core of server.
+ * @sock: socket to reply.
+ * @msg: log level message, replied with the previous level on success, with no data on failure.
+ */
+static int ipc_server_loglevel(struct ipc_core *core, int sock, struct ipc_msg *msg)
+{
+	int *level = NULL;
+	struct ipc_loglevel *ll = (struct ipc_loglevel *)msg->data;
+	if (msg->data_len < sizeof(struct ipc_loglevel))
+		return -1;
+	switch (ll->module) {
+	case IPC_LOG_MODULE_IPC:
+		level = &ipc_log_level;
+		break;
+	case IPC_LOG_MODULE_GENERIC:
+		level = &generic_log_level;
+		break;
+	}
+	if (!level || ll->level > IPC_LOG_LEVEL_D) {
+		IPC_LOGW("log level unsupported, module:%d, level:%d.", ll->module, ll->level);
+		msg->data_len = 0;
+	} else {
+		int prev = *level;
+		if (ll->level >= 0) {
+			*level = ll->level;
+			IPC_LOGW("log level of module:%d changed by %d: %d -> %d.", ll->module, msg->from, prev, ll->level);
+		}
+		ll->level = prev;
+		msg->msg_id = IPC_SDK_MSG_SUCCESS;
+	}
+	if (msg->flags & __bit(IPC_BIT_REPLY))
+		return send_msg(sock, msg) < 0 ? -1 : 0;
+	return 0;
+}
+/**
+ * ipc_server_stats - handler for the statistics message from client
+ * @core: ipc core of server.
+ * @sock: socket to reply.
+ * @msg: statistics message, optional unsigned int flags in data, IPC_STATS_RESET.
+ * Replied with struct ipc_stats, clients and message IDs not fitting in IPC_STATS_SIZE are left out.
+ */
+static int ipc_server_stats(struct ipc_core *core, int sock, struct ipc_msg *msg)
+{
+	int rc = 0;
+	unsigned int i, flags = 0, used;
+	struct ipc_server *s;
+	struct ipc_stats *stats;
+	struct ipc_stat_client *c;
+	struct ipc_stat_msg *m;
+	struct ipc_msg *rsp = ipc_alloc_msg(IPC_STATS_SIZE);
+	if (!rsp)
+		return -1;
+	if (msg->data_len >= sizeof(flags))
+		memcpy(&flags, msg->data, sizeof(flags));
+	stats = (struct ipc_stats *)rsp->data;
+	memset(stats, 0, sizeof(*stats));
+	stats->uptime = (ipc_trace_now() - core->stat_start) / 1000000;
+	stats->total  = core->total;
+	stats->timing = core->lateness;
+	used = sizeof(*stats);
+	c = ipc_stats_clients(stats);
+	/* Dummy first, it carries the messages of connectionless clients */
+	c->identity = core->dummy->identity;
+	c->clazz	= core->dummy->clazz;
+	c->counter	= core->dummy->counter;
+	c++;
+	used += sizeof(*c);
+	stats->nclients = stats->nclients_total = 1;
+	list_for_each_entry(s, &core->head, list) {
+		if (s->clazz != IPC_CLASS_REQUESTER && 
+			s->clazz != IPC_CLASS_SUBSCRIBER)
+			continue;
+		stats->nclients_total++;
+		if (used + sizeof(*c) > IPC_STATS_SIZE) {
+			stats->flags |= IPC_STATS_TRUNCATED;
+			continue;
+		}
+		c->identity = s->identity;
+		c->clazz	= s->clazz;
+		c->counter	= s->counter;
+		c++;
+		used += sizeof(*c);
+		stats->nclients++;
+	}
+	m = (struct ipc_stat_msg *)c;
+	for (i = 0; i <= IPC_STATS_MSGS; i++) {
+		const struct ipc_stat_msg *src = i < IPC_STATS_MSGS ?
+			(core->stat_msgs ? &core->stat_msgs[i] : NULL) : &core->stat_other;
+		if (!src || !src->count)
+			continue;
+		if (used + sizeof(*m) > IPC_STATS_SIZE) {
+			stats->flags |= IPC_STATS_TRUNCATED;
+			break;
+		}
+		*m++ = *src;
+		used += sizeof(*m);
+		stats->nmsgs++;
+	}
+	rsp->from	  = msg->from;
+	rsp->msg_id   = IPC_SDK_MSG_SUCCESS;
+	rsp->flags	  = msg->flags;
+	rsp->data_len = used;
+	if (msg->flags & __bit(IPC_BIT_REPLY))
+		rc = send_msg(sock, rsp) < 0 ? -1 : 0;
+	if (flags & IPC_STATS_RESET)
+		stat_reset(core);
+	ipc_free_msg(rsp);
+	return rc;
+}
 /**
  * ipc_server_sync - handler for the syn message from client's callback
  * @core: ipc core of server.
@@ -886,28 +1505,30 @@ static int ipc_broker_publish(struct ipc_core *core, struct ipc_msg * msg)
 	 * We do not clone new one, as we may get @msg from @notify by offset when calling ipc_server_forward()
 	 */
 	struct ipc_notify *notify = (struct ipc_notify *)msg->data;
-	if (!topic_check(notify->topic))
+	if (!notify->topic)
 		return -1;
     /**
      * Every notify msg transferred by the server needs to be filtered by filter hook.
      * If filter hook returns a negative number, this notify will be ignored and not be dispatched.
      */
+    ipc_trace_stamp(IPC_TRACE_ENTER);
     if (core->filter &&
-        core->filter(notify, core->arg) < 0)
+        core->filter(notify, core->arg) < 0) {
+        ipc_trace_stamp(IPC_TRACE_LEAVE);
         return -1;
+    }
+    ipc_trace_stamp(IPC_TRACE_LEAVE);
 
+	unsigned long topic = ipc_channel_dispatch(core, notify, notify->topic, notify->to);
 	/**
 	 * Node hash bucket is null, this indicates that no clients register to the server
 	 */
-	if (!core->node_hb)
+	if (!core->node_hb || !topic)
 		return 0;
 
-
-	int i = bit_index(notify->topic);
-	if (notify->to == IPC_TO_BROADCAST)
-		msg_broadcast(&core->node_hb[i], msg);
-	else
-		msg_unicast(&core->node_hb[i], msg, notify->to);
+	ipc_mutex_lock(core->mutex);
+	ipc_topic_dispatch(core, msg, topic, notify->to);
+	ipc_mutex_unlock(core->mutex);
 	return 0;
 }
 static int ipc_proxy_socket_handler(struct ipc_core *core, struct ipc_server *ipc)
@@ -918,6 +1539,38 @@ static int ipc_proxy_socket_handler(struct ipc_core *core, struct ipc_server *ip
 	
 	return proxy->handler(ipc->sock, proxy->arg);
 }
+/**
+ * ipc_socket_dispatch - handle one message received from a connected client
+ * @core:ipc core of server
+ * @ipc: ipc handle the message came from
+ * @msg: message received
+ * Returns -1 if the connection should be released, 1 if it has been released already.
+ */
+static int ipc_socket_dispatch(struct ipc_core *core, struct ipc_server *ipc, struct ipc_msg *msg)
+{
+	switch (msg->msg_id) {
+	case IPC_SDK_MSG_CONNECT:
+		return -1;	/* This kind of msg is not allowed for this ipc handle */
+	case IPC_SDK_MSG_REGISTER:
+		return -1;	/* This kind of msg is not allowed for this ipc handle */
+	case IPC_SDK_MSG_SYNC:
+		return ipc_server_sync(core, ipc, msg) < 0 ? -1 : 0;
+	case IPC_SDK_MSG_UNREGISTER:
+		return ipc_server_unregister(core, ipc, msg) < 0 ? -1 : 1;
+	case IPC_SDK_MSG_NOTIFY:
+		if (ipc_broker_publish(core, msg) < 0)
+			IPC_LOGE("broker dispatch notify error.");
+		return 0;
+	case IPC_SDK_MSG_BATCH:
+		return ipc_batch_invoke(core, ipc, msg) < 0 ? -1 : 0;
+	case IPC_SDK_MSG_LOGLEVEL:
+		return ipc_server_loglevel(core, ipc->sock, msg) < 0 ? -1 : 0;
+	case IPC_SDK_MSG_STATS:
+		return ipc_server_stats(core, ipc->sock, msg) < 0 ? -1 : 0;
+	default:
+		return ipc_handler_invoke(core, ipc, msg) < 0 ? -1 : 0;
+	}
+}
 /**
  * ipc_common_socket_handler - handler for client handle that use continuous stream socket connection
  * @core:ipc core of server
@@ -925,7 +1578,7 @@ static int ipc_proxy_socket_handler(struct ipc_core *core, struct ipc_server *ip
  */
 static int ipc_common_socket_handler(struct ipc_core *core, struct ipc_server *ipc)
 {
-	int len;
+	int len, rc;
 	struct ipc_buf *buf = core->buf;
 	struct ipc_msg *msg = (struct ipc_msg *)buf->data;
 	struct timeval timeout = {.tv_sec  = 0, .tv_usec = 500 * 1000};
@@ -948,28 +1601,15 @@ static int ipc_common_socket_handler(struct ipc_core *core, struct ipc_server *i
 				}
 				goto __recv;
 			}
-			switch (msg->msg_id) {
-			case IPC_SDK_MSG_CONNECT:
-				goto __error;	/* This kind of msg is not allowed for this ipc handle */
-			case IPC_SDK_MSG_REGISTER:
-				goto __error;	/* This kind of msg is not allowed for this ipc handle */
-			case IPC_SDK_MSG_SYNC:
-				if (ipc_server_sync(core, ipc, msg) < 0)
-					goto __error;
-				break;
-			case IPC_SDK_MSG_UNREGISTER:
-				if (ipc_server_unregister(core, ipc, msg) < 0)
-					goto __error;
-				break;
-			case IPC_SDK_MSG_NOTIFY:
-				if (ipc_broker_publish(core, msg) < 0)
-					IPC_LOGE("broker dispatch notify error.");
-				break;
-			default:
-				if (ipc_handler_invoke(core, ipc, msg) < 0)
-					goto __error;
-				break;
-			}
+			stat_recv(core, ipc, msg);
+			if (core->trace)
+				ipc_trace_begin(core->trace, msg, ipc->identity);
+			rc = ipc_socket_dispatch(core, ipc, msg);
+			if (rc < 0)
+				goto __error;
+			ipc_trace_end(msg);
+			if (rc > 0)
+				return 0;
 		} while (ipc_buf_pending(buf));
 		return 0;
 	}
@@ -993,6 +1633,50 @@ static int ipc_common_socket_handler(struct ipc_core *core, struct ipc_server *i
 			ipc_server_manager(core, ipc, IPC_CLIENT_SHUTDOWN, NULL);
 	}
   __error:
+	ipc_trace_end(msg);
+	ipc_release(core, ipc);
+	return -1;
+}
+/**
+ * ipc_packet_socket_handler - handler for client handle that use SOCK_SEQPACKET connection
+ * Every receive returns exactly one message, no re-framing, no cloning.
+ * @core:ipc core of server
+ * @ipc: ipc handle
+ */
+static int ipc_packet_socket_handler(struct ipc_core *core, struct ipc_server *ipc)
+{
+	int len, n, rc;
+	struct ipc_msg *msg = (struct ipc_msg *)core->buf->data;
+	for (n = 0; n < IPC_PACKET_BURST; n++) {
+		len = recv_packet(ipc->sock, core->buf->data, core->buf->size, 0);
+		if (len == IPC_RECEIVE_TMO)
+			return 0;
+		if (len == IPC_RECEIVE_EMEM || len == IPC_RECEIVE_EMSG)
+			goto __error;	/* The same as the stream handler does for a full buffer */
+		if (len < 0)
+			break;
+		stat_recv(core, ipc, msg);
+		if (core->trace)
+			ipc_trace_begin(core->trace, msg, ipc->identity);
+		rc = ipc_socket_dispatch(core, ipc, msg);
+		if (rc < 0)
+			goto __error;
+		ipc_trace_end(msg);
+		if (rc > 0)
+			return 0;
+	}
+	if (n == IPC_PACKET_BURST)
+		return 0;	/* Level triggered, the rest is picked up next round */
+	if (len == IPC_RECEIVE_EOF)
+		IPC_LOGW("client %d:%d:%s shutdown sk:%d", ipc->clazz, ipc->identity, peer_name(ipc), ipc->sock);
+	else
+		IPC_LOGE("client %d:%d:%s recv error sk:%d", ipc->clazz, ipc->identity, peer_name(ipc), ipc->sock);
+	if (ipc->clazz == IPC_CLASS_SUBSCRIBER)
+		ipc_server_manager(core, ipc, IPC_CLIENT_SHUTDOWN, NULL);
+	ipc_release(core, ipc);
+	return -1;
+  __error:
+	ipc_trace_end(msg);
 	ipc_release(core, ipc);
 	return -1;
 }
@@ -1009,6 +1693,271 @@ static inline struct ipc_proxy * ipc_proxy_create(struct ipc_core *core, int fd,
 	IPC_LOGI("Alloc proxy: %p.", proxy);
 	return proxy;
 }
+static inline int lb_futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *ts)
+{
+	return syscall(SYS_futex, uaddr, op, val, ts, NULL, 0);
+}
+static inline void lb_put(struct ipc_loopback *lb)
+{
+	if (ATOMIC_FSUB(&lb->refs, 1) == 1)
+		free(lb);
+}
+#define lb_owned(lb)	((lb)->msg == (struct ipc_msg *)((lb) + 1))
+static inline void lb_done(struct ipc_loopback *lb, int rc)
+{
+	lb->rc = rc;
+	ATOMIC_SET(&lb->state, IPC_LB_DONE);
+	lb_futex(&lb->state, FUTEX_WAKE_PRIVATE, 1, NULL);
+}
+/**
+ * ipc_loopback_invoke - handle a loopback request, always in the core context.
+ * @msg: request, the caller's message or a copy of it, holds the response on success.
+ * @size: size of the caller's buffer.
+ * Returns IPC_REQUEST_XXX values, a failed handler is reported as a timeout at once,
+ * where a socket client would wait it out.
+ */
+static int ipc_loopback_invoke(struct ipc_core *core, struct ipc_msg *msg, unsigned int size)
+{
+	int rc, msg_id, reply;
+	uint64_t start;
+	struct ipc_server *s = &__ipc_loopback;
+	reply = msg->flags & __bit(IPC_BIT_REPLY);
+	ipc_msg_classify(s, msg);
+	stat_recv(core, s, msg);
+	/* Nested in a handler of the core, the entry of the outer message stays current */
+	int traced = core->trace && !__ipc_trace_current;
+	if (traced)
+		ipc_trace_begin(core->trace, msg, s->identity);
+	msg_id = msg->msg_id;
+	if (msg_id == IPC_SDK_MSG_BATCH) {
+		/* Envelope of ipc_client_batch(), the envelope of replies is left in core->batch */
+		rc = ipc_batch_handle(core, s, msg);
+		if (rc == 0 && reply && __data_len(core->batch) > size)
+			rc = -1;
+	} else {
+		ipc_trace_stamp(IPC_TRACE_ENTER);
+		start = ipc_trace_now();
+		rc = core->handler(msg, core->arg, s->cookie);
+		stat_handler(core, msg_id, ipc_trace_now() - start, rc < 0);
+		ipc_trace_stamp(IPC_TRACE_LEAVE);
+	}
+	if (rc < 0 || (msg->flags & __bit(IPC_BIT_ASYNC))) {
+		rc = -IPC_ETIMEOUT;
+	} else if (!reply) {
+		rc = IPC_SUCCESS;
+	} else if (__data_len(msg) > size) {
+		IPC_LOGE("loopback reply out of space, msg:%04x, len:%u, size:%u.", msg->msg_id, msg->data_len, size);
+		rc = -IPC_EMEM;
+	} else {
+		stat_send(core, s, msg, __data_len(msg));
+		ipc_trace_stamp(IPC_TRACE_SEND);
+		rc = IPC_SUCCESS;
+	}
+	if (traced)
+		ipc_trace_end(msg);
+	return rc;
+}
+/**
+ * ipc_loopback_proxy - take all the queued loopback requests, and handle them in the order of arrival.
+ * Requests expecting a response are handled in the clone, so that a caller timing out may leave
+ * at any time but while its request or response is being copied.
+ */
+static int ipc_loopback_proxy(int fd, void *arg)
+{
+	int rc;
+	uint64_t n;
+	struct ipc_core *core = arg;
+	struct ipc_msg *clone = core->lb_clone, *rsp;
+	struct ipc_loopback *lb, *next, *list = NULL;
+	if (read(fd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+		IPC_LOGE("loopback read errno:%d.", errno);
+	do {
+		lb = ATOMIC_GET(&core->lb_head);
+	} while (!ATOMIC_BCS(&core->lb_head, lb, NULL));
+	/* Stack to FIFO */
+	for (; lb; lb = next) {
+		next = lb->next;
+		lb->next = list;
+		list = lb;
+	}
+	for (lb = list; lb; lb = next) {
+		next = lb->next;
+		if (lb_owned(lb)) {
+			/* No response expected, the message is owned by the node */
+			ipc_loopback_invoke(core, lb->msg, lb->size);
+		} else if (ATOMIC_BCS(&lb->state, IPC_LB_PENDING, IPC_LB_COPYIN)) {
+			memcpy(clone, lb->msg, __data_len(lb->msg));
+			ATOMIC_SET(&lb->state, IPC_LB_HANDLING);
+			rc = ipc_loopback_invoke(core, clone, lb->size);
+			if (ATOMIC_BCS(&lb->state, IPC_LB_HANDLING, IPC_LB_COPYING)) {
+				/* Replies of a batch are in core->batch, the caller's envelope is untouched till now */
+				rsp = lb->msg->msg_id == IPC_SDK_MSG_BATCH ? core->batch : clone;
+				if (rc == IPC_SUCCESS && (clone->flags & __bit(IPC_BIT_REPLY)))
+					memcpy(lb->msg, rsp, __data_len(rsp));
+				lb_done(lb, rc);
+			}
+		}
+		lb_put(lb);
+	}
+	return 0;
+}
+/**
+ * ipc_loopback_init - set up the queue of loopback requests
+ */
+static int ipc_loopback_init(struct ipc_core *core)
+{
+	core->lb_head = NULL;
+	core->lb_off  = 0;
+	core->lb_efd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (core->lb_efd < 0)
+		return -1;
+	if (!ipc_proxy_create(core, core->lb_efd, ipc_loopback_proxy, core)) {
+		close(core->lb_efd);
+		core->lb_efd = -1;
+		return -1;
+	}
+	return 0;
+}
+/**
+ * ipc_loopback_exit - fail the requests still queued, the core is leaving.
+ */
+static void ipc_loopback_exit(struct ipc_core *core)
+{
+	struct ipc_loopback *lb, *next;
+	core->lb_efd = -1;	/* Closed with its proxy */
+	do {
+		lb = ATOMIC_GET(&core->lb_head);
+	} while (!ATOMIC_BCS(&core->lb_head, lb, NULL));
+	for (; lb; lb = next) {
+		next = lb->next;
+		if (!lb_owned(lb) && ATOMIC_BCS(&lb->state, IPC_LB_PENDING, IPC_LB_COPYING))
+			lb_done(lb, -IPC_EOF);
+		lb_put(lb);
+	}
+	if (core->lb_clone) {
+		ipc_free_msg(core->lb_clone);
+		core->lb_clone = NULL;
+	}
+}
+static inline int ipc_loopback_serves(struct ipc_core *core, const char *path)
+{
+	return ipc_core_running(core) && !core->lb_off && core->lb_efd >= 0 && !core->manager &&
+		core->path && !strcmp(core->path, path);
+}
+/**
+ * ipc_loopback_size - buffer size of the core serving @path in this process, 0 if it is not served here.
+ * Lets a caller holding its request in pieces build one message only when the loopback applies.
+ */
+unsigned int ipc_loopback_size(const char *path)
+{
+	struct ipc_core *core = current_core();
+	return ipc_loopback_serves(core, path) ? core->buf->size : 0;
+}
+/**
+ * ipc_loopback_request - deliver a request of a client in this process straight to the core.
+ * Called by ipc_client_request(), in any thread.
+ * Requests from the core context, i.e. a handler calling its own server, are handled in place, 
+ * other threads queue them and wait, so the handler always runs in the core context.
+ * Only used if the server has no manager hook, requests are handled as the ones of temporary clients.
+ * @path: path of the server the client connected
+ * @from: identity of the client
+ * @msg: request message, holds the response on success
+ * @size: size of @msg buffer
+ * @tmo: seconds to wait for the response, negative for ever
+ * Returns IPC_LOOPBACK_NONE if @path is not served by this process, IPC_REQUEST_XXX values otherwise.
+ */
+int ipc_loopback_request(const char *path, int from, struct ipc_msg *msg, unsigned int size, int tmo)
+{
+	int rc, reply;
+	uint32_t state;
+	struct timespec ts, now, end;
+	struct ipc_loopback *lb;
+	struct ipc_core *core = current_core();
+	if (!ipc_loopback_serves(core, path))
+		return IPC_LOOPBACK_NONE;
+	msg->from	= from;
+	msg->flags &= IPC_FLAG_CLIENT_MASK;
+	if (__data_len(msg) > core->buf->size) {
+		IPC_LOGE("loopback request too long, msg:%04x, len:%u.", msg->msg_id, msg->data_len);
+		return -IPC_EMEM;
+	}
+	reply = msg->flags & __bit(IPC_BIT_REPLY);
+	if (ipc_core_context(core)) {
+		if (msg->msg_id == IPC_SDK_MSG_BATCH) {
+			/* core->batch may be in use by the envelope being handled */
+			IPC_LOGE("loopback batch not allowed in handler.");
+			return -IPC_EVAL;
+		}
+		/* Handler may write a reply of the buffer size */
+		if (!reply || size >= core->buf->size)
+			return ipc_loopback_invoke(core, msg, size);
+		struct ipc_msg *clone = ipc_alloc_msg(core->buf->size);
+		if (!clone)
+			return -IPC_EMEM;
+		memcpy(clone, msg, __data_len(msg));
+		rc = ipc_loopback_invoke(core, clone, size);
+		if (rc == IPC_SUCCESS)
+			memcpy(msg, clone, __data_len(clone));
+		ipc_free_msg(clone);
+		return rc;
+	}
+	lb = (struct ipc_loopback *)malloc(sizeof(struct ipc_loopback) + (reply ? 0 : __data_len(msg)));
+	if (!lb)
+		return -IPC_EMEM;
+	if (reply) {
+		lb->msg  = msg;
+		lb->size = size;
+		lb->refs = 2;
+	} else {
+		/* Nothing to wait for, the core owns a copy */
+		lb->msg  = (struct ipc_msg *)(lb + 1);
+		lb->size = __data_len(msg);
+		lb->refs = 1;
+		memcpy(lb->msg, msg, __data_len(msg));
+	}
+	lb->rc	  = -IPC_ETIMEOUT;
+	lb->state = IPC_LB_PENDING;
+	do {
+		lb->next = ATOMIC_GET(&core->lb_head);
+	} while (!ATOMIC_BCS(&core->lb_head, lb->next, lb));
+	if (!lb->next) {
+		uint64_t one = 1;
+		if (write(core->lb_efd, &one, sizeof(one)) < 0)
+			IPC_LOGE("loopback write errno:%d.", errno);
+	}
+	if (!reply)
+		return IPC_SUCCESS;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += tmo;
+	while ((state = ATOMIC_GET(&lb->state)) != IPC_LB_DONE) {
+		struct timespec *tp = NULL;
+		if (state == IPC_LB_COPYIN) {
+			/* A memcpy() of the core, nobody wakes us up when it is over */
+			sched_yield();
+			continue;
+		}
+		if (tmo >= 0 && state != IPC_LB_COPYING) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			ts.tv_sec  = end.tv_sec - now.tv_sec;
+			ts.tv_nsec = end.tv_nsec - now.tv_nsec;
+			if (ts.tv_nsec < 0) {
+				ts.tv_sec--;
+				ts.tv_nsec += 1000000000L;
+			}
+			if (ts.tv_sec < 0) {
+				/* Leave unless the request or response is being copied */
+				if (ATOMIC_BCS(&lb->state, state, IPC_LB_CANCELED))
+					break;
+				continue;
+			}
+			tp = &ts;
+		}
+		lb_futex(&lb->state, FUTEX_WAIT_PRIVATE, state, tp);
+	}
+	rc = lb->rc;
+	lb_put(lb);
+	return rc;
+}
 /**
  * ipc_peer_create - to initialize a peer which is used to support asynchronous message to clients
  * @core: ipc core of server
@@ -1016,11 +1965,13 @@ static inline struct ipc_proxy * ipc_proxy_create(struct ipc_core *core, int fd,
  * @clazz: ipc handle type, defined in enum IPC_CLASS.
  * @identity: client identity, it is client's pid.
  * @sock: socket fd
+ * @handler: socket handler, depends on the socket type of the connection
  */
 static struct ipc_peer * ipc_peer_create(struct ipc_core *core, unsigned long mask,
 							int clazz,
 							int identity,
-							int sock)
+							int sock,
+							int (*handler)(struct ipc_core *, struct ipc_server *))
 {
 	assert(mask);
 	
@@ -1029,6 +1980,9 @@ static struct ipc_peer * ipc_peer_create(struct ipc_core *core, unsigned long ma
 	if (!peer)
 		return NULL;
 	peer->mask = mask;
+	peer->stamp = 0ul;
+	peer->nfilters = 0;
+	peer->filters = NULL;
 	peer->node = NULL;
 
 	/*
@@ -1051,7 +2005,7 @@ static struct ipc_peer * ipc_peer_create(struct ipc_core *core, unsigned long ma
 		}
 	}
 	ipc_mutex_unlock(core->mutex);
-	sevr_init(core, &peer->sevr, clazz, identity, sock, ipc_common_socket_handler);
+	sevr_init(core, &peer->sevr, clazz, identity, sock, handler);
 	IPC_LOGI("Alloc peer: %p.", peer);
 	return peer;
 err:
@@ -1067,19 +2021,55 @@ err:
  * @core: ipc core of server
  * @sock: socket fd
  * @msg: callback register message
+ * @handler: socket handler of the connection
  */
-static int ipc_server_register(struct ipc_core *core, int sock, struct ipc_msg * msg)
+static int ipc_server_register(struct ipc_core *core, int sock, struct ipc_msg * msg,
+							int (*handler)(struct ipc_core *, struct ipc_server *))
 {
+	int i, nfilters = 0;
 	struct ipc_peer *peer;
+	struct ipc_filter *filters = NULL;
 	struct ipc_reg *reg = (struct ipc_reg *)msg->data;
-	if (!reg->mask) {
+	if (msg->data_len < sizeof(struct ipc_reg) || 
+		msg->data_len < sizeof(struct ipc_reg) + reg->data_len || !reg->mask) {
 		IPC_LOGE("Incorrect mask.");
 		goto __fatal;
 	}
+	/*
+	 * Content filters follow the register data, none from older clients.
+	 */
+	unsigned int flen = msg->data_len - sizeof(struct ipc_reg) - reg->data_len;
+	if (flen) {
+		nfilters = flen / sizeof(struct ipc_filter);
+		if (flen % sizeof(struct ipc_filter) || nfilters > IPC_FILTER_MAX) {
+			IPC_LOGE("Incorrect filters length:%u.", flen);
+			goto __fatal;
+		}
+		filters = (struct ipc_filter *)malloc(flen);
+		if (!filters)
+			goto __fatal;
+		memcpy(filters, reg->data + reg->data_len, flen);
+		for (i = 0; i < nfilters; i++) {
+			if (!filter_check(&filters[i])) {
+				IPC_LOGE("Incorrect filter type:%u.", filters[i].type);
+				free(filters);
+				goto __fatal;
+			}
+		}
+	}
+	/* Still served for notifications sent to it only */
+	if (reg->mask & core->channel_mask)
+		IPC_LOGW("Subscriber %d mask:%04lx, broadcasts of %04lx are in channels, see ipc_channel_open().",
+					msg->from, reg->mask, reg->mask & core->channel_mask);
 	/* Identity always be client's pid */
-	peer = ipc_peer_create(core, reg->mask, IPC_CLASS_SUBSCRIBER, msg->from, sock);
-	if (!peer)
+	peer = ipc_peer_create(core, reg->mask, IPC_CLASS_SUBSCRIBER, msg->from, sock, handler);
+	if (!peer) {
+		if (filters)
+			free(filters);
 		goto __fatal;
+	}
+	peer->nfilters = nfilters;
+	peer->filters  = filters;
 	/*
 	 * Manager hook provide a possibility to manage the clients registered to the server.
 	 * This is the only hook which expose the IPC handle, user can set client cookies through this.
@@ -1090,8 +2080,8 @@ static int ipc_server_register(struct ipc_core *core, int sock, struct ipc_msg *
 		IPC_LOGW("Manager refused.");
 		goto __error;
 	}
-	IPC_LOGI("%d register, client %d:%s, sk: %d, mask: %04lx",
-					msg->from, peer->sevr.identity, peer_name(&peer->sevr), peer->sevr.sock, peer->mask);
+	IPC_LOGI("%d register, client %d:%s, sk: %d, mask: %04lx, filters: %d",
+					msg->from, peer->sevr.identity, peer_name(&peer->sevr), peer->sevr.sock, peer->mask, peer->nfilters);
 	/*
 	 * In this period, do some negotiation.
 	 * max IPC buffer size is always required
@@ -1122,12 +2112,14 @@ __fatal:
  * @core: ipc core of server
  * @sock: socket fd
  * @msg: channel register message
+ * @handler: socket handler of the connection
  */
-static int ipc_server_connect(struct ipc_core *core, int sock, struct ipc_msg * msg)
+static int ipc_server_connect(struct ipc_core *core, int sock, struct ipc_msg * msg,
+							int (*handler)(struct ipc_core *, struct ipc_server *))
 {
 	struct ipc_server *sevr;
 	struct ipc_identity *cid = (struct ipc_identity *)msg->data;
-	sevr = ipc_server_create(core, IPC_CLASS_REQUESTER, cid->identity, sock, ipc_common_socket_handler);
+	sevr = ipc_server_create(core, IPC_CLASS_REQUESTER, cid->identity, sock, handler);
 	if (!sevr) {
 		send_msg(sock, msg);
 		close(sock);
@@ -1152,14 +2144,17 @@ err:
 	return -1;
 }
 /**
- * ipc_master_socket_handler - handler for client handle that use temporary stream socket connection
+ * ipc_master_accept - accept a connection on a listening socket, and handle its first message
  * @core:ipc core of server
  * @ipc: master ipc handle
+ * @packet: 1 if @ipc is the SOCK_SEQPACKET listener
  */
-static int ipc_master_socket_handler(struct ipc_core *core, struct ipc_server *ipc)
+static int ipc_master_accept(struct ipc_core *core, struct ipc_server *ipc, int packet)
 {
-	int sock;
+	int sock, rc;
 	char *buffer = core->buf->data;
+	int (*handler)(struct ipc_core *, struct ipc_server *) = 
+		packet ? ipc_packet_socket_handler : ipc_common_socket_handler;
 
 	struct sockaddr_un client_addr = {0};
 	socklen_t addrlen = (socklen_t)sizeof(struct sockaddr_un);
@@ -1168,14 +2163,18 @@ static int ipc_master_socket_handler(struct ipc_core *core, struct ipc_server *i
 	if (sock > 0) {
 		if (sock_opts(sock, 0) < 0)
 			goto __error;
-		if (recv_msg(sock, buffer, core->buf->size, 1) < 0)
+		rc = packet ? recv_packet(sock, buffer, core->buf->size, 1) :
+					  recv_msg(sock, buffer, core->buf->size, 1);
+		if (rc < 0)
 			goto __error;
 		struct ipc_msg *msg = (struct ipc_msg *)buffer;
+		core->dummy->sock = sock;
+		stat_recv(core, core->dummy, msg);
 		switch (msg->msg_id){
 		case IPC_SDK_MSG_CONNECT:
-			return ipc_server_connect(core, sock, msg);
+			return ipc_server_connect(core, sock, msg, handler);
 		case IPC_SDK_MSG_REGISTER:
-			return ipc_server_register(core, sock, msg);
+			return ipc_server_register(core, sock, msg, handler);
 		case IPC_SDK_MSG_SYNC:
 			goto __error;	/* This kind of msg is not allowed for this ipc handle */
 		case IPC_SDK_MSG_UNREGISTER:
@@ -1184,8 +2183,19 @@ static int ipc_master_socket_handler(struct ipc_core *core, struct ipc_server *i
 			if (ipc_broker_publish(core, msg) < 0)
 				IPC_LOGE("broker dispatch notify error.");
 			break;
+		case IPC_SDK_MSG_BATCH:
+			if (ipc_batch_invoke(core, core->dummy, msg) < 0)
+				goto __error;
+			break;
+		case IPC_SDK_MSG_LOGLEVEL:
+			if (ipc_server_loglevel(core, sock, msg) < 0)
+				goto __error;
+			break;
+		case IPC_SDK_MSG_STATS:
+			if (ipc_server_stats(core, sock, msg) < 0)
+				goto __error;
+			break;
 		default:
-			core->dummy->sock = sock;
 			if (ipc_handler_invoke(core, core->dummy, msg) < 0)
 				goto __error;
 			break;
@@ -1204,16 +2214,35 @@ static int ipc_master_socket_handler(struct ipc_core *core, struct ipc_server *i
 		return -1;
 	}
 }
+/**
+ * ipc_master_socket_handler - handler for client handle that use temporary stream socket connection
+ * @core:ipc core of server
+ * @ipc: master ipc handle
+ */
+static int ipc_master_socket_handler(struct ipc_core *core, struct ipc_server *ipc)
+{
+	return ipc_master_accept(core, ipc, 0);
+}
+/**
+ * ipc_master_packet_handler - handler of the SOCK_SEQPACKET listener, see IPC_SEROPT_ENABLE_SEQPACKET
+ * @core:ipc core of server
+ * @ipc: master ipc handle
+ */
+static int ipc_master_packet_handler(struct ipc_core *core, struct ipc_server *ipc)
+{
+	return ipc_master_accept(core, ipc, 1);
+}
 
 /**
- * ipc_socket_create - create a unix-domain stream socket
+ * ipc_socket_create - create a unix-domain listening socket
  * @path: the path of unix-domain socket
+ * @type: SOCK_STREAM or SOCK_SEQPACKET
  */
-static int ipc_socket_create(const char *path)
+static int ipc_socket_create(const char *path, int type)
 {
 	int sock;
     struct sockaddr_un serv_adr;
-    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    if ((sock = socket(AF_UNIX, type, 0)) < 0)
 	{
         IPC_LOGE("Unable to create socket: %s", strerror(errno));
         return -1;
@@ -1240,12 +2269,14 @@ static int ipc_socket_create(const char *path)
 /**
  * ipc_master_init - init master socket for the ipc core
  * @core: ipc core to be initialized
+ * @path: the path of unix-domain socket
+ * @type: SOCK_STREAM or SOCK_SEQPACKET
  */
-static int ipc_master_init(struct ipc_core *core)
+static int ipc_master_init(struct ipc_core *core, const char *path, int type)
 {
 	int sock;
 	struct ipc_server *master;
-	sock = ipc_socket_create(core->path);
+	sock = ipc_socket_create(path, type);
 	if (sock < 0)
 		return -1;
 
@@ -1253,8 +2284,8 @@ static int ipc_master_init(struct ipc_core *core)
 		close(sock);
 		return -1;
 	}
-	master = ipc_server_create(core, IPC_CLASS_MASTER, 0, sock,
-		ipc_master_socket_handler);
+	master = ipc_server_create(core, IPC_CLASS_MASTER, 0, sock, 
+		type == SOCK_SEQPACKET ? ipc_master_packet_handler : ipc_master_socket_handler);
 	if (master == NULL) {
 		close(sock);
 		return -1;
@@ -1366,6 +2397,7 @@ static int ipc_loop(struct ipc_core *core)
 			
 				IPC_LOGD("{%ld %ld} {%ld %ld} expired!", timing->expire.tv_sec, timing->expire.tv_usec, now.tv_sec, now.tv_usec);
 				list_del_init(&timing->list);
+				stat_timing(core, timing, &now);
 				if (timing->cycle) {
 					timing_refresh(timing, &now);
 					timing_insert(core, timing);
@@ -1423,6 +2455,7 @@ static int ipc_loop(struct ipc_core *core)
 			list_for_each_entry_safe(timing, tt, &core->timing, list) {
 				if (!timercmp(&now, &timing->expire, <)) {
 					list_del_init(&timing->list);
+					stat_timing(core, timing, &now);
 					if (timing->cycle) {
 						timing_refresh(timing, &now);
 						timing_insert(core, timing);
@@ -1477,9 +2510,13 @@ int ipc_server_init(const char *server, int (*handler)(struct ipc_msg *, void *,
 	core->manager = NULL;
 	core->mutex   = NULL;
 	core->node_hb = NULL;
+	core->stamp   = 0ul;
 	core->buf 	  = NULL;
+	core->batch   = NULL;
+	core->bclone  = NULL;
 	core->arg	  = NULL;
 	core->pool	  = NULL;
+	core->stat_msgs = NULL;
 	core->path 	  = (const char *)path;
 	core->server  = self_name();
 #if IPC_EPOLL
@@ -1495,14 +2532,17 @@ int ipc_server_init(const char *server, int (*handler)(struct ipc_msg *, void *,
 	core->nfds	  = 0;
 	FD_ZERO(&core->rfds);
 #endif
-	if (ipc_master_init(core) < 0) {
+	if (ipc_master_init(core, core->path, SOCK_STREAM) < 0) {
 #if IPC_EPOLL
 		close(core->epfd);
 #endif
 		goto err;
 	}
+	if (ipc_loopback_init(core) < 0)
+		IPC_LOGW("loopback init failure.");
 	core->dummy	 = &__ipc_dummy;
 	core->tid 	 = gettid();
+	stat_reset(core);
 	core->flags |= IPC_CORE_F_INITED;
 	IPC_LOGI("%s init done.", server);
 	return 0;
@@ -1531,6 +2571,9 @@ int ipc_server_run()
 	core->clone = ipc_alloc_msg(core->buf->size);
 	if (!core->clone)
 		return -1;
+	core->lb_clone = ipc_alloc_msg(core->buf->size);
+	if (!core->lb_clone)
+		return -1;
 	core->tid = gettid();
 	IPC_LOGI("mutex:%p,filter:%p,manager:%p, buf size:%u, context@%d", core->mutex,
 			core->filter,
@@ -1551,6 +2594,7 @@ int ipc_server_exit()
 	if (!ipc_core_inited(core))
 		return -1;
 	core->flags &= ~IPC_CORE_F_RUN;
+	ipc_loopback_exit(core);
 	list_for_each_entry_safe(pos, tmp, &core->head, list) {
 		ipc_release(core, pos);
 	}
@@ -1580,6 +2624,42 @@ int ipc_server_exit()
 		ipc_free_msg(core->clone);
 		core->clone = NULL;
 	}
+	if (core->batch) {
+		ipc_free_msg(core->batch);
+		core->batch = NULL;
+	}
+	if (core->bclone) {
+		ipc_free_msg(core->bclone);
+		core->bclone = NULL;
+	}
+	if (core->trace_signo > 0) {
+		signal(core->trace_signo, SIG_DFL);
+		close(__ipc_trace_wfd);
+		__ipc_trace_wfd = -1;
+		core->trace_signo = 0;
+	}
+	if (core->trace_path) {
+		free((void *)core->trace_path);
+		core->trace_path = NULL;
+	}
+	if (core->trace) {
+		ipc_trace_destroy(core->trace);
+		core->trace = NULL;
+	}
+	if (core->stat_msgs) {
+		free(core->stat_msgs);
+		core->stat_msgs = NULL;
+	}
+	if (core->capture) {
+		ipc_capture_close(core->capture);
+		core->capture = NULL;
+	}
+	core->channel_mask = 0;
+	while (core->nchannels > 0) {
+		core->nchannels--;
+		ipc_channel_destroy(core->channels[core->nchannels]);
+		core->channels[core->nchannels] = NULL;
+	}
 	core->flags &= ~IPC_CORE_F_INITED;
 	ipc_mutex_unlock(core->mutex);
 #if IPC_EPOLL
@@ -1596,7 +2676,7 @@ int ipc_server_exit()
  * This function is non-thread-safe can be called only in your %handler callback passed by ipc_server_init(),
  * if calling in mult-thread-environment, please set IPC_SEROPT_SET_BROKER_MUTEX option.
  * @to: indicate who the notify message is sent to.
- * @topic: message type
+ * @topic: message type, several bits may be set, subscribers matching any of them get the message once.
  * @msg_id: message id
  * @data: message data, if no data carried, set NULL
  * @size: the length of message data
@@ -1610,7 +2690,7 @@ int ipc_server_publish(int to, unsigned long topic, int msg_id, const void *data
 	struct ipc_core *core = current_core();
 	if (!ipc_core_running(core))
 		return -1;
-	if (!topic_check(topic))
+	if (!topic)
 		return -1;
 	if (!ipc_notify_space_check(sizeof(buffer), size)) {
 		ipc_msg = ipc_alloc_msg(sizeof(struct ipc_notify) + size);
@@ -1620,19 +2700,18 @@ int ipc_server_publish(int to, unsigned long topic, int msg_id, const void *data
 		} else dynamic = 1;
 	}
 	ipc_notify_pack(ipc_msg, to, topic, msg_id, data, size);
-	int i = bit_index(topic);
+	int traced = ipc_trace_publish(core, ipc_msg);
+	topic = ipc_channel_dispatch(core, (struct ipc_notify *)ipc_msg->data, topic, to);
 	ipc_mutex_lock(core->mutex);
 	/*
 	 * Node hash bucket has not been initialized.
 	 * This indicates that no clients register to server.
 	 */
-	if (core->node_hb) {
-		if (to == IPC_TO_BROADCAST)
-			msg_broadcast(&core->node_hb[i], ipc_msg);
-		else
-			msg_unicast(&core->node_hb[i], ipc_msg, to);
-	}
+	if (core->node_hb && topic)
+		ipc_topic_dispatch(core, ipc_msg, topic, to);
 	ipc_mutex_unlock(core->mutex);
+	if (traced)
+		ipc_trace_end(ipc_msg);
 	if (dynamic)
 		ipc_free_msg(ipc_msg);
 	return 0;
@@ -1651,22 +2730,21 @@ int ipc_server_publishx(struct ipc_msg *msg,
 	struct ipc_core *core = current_core();
 	if (!ipc_core_running(core))
 		return -1;
-	if (!topic_check(mask))
+	if (!mask)
 		return -1;
 	ipc_notify_fill(msg, to, mask, msg_id, data_len);
-	int i = bit_index(mask);
+	int traced = ipc_trace_publish(core, msg);
+	mask = ipc_channel_dispatch(core, (struct ipc_notify *)msg->data, mask, to);
 	ipc_mutex_lock(core->mutex);
 	/*
 	 * Node hash bucket has not been initialized.
 	 * This indicates that no clients register to server.
 	 */
-	if (core->node_hb) {
-		if (to == IPC_TO_BROADCAST)
-			msg_broadcast(&core->node_hb[i], msg);
-		else
-			msg_unicast(&core->node_hb[i], msg, to);
-	}
+	if (core->node_hb && mask)
+		ipc_topic_dispatch(core, msg, mask, to);
 	ipc_mutex_unlock(core->mutex);
+	if (traced)
+		ipc_trace_end(msg);
 	return 0;
 }
 
@@ -1748,7 +2826,9 @@ int ipc_server_notifyx(const struct ipc_server *sevr,
 int ipc_server_forward(const struct ipc_server *sevr, struct ipc_notify *notify)
 {
 	struct ipc_msg *msg = (struct ipc_msg *)( (char *)notify - offsetof(struct ipc_msg, data) );
-	return send_msg(sevr->sock, msg) > 0 ? 0: -1;
+	int rc = send_msg(sevr->sock, msg);
+	stat_send(current_core(), sevr, msg, rc);
+	return rc > 0 ? 0: -1;
 }
 static inline int set_opt_flt(struct ipc_core *core, void *arg)
 {
@@ -1790,26 +2870,186 @@ static inline int set_opt_arg(struct ipc_core *core, void *arg)
 }
 static inline int set_opt_async(struct ipc_core *core, void *arg)
 {
-	core->pool = &__ipc_async_pool;
-	if (arg) {
-		struct ipc_aopts *opts = arg;
+	struct ipc_aopts *opts = arg;
+	struct ipc_pool *pool = &__ipc_async_pool;
+	/* Nothing of the pool is changed unless all the options are valid */
+	if (opts) {
 		if (opts->mintasks < 0 || 
 			opts->mintasks > opts->maxtasks) {
 			IPC_LOGE("Async option invalid arg, min tasks:%d, max tasks:%d.", opts->mintasks, opts->maxtasks);
-			core->pool = NULL;
 			return -1;
 		}
-		
+		if (opts->executor && !opts->executor->execute) {
+			IPC_LOGE("Async option invalid executor.");
+			return -1;
+		}
+		if (opts->executor && opts->cpuset) {
+			IPC_LOGE("Async option cpuset not applicable to an external executor.");
+			return -1;
+		}
+	}
+	ipc_async_setup(pool);
+	if (opts && opts->cpuset &&
+		pthread_attr_setaffinity_np(&pool->attr, sizeof(cpu_set_t), opts->cpuset)) {
+		IPC_LOGE("Async option invalid cpuset.");
+		ipc_async_exit(pool);
+		return -1;
+	}
+	if (opts) {
 		if (opts->mintasks > 0)
-			core->pool->mintasks = opts->mintasks;
+			pool->mintasks = opts->mintasks;
 		if (opts->maxtasks > 0)
-			core->pool->maxtasks = opts->maxtasks;
+			pool->maxtasks = opts->maxtasks;
 		if (opts->linger > 0)
-			core->pool->linger = opts->linger;
+			pool->linger = opts->linger;
+		if (opts->executor)
+			pool->executor = *opts->executor;
 	}
-	ipc_async_setup(core->pool);
+	if (pool->executor.execute)
+		IPC_LOGI("Task pool on external executor:%p.", pool->executor.ctx);
+	else
+		IPC_LOGI("Task pool create done<%d-%d>.", pool->mintasks, pool->maxtasks);
+	core->pool = pool;
+	return 0;
+}
+static void ipc_trace_signal(int signo)
+{
+	int err = errno;
+	char c = 0;
+	if (write(__ipc_trace_wfd, &c, 1) < 0) {
+		/* A dump is pending already */
+	}
+	errno = err;
+}
+static int ipc_trace_proxy(int fd, void *arg)
+{
+	char c[16];
+	struct ipc_core *core = arg;
+	while (read(fd, c, sizeof(c)) > 0);
+	int out = open(core->trace_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out < 0) {
+		IPC_LOGE("trace dump %s error: %d.", core->trace_path, errno);
+		return 0;
+	}
+	IPC_LOGI("trace dump %s: %d entries.", core->trace_path, ipc_trace_dump(core->trace, out));
+	close(out);
+	return 0;
+}
+static inline int set_opt_trace(struct ipc_core *core, void *arg)
+{
+	int fds[2];
+	char path[128];
+	struct ipc_topts *opts = arg;
+	if (!opts || core->trace)
+		return -1;
+	if (!opts->entries)
+		return 0;
+	/* Catch the signals sigaction() refuses before anything is set up */
+	if (opts->signo >= NSIG || opts->signo == SIGKILL || opts->signo == SIGSTOP)
+		return -1;
+	core->trace = ipc_trace_create(opts->entries);
+	if (!core->trace)
+		return -1;
+	if (opts->signo <= 0)
+		return 0;
+	if (!opts->path)
+		snprintf(path, sizeof(path), IPC_TRACE_PATH"%s", core->server);
+	core->trace_path = strdup(opts->path ? opts->path : path);
+	if (!core->trace_path)
+		goto err;
+	if (pipe(fds) < 0)
+		goto err;
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	if (!ipc_proxy_create(core, fds[0], ipc_trace_proxy, core)) {
+		close(fds[0]);
+		close(fds[1]);
+		goto err;
+	}
+	__ipc_trace_wfd = fds[1];
+	core->trace_signo = opts->signo;
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = ipc_trace_signal;
+	sa.sa_flags   = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	return sigaction(opts->signo, &sa, NULL);
+err:
+	free((void *)core->trace_path);
+	core->trace_path = NULL;
+	ipc_trace_destroy(core->trace);
+	core->trace = NULL;
+	return -1;
+}
+static inline int set_opt_channel(struct ipc_core *core, void *arg)
+{
+	char name[128];
+	struct ipc_chopts *opts = arg;
+	if (!opts || !opts->topic || core->nchannels == IPC_CHANNELS_MAX ||
+		(opts->topic & core->channel_mask))
+		return -1;
+	if (!opts->name)
+		snprintf(name, sizeof(name), "%s.%d", server_offset(core->path), __builtin_ctzl(opts->topic));
+	struct ipc_channel *ch = ipc_channel_create(opts->name ? opts->name : name, opts->slots, opts->size);
+	if (!ch)
+		return -1;
+	core->channels[core->nchannels] 	  = ch;
+	core->channel_topics[core->nchannels] = opts->topic;
+	core->nchannels++;
+	ATOMIC_SET(&core->channel_mask, core->channel_mask | opts->topic);
+	return 0;
+}
+static inline int set_opt_loopback(struct ipc_core *core, void *arg)
+{
+	core->lb_off = !arg;
 	return 0;
 }
+static inline int set_opt_seqpacket(struct ipc_core *core, void *arg)
+{
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	if (!arg)
+		return 0;
+	if (snprintf(path, sizeof(path), "%s"IPC_SEQPACKET_SUFFIX, core->path) >= sizeof(path)) {
+		IPC_LOGE("seqpacket path too long: %s.", core->path);
+		return -1;
+	}
+	return ipc_master_init(core, path, SOCK_SEQPACKET);
+}
+static int ipc_capture_timer(struct ipc_timing *timing)
+{
+	ipc_capture_flush((struct ipc_capture *)timing->arg);
+	return 0;
+}
+static inline int set_opt_capture(struct ipc_core *core, void *arg)
+{
+	if (!arg || core->capture)
+		return -1;
+	core->capture = ipc_capture_open((const char *)arg, core->server);
+	if (!core->capture)
+		return -1;
+	ipc_timing_init(&core->capture_timing, 1, 0, IPC_CAPTURE_FLUSH_NS / 1000, core->capture, ipc_capture_timer);
+	if (ipc_timing_register(&core->capture_timing) < 0) {
+		IPC_LOGE("capture timing register failure.");
+		ipc_capture_close(core->capture);
+		core->capture = NULL;
+		return -1;
+	}
+	return 0;
+}
+/**
+ * ipc_server_trace_dump - write the flight recorder to @fd, oldest entry first.
+ * Safe to call from any thread while the server is running.
+ * Returns the number of entries written, or -1 if the recorder is not enabled.
+ */
+int ipc_server_trace_dump(int fd)
+{
+	struct ipc_core *core = current_core();
+	if (!ipc_core_inited(core) || !core->trace)
+		return -1;
+	return ipc_trace_dump(core->trace, fd);
+}
 /**
  * ipc_server_proxy - Calling this function, ipc core will manage this fd.
  * @fd: fd to be trusted.
@@ -1852,6 +3092,16 @@ int ipc_server_setopt(int opt, void *arg)
 		return set_opt_arg(core, arg);
 	case IPC_SEROPT_ENABLE_ASYNC:
 		return set_opt_async(core, arg);
+	case IPC_SEROPT_SET_TRACE:
+		return set_opt_trace(core, arg);
+	case IPC_SEROPT_SET_CAPTURE:
+		return set_opt_capture(core, arg);
+	case IPC_SEROPT_SET_CHANNEL:
+		return set_opt_channel(core, arg);
+	case IPC_SEROPT_ENABLE_SEQPACKET:
+		return set_opt_seqpacket(core, arg);
+	case IPC_SEROPT_SET_LOOPBACK:
+		return set_opt_loopback(core, arg);
 	default:
 		return -1;
 	}
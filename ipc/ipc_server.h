@@ -2,6 +2,7 @@
 
 #define __IPC_SERVER_H__
 #include <sys/time.h>
+#include <sched.h>
 #include "list.h"
 #include "ipc_common.h"
 
@@ -38,6 +39,7 @@ struct ipc_server
 	 */
 	void *cookie;
 	struct list_head list;
+	struct ipc_stat_counter counter;	/* Traffic of this handle, see IPC_SDK_MSG_STATS */
 };
 struct ipc_timing
 {
@@ -48,12 +50,42 @@ struct ipc_timing
 	int (*handler)(struct ipc_timing *);
 	struct list_head list;
 };
+/* Option setting for IPC_SEROPT_SET_TRACE */
+struct ipc_topts
+{
+	unsigned int entries;	/* Flight recorder ring size, 0: disabled */
+	int signo;				/* Dump the recorder on this signal, 0: on demand only, see ipc_server_trace_dump() */
+	const char *path;		/* File dumped to on signal, null: IPC_TRACE_PATH<server> */
+};
+#define IPC_TRACE_PATH		"/tmp/ipctrace."
+/*
+ * Option setting for IPC_SEROPT_SET_CHANNEL.
+ * Broadcasts of @topic, published by server or through it as broker, are written into
+ * a shared memory channel instead of being sent to each subscriber, see ipc_channel.h.
+ * Subscribers read them with ipc_channel_open(@name) and ipc_channel_read().
+ * Socket subscribers of @topic only get the notifications sent to them, and the broadcasts
+ * the channel refused, e.g. longer than @size.
+ */
+struct ipc_chopts
+{
+	unsigned long topic;	/* Topic bits bound to the channel, not bound to another one */
+	unsigned int slots;		/* Ring size, 0: IPC_CHANNEL_SLOTS */
+	unsigned int size;		/* Max payload, 0: IPC_CHANNEL_SIZE */
+	const char *name;		/* Channel name, null: <server>.<lowest bit of topic> */
+};
 /* Option setting for IPC_SEROPT_ENABLE_ASYNC*/
 struct ipc_aopts 
 {
 	int mintasks;
 	int maxtasks;
 	int linger;
+	const cpu_set_t *cpuset;	/* Async tasks run on these CPUs, NULL: all, not allowed with @executor */
+	/*
+	 * External executor, copied, see struct ipc_executor. NULL: own async tasks.
+	 * Otherwise async requests are handed to it, the fields above are ignored.
+	 * execute() is called without any lock of IPC held, it may block; if it fails, the request is refused.
+	 */
+	const struct ipc_executor *executor;
 };
 /*
  * ipc_timing_init() - initialize struct ipc_timing.
@@ -87,6 +119,8 @@ struct ipc_aopts
  * @msg : ipc msg to the server.
  * @arg : private argument, see option - IPC_SEROPT_SET_ARG. 
  * On success, zero is returned.  On error, -1 is returned.
+ * Requests batched via ipc_client_batch() are handled with IPC_FLAG_REPLY cleared,
+ * the content left in @msg is returned if the client expects a reply.
  */
 typedef int (*ipc_server_handler)(struct ipc_msg *, void *);
 /* 
@@ -126,6 +160,11 @@ enum IPC_SERVER_OPTION
 	IPC_SEROPT_SET_BUF_SIZE,		/* arg must be unsigned int* type */
 	IPC_SEROPT_SET_ARG,				/* arg: Argument of handler(),filter(),manager() */
 	IPC_SEROPT_ENABLE_ASYNC,
+	IPC_SEROPT_SET_TRACE,			/* arg must be struct ipc_topts* type */
+	IPC_SEROPT_SET_CAPTURE,			/* arg: path of capture file, const char * type, see ipc_capture.h */
+	IPC_SEROPT_SET_CHANNEL,			/* arg must be struct ipc_chopts* type, may be set several times */
+	IPC_SEROPT_ENABLE_SEQPACKET,	/* arg: Boolean Type, clients may connect with SOCK_SEQPACKET, see ipc_client_seqpacket() */
+	IPC_SEROPT_SET_LOOPBACK,		/* arg: Boolean Type, requests of clients in this process skip sockets, enabled by default */
 };
 int ipc_server_init(const char *server, int (*handler)(struct ipc_msg *, void *, void *));
 int ipc_server_run();
@@ -139,6 +178,7 @@ int ipc_server_notifyx(const struct ipc_server *sevr,
 int ipc_server_forward(const struct ipc_server *sevr, struct ipc_notify *notify);
 int ipc_server_setopt(int opt, void *arg);
 int ipc_server_proxy(int fd, int (*proxy)(int, void *), void *arg);
+int ipc_server_trace_dump(int fd);
 /*
  * ipc_timing_idle() - Checking if @timing is running.
  *@timing: Must have been initialized.
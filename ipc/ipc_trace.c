@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2017, <-Jason Chen->
+ * Version: 1.0.0 - 20261019
+ *				  - IPC flight recorder: per-hop timestamps of messages in a fixed-size ring.
+ * Author: Jie Chen <jasonchen0720@163.com>
+ *
+ * Brief : Flight recorder of IPC server core.
+ * Date  : Created at 2026/10/19
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "ipc_trace.h"
+#include "ipc_atomic.h"
+#include "ipc_log.h"
+#define __LOGTAG__ "TRACE"
+#define IPC_TRACE_ENTRIES_MAX	(1 << 20)
+
+__thread struct ipc_trace_entry *__ipc_trace_current = NULL;
+static __thread unsigned long __ipc_trace_pos = 0;
+
+/**
+ * ipc_trace_create - allocate a recorder
+ * @entries: ring size, rounded up to a power of 2
+ */
+struct ipc_trace *ipc_trace_create(unsigned int entries)
+{
+	struct timespec mono, real;
+	unsigned int n = 16;
+	while (n < entries && n < IPC_TRACE_ENTRIES_MAX)
+		n <<= 1;
+	struct ipc_trace *trace = calloc(1, sizeof(struct ipc_trace));
+	if (!trace)
+		return NULL;
+	trace->ring = calloc(n, sizeof(struct ipc_trace_entry));
+	if (!trace->ring) {
+		free(trace);
+		return NULL;
+	}
+	trace->mask = n - 1;
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	trace->base = ((uint64_t)real.tv_sec * 1000000000ull + real.tv_nsec)
+				- ((uint64_t)mono.tv_sec * 1000000000ull + mono.tv_nsec);
+	IPC_LOGI("trace entries:%u, %u bytes.", n, (unsigned int)(n * sizeof(struct ipc_trace_entry)));
+	return trace;
+}
+
+void ipc_trace_destroy(struct ipc_trace *trace)
+{
+	free(trace->ring);
+	free(trace);
+}
+
+/**
+ * ipc_trace_begin - claim an entry for @msg and make it current for the calling thread
+ * @trace: recorder
+ * @msg: message just received, or about to be published
+ * @identity: peer the message came from
+ */
+void ipc_trace_begin(struct ipc_trace *trace, const struct ipc_msg *msg, int identity)
+{
+	unsigned long pos = ATOMIC_FADD(&trace->head, 1);
+	struct ipc_trace_entry *e = &trace->ring[pos & trace->mask];
+	e->seq = 0;
+	barrier();
+	e->stamp[IPC_TRACE_RECV]  = ipc_trace_now();
+	e->stamp[IPC_TRACE_ENTER] = 0;
+	e->stamp[IPC_TRACE_LEAVE] = 0;
+	e->stamp[IPC_TRACE_SEND]  = 0;
+	e->msg_id	= msg->msg_id;
+	e->from		= msg->from;
+	e->identity = identity;
+	e->len		= msg->data_len;
+	e->flags	= 0;
+	e->sends	= 0;
+	__ipc_trace_pos 	= pos;
+	__ipc_trace_current = e;
+}
+
+/**
+ * ipc_trace_commit - complete the current entry of the calling thread
+ * @msg: message handled, its flags are recorded
+ */
+void ipc_trace_commit(const struct ipc_msg *msg)
+{
+	struct ipc_trace_entry *e = __ipc_trace_current;
+	__ipc_trace_current = NULL;
+	if (msg)
+		e->flags = msg->flags;
+	barrier();
+	e->seq = __ipc_trace_pos + 1;
+}
+
+/* Microseconds between two hops, -1 if either was not reached */
+static inline double trace_us(const uint64_t *t, int from, int to)
+{
+	return t[from] && t[to] ? (double)(t[to] - t[from]) / 1000 : -1.0;
+}
+/**
+ * ipc_trace_dump - write the entries in the ring as text, oldest first
+ * @trace: recorder
+ * @fd: file to write to
+ * Times are in microseconds: queue is receive to handler entry, handle is handler
+ * entry to exit, send is handler exit (or receive if no handler ran) to the last send.
+ */
+int ipc_trace_dump(struct ipc_trace *trace, int fd)
+{
+	char line[256];
+	struct ipc_trace_entry e;
+	unsigned long head = ATOMIC_GET(&trace->head);
+	unsigned long n = trace->mask + 1;
+	unsigned long pos = head > n ? head - n : 0;
+	int len, count = 0;
+	len = snprintf(line, sizeof(line), "# seq time msg_id from identity len flags sends queue(us) handle(us) send(us) total(us)\n");
+	if (write(fd, line, len) != len)
+		return -1;
+	for (; pos < head; pos++) {
+		struct ipc_trace_entry *slot = &trace->ring[pos & trace->mask];
+		if (ATOMIC_GET(&slot->seq) != pos + 1)
+			continue;	/* In flight or overwritten */
+		memcpy(&e, slot, sizeof(e));
+		barrier();
+		if (ATOMIC_GET(&slot->seq) != pos + 1)
+			continue;
+		uint64_t *t = e.stamp;
+		uint64_t wall = t[IPC_TRACE_RECV] + trace->base;
+		time_t sec = wall / 1000000000ull;
+		struct tm tm;
+		char stamp[32] = "";
+		if (localtime_r(&sec, &tm))
+			strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+		len = snprintf(line, sizeof(line), "%lu %s.%06lu %04x %d %d %u %04x %u %.1f %.1f %.1f %.1f\n",
+				pos, stamp, (unsigned long)(wall % 1000000000ull) / 1000,
+				e.msg_id, e.from, e.identity, e.len, e.flags, e.sends,
+				trace_us(t, IPC_TRACE_RECV, IPC_TRACE_ENTER),
+				trace_us(t, IPC_TRACE_ENTER, IPC_TRACE_LEAVE),
+				trace_us(t, t[IPC_TRACE_LEAVE] ? IPC_TRACE_LEAVE : IPC_TRACE_RECV, IPC_TRACE_SEND),
+				trace_us(t, IPC_TRACE_RECV, t[IPC_TRACE_SEND] ? IPC_TRACE_SEND :
+								(t[IPC_TRACE_LEAVE] ? IPC_TRACE_LEAVE : IPC_TRACE_RECV)));
+		if (write(fd, line, len) != len)
+			return -1;
+		count++;
+	}
+	return count;
+}
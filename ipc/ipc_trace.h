@@ -0,0 +1,69 @@
+#ifndef __IPC_TRACE_H__
+#define __IPC_TRACE_H__
+#include <stdint.h>
+#include <time.h>
+#include "ipc_common.h"
+/*
+ * IPC flight recorder.
+ * Every message handled by the server core gets one entry in a fixed-size ring,
+ * stamped at each hop it goes through. The ring always holds the latest entries,
+ * so it can be dumped after the fact when a latency spike is noticed.
+ */
+enum IPC_TRACE_HOP {
+	IPC_TRACE_RECV = 0,		/* Message taken out of the socket buffer */
+	IPC_TRACE_ENTER,		/* Handler entry */
+	IPC_TRACE_LEAVE,		/* Handler exit */
+	IPC_TRACE_SEND,			/* Reply sent, or last notification sent to subscribers */
+	IPC_TRACE_HOPS,
+};
+struct ipc_trace_entry {
+	unsigned long seq;		/* Position + 1 once completed, 0 while in use */
+	uint64_t stamp[IPC_TRACE_HOPS];	/* CLOCK_MONOTONIC nanoseconds, 0 if the hop was not reached */
+	int 	 msg_id;
+	int 	 from;
+	int 	 identity;		/* Peer the message came from, -1 if published by server itself */
+	unsigned int   len;
+	unsigned short flags;	/* Message flags after handling */
+	unsigned short sends;	/* Messages sent on its behalf */
+};
+struct ipc_trace {
+	unsigned int mask;
+	unsigned long head;
+	uint64_t base;			/* CLOCK_REALTIME - CLOCK_MONOTONIC at creation, for dumps */
+	struct ipc_trace_entry *ring;
+};
+/* Entry of the message being handled by the calling thread */
+extern __thread struct ipc_trace_entry *__ipc_trace_current;
+
+static inline uint64_t ipc_trace_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+/**
+ * ipc_trace_stamp - stamp @hop of the current message, no-op if recorder is off.
+ */
+static inline void ipc_trace_stamp(int hop)
+{
+	struct ipc_trace_entry *e = __ipc_trace_current;
+	if (__builtin_expect(e != NULL, 0)) {
+		e->stamp[hop] = ipc_trace_now();
+		if (hop == IPC_TRACE_SEND)
+			e->sends++;
+	}
+}
+struct ipc_trace *ipc_trace_create(unsigned int entries);
+void ipc_trace_destroy(struct ipc_trace *trace);
+void ipc_trace_begin(struct ipc_trace *trace, const struct ipc_msg *msg, int identity);
+void ipc_trace_commit(const struct ipc_msg *msg);
+/**
+ * ipc_trace_end - complete the entry of the current message, if any.
+ */
+static inline void ipc_trace_end(const struct ipc_msg *msg)
+{
+	if (__builtin_expect(__ipc_trace_current != NULL, 0))
+		ipc_trace_commit(msg);
+}
+int  ipc_trace_dump(struct ipc_trace *trace, int fd);
+#endif
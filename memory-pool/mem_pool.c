@@ -125,7 +125,7 @@ static void *chunk_alloc(struct rb_tree *onrbt, struct mem_slot *slot)
 		return NULL;
 	}
 	struct mem_stock *stock = list_first_entry(&slot->free_head, struct mem_stock, list);
-	LOG("stock->recycle: %p, stock->index: %d, stock->start: %p.", stock->recycle, stock->index, stock->start);
+	DBG("stock->recycle: %p, stock->index: %d, stock->start: %p.", stock->recycle, stock->index, stock->start);
 	if (stock->recycle) {
 		chunk = stock->recycle;
 		stock->recycle = chunk->next;
@@ -142,19 +142,19 @@ static void *chunk_alloc(struct rb_tree *onrbt, struct mem_slot *slot)
 		list_add(&stock->list, &slot->full_head);
 	}
 	
-	LOG("chunk allocated: %p", chunk);	
+	DBG("chunk allocated: %p", chunk);	
 	return (void *)chunk;
 }
 
 static void chunk_free(struct rb_tree *onrbt, void *p)
 {
-	LOG("chunk free: %p", p);
+	DBG("chunk free: %p", p);
 	struct rb_node *node = rb_search(p, onrbt);
 	assert(node != NULL);
 	struct mem_stock *stock = rb_entry(node, struct mem_stock, node);
 	struct mem_chunk *chunk = (struct mem_chunk *)p;
 
-	LOG("stock@%p, recycle count: %d, index: %d, stock->start: %p", stock, stock->recycnt, stock->index, stock->start);
+	DBG("stock@%p, recycle count: %d, index: %d, stock->start: %p", stock, stock->recycnt, stock->index, stock->start);
 	if (stock_exhausted(stock)) {
 		list_del(&stock->list);
 		list_add(&stock->list, &stock->slot->free_head);
@@ -163,7 +163,7 @@ static void chunk_free(struct rb_tree *onrbt, void *p)
 	chunk->next = stock->recycle;
 	stock->recycle = chunk;
 
-	LOG("chunk released: %p", p);
+	DBG("chunk released: %p", p);
 	if (stock->recycnt == stock->index) {
 		struct list_head *head = &stock->slot->free_head;
 		/* More than two memory stock */
@@ -175,7 +175,7 @@ static void chunk_free(struct rb_tree *onrbt, void *p)
 			return;
 		} 
 	}
-	LOG("stock@%p, keep in free list", stock);
+	DBG("stock@%p, keep in free list", stock);
 }
 
 size_t mem_chunk_count(int pages, size_t chunk_size)
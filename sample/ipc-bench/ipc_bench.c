@@ -0,0 +1,643 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ipc_base.h"
+#include "ipc_client.h"
+#include "ipc_server.h"
+/*
+ * ipc-bench - IPC benchmark, results written as JSON.
+ *
+ * The server under test is this program re-executed in server mode, an echo
+ * server whose buffer fits the largest payload. Tests:
+ *   latency:	 request/response round trips of one connection, per payload size.
+ *   throughput: requests per second of -t threads over -c connections, per payload size.
+ *   fanout:	 publish to N subscribers through the broker, delivery latency per N.
+ *   reconnect:	 server killed and restarted, time until every client got a reply again.
+ */
+#define BENCH_SERVER		"IPC_BENCH"
+#define BENCH_SIZES_MAX		16
+#define BENCH_CONNS_MAX		1024
+#define BENCH_FANOUT_SIZE	256		/* Payload of publishes, fits the subscriber buffer */
+#define BENCH_TOPIC			0x1
+#define BENCH_T_LATENCY		0x1
+#define BENCH_T_THROUGHPUT	0x2
+#define BENCH_T_FANOUT		0x4
+#define BENCH_T_RECONNECT	0x8
+
+struct bench_config {
+	int sizes[BENCH_SIZES_MAX];
+	int nsizes;
+	int subs[BENCH_SIZES_MAX];
+	int nsubs;
+	int count;			/* Round trips per latency run */
+	int duration;		/* Seconds per throughput run */
+	int threads;
+	int conns;
+	int publishes;
+	int clients;		/* Clients of the reconnect storm */
+	int tests;
+	int seqpacket;		/* Clients connect with SOCK_SEQPACKET */
+};
+static struct bench_config __cfg = {
+	{ 16, 256, 4096 }, 3,
+	{ 1, 4, 16 }, 3,
+	10000, 2, 4, 4, 1000, 32,
+	BENCH_T_LATENCY | BENCH_T_THROUGHPUT | BENCH_T_FANOUT | BENCH_T_RECONNECT,
+};
+static const char *__self;
+static FILE *__out;
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+static double pct_us(const uint64_t *v, unsigned int n, double pct)
+{
+	unsigned int i = (unsigned int)(pct / 100 * n);
+	return n ? (double)v[i < n ? i : n - 1] / 1000 : 0;
+}
+/* Sort @v and write its distribution as JSON members */
+static void json_dist(uint64_t *v, unsigned int n)
+{
+	unsigned int i;
+	double sum = 0;
+	qsort(v, n, sizeof(uint64_t), cmp_u64);
+	for (i = 0; i < n; i++)
+		sum += v[i];
+	fprintf(__out, "\"mean_us\": %.2f, \"p50_us\": %.2f, \"p90_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f",
+		n ? sum / n / 1000 : 0, pct_us(v, n, 50), pct_us(v, n, 90), pct_us(v, n, 99), pct_us(v, n, 99.9),
+		n ? (double)v[n - 1] / 1000 : 0);
+}
+/* A run which could not be set up still writes one element, main has printed the separator already */
+static int json_error(const char *what)
+{
+	fprintf(__out, "    {\"error\": \"%s\"}", what);
+	return -1;
+}
+
+/*
+ * Server side
+ */
+static int bench_handler(struct ipc_msg *msg, void *arg, void *cookie)
+{
+	return 0;	/* Echo */
+}
+static int bench_server()
+{
+	unsigned int size = ipc_msg_buffer_size(0xffff);
+	if (ipc_server_init(BENCH_SERVER, bench_handler) < 0)
+		return 1;
+	ipc_server_setopt(IPC_SEROPT_SET_BUF_SIZE, &size);
+	ipc_server_setopt(IPC_SEROPT_ENABLE_SEQPACKET, (void *)1);
+	ipc_server_run();
+	return 0;
+}
+/* Plain connect, ipc_client_init() sleeps between retries */
+static int server_ready()
+{
+	int rc, sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr = {0};
+	if (sock < 0)
+		return 0;
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s", UNIX_SOCK_DIR, BENCH_SERVER);
+	rc = connect(sock, (struct sockaddr *)&addr, sizeof(addr));
+	close(sock);
+	return rc == 0;
+}
+static pid_t server_start()
+{
+	int i;
+	pid_t pid = fork();
+	if (pid == 0) {
+		execl(__self, __self, "-S", (char *)NULL);
+		_exit(127);
+	}
+	if (pid < 0)
+		return -1;
+	/* Wait until it accepts connections */
+	for (i = 0; i < 2000; i++) {
+		if (server_ready())
+			return pid;
+		usleep(100);
+	}
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	return -1;
+}
+static void server_stop(pid_t pid)
+{
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+}
+static struct ipc_msg *bench_msg(int size)
+{
+	struct ipc_msg *msg = ipc_alloc_msg(size);
+	if (msg)
+		memset(msg->data, 0x5a, size);
+	return msg;
+}
+static int bench_request(struct ipc_client *client, struct ipc_msg *msg, int size)
+{
+	msg->msg_id   = 1;
+	msg->flags	  = IPC_FLAG_REPLY;
+	msg->data_len = size;
+	return ipc_client_request(client, msg, ipc_msg_buffer_size(size), 1);
+}
+
+/*
+ * Latency
+ */
+static int bench_latency(int size)
+{
+	int i, rc = 0, errors = 0;
+	unsigned int n = 0;
+	struct ipc_client *client = ipc_client_create(BENCH_SERVER);
+	struct ipc_msg *msg = bench_msg(size);
+	uint64_t *lat = malloc(__cfg.count * sizeof(uint64_t));
+	if (!client || !msg || !lat) {
+		rc = json_error(client ? "out of memory" : "connect failed");
+		goto out;
+	}
+	for (i = 0; i < __cfg.count / 10; i++)	/* Warm up */
+		bench_request(client, msg, size);
+	for (i = 0; i < __cfg.count; i++) {
+		uint64_t t = now_ns();
+		if (bench_request(client, msg, size)) {
+			errors++;
+			continue;
+		}
+		lat[n++] = now_ns() - t;
+	}
+	fprintf(__out, "    {\"size\": %d, \"count\": %u, \"errors\": %d, ", size, n, errors);
+	json_dist(lat, n);
+	fprintf(__out, "}");
+out:
+	free(lat);
+	if (msg)
+		ipc_free_msg(msg);
+	if (client)
+		ipc_client_destroy(client);
+	return rc;
+}
+
+/*
+ * Throughput
+ */
+struct tp_worker {
+	pthread_t tid;
+	int size;
+	int nclients;
+	struct ipc_client *clients[BENCH_CONNS_MAX];
+	volatile int *stop;
+	unsigned long long requests;
+	unsigned long long errors;
+};
+static void *tp_thread(void *arg)
+{
+	int i = 0;
+	struct tp_worker *w = arg;
+	struct ipc_msg *msg = bench_msg(w->size);
+	if (!msg)
+		return NULL;
+	while (!*w->stop) {
+		if (bench_request(w->clients[i], msg, w->size))
+			w->errors++;
+		else
+			w->requests++;
+		if (++i == w->nclients)
+			i = 0;
+	}
+	ipc_free_msg(msg);
+	return NULL;
+}
+static int bench_throughput(int size)
+{
+	int i, j, rc = 0, nthreads = __cfg.threads;
+	volatile int stop = 0;
+	unsigned long long requests = 0, errors = 0;
+	struct tp_worker *workers = calloc(nthreads, sizeof(struct tp_worker));
+	if (!workers)
+		return json_error("out of memory");
+	for (i = 0; i < nthreads; i++) {
+		workers[i].size = size;
+		workers[i].stop = &stop;
+	}
+	/* Connections dealt to threads round robin, every thread gets at least one */
+	for (i = 0; i < (__cfg.conns > nthreads ? __cfg.conns : nthreads); i++) {
+		struct tp_worker *w = &workers[i % nthreads];
+		if (w->nclients == BENCH_CONNS_MAX)
+			break;
+		w->clients[w->nclients] = ipc_client_create(BENCH_SERVER);
+		if (!w->clients[w->nclients]) {
+			rc = json_error("connect failed");
+			goto out;
+		}
+		w->nclients++;
+	}
+	uint64_t t = now_ns();
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&workers[i].tid, NULL, tp_thread, &workers[i]))
+			break;
+	}
+	if (i < nthreads) {
+		stop = 1;
+		while (i-- > 0)
+			pthread_join(workers[i].tid, NULL);
+		rc = json_error("thread create failed");
+		goto out;
+	}
+	sleep(__cfg.duration);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].tid, NULL);
+		requests += workers[i].requests;
+		errors	 += workers[i].errors;
+	}
+	double elapsed = (double)(now_ns() - t) / 1e9;
+	fprintf(__out, "    {\"size\": %d, \"threads\": %d, \"connections\": %d, \"seconds\": %.3f, "
+				   "\"requests\": %llu, \"errors\": %llu, \"rps\": %.0f, \"mbps\": %.2f}",
+		size, nthreads, (__cfg.conns > nthreads ? __cfg.conns : nthreads), elapsed, requests, errors,
+		requests / elapsed, requests * 2.0 * ipc_msg_buffer_size(size) / elapsed / 1e6);
+out:
+	for (i = 0; i < nthreads; i++) {
+		for (j = 0; j < workers[i].nclients; j++)
+			ipc_client_destroy(workers[i].clients[j]);
+	}
+	free(workers);
+	return rc;
+}
+
+/*
+ * Fan-out
+ */
+struct fan_stamp {
+	uint64_t sent;
+	uint32_t seq;
+};
+#define FAN_WARMUP		0xffffffff	/* Sequence of warm-up publishes */
+struct fan_sub {
+	struct fan_state *fs;
+	int ready;
+	struct ipc_subscriber *subscriber;
+};
+struct fan_state {
+	int publishes;
+	int ready;				/* Subscribers which got a warm-up publish */
+	uint64_t *lat;			/* Every delivery */
+	uint64_t *last;			/* Per publish, delivery to the last subscriber */
+	unsigned int count;
+};
+static int fan_handler(int msg_id, void *data, int size, void *arg)
+{
+	struct fan_sub *sub = arg;
+	struct fan_state *fs = sub->fs;
+	struct fan_stamp stamp;
+	uint64_t lat, old;
+	if (size < (int)sizeof(stamp))
+		return 0;
+	memcpy(&stamp, data, sizeof(stamp));
+	lat = now_ns() - stamp.sent;
+	if (stamp.seq == FAN_WARMUP) {
+		if (!sub->ready) {
+			sub->ready = 1;
+			__sync_fetch_and_add(&fs->ready, 1);
+		}
+		return 0;
+	}
+	if (stamp.seq >= (uint32_t)fs->publishes)
+		return 0;
+	fs->lat[__sync_fetch_and_add(&fs->count, 1)] = lat;
+	do {
+		old = fs->last[stamp.seq];
+		if (lat <= old)
+			break;
+	} while (!__sync_bool_compare_and_swap(&fs->last[stamp.seq], old, lat));
+	return 0;
+}
+static int bench_fanout(int nsubs)
+{
+	int i, rc = 0, errors = 0;
+	char data[BENCH_FANOUT_SIZE];
+	struct fan_stamp stamp;
+	struct fan_state fs;
+	struct fan_sub *subs = calloc(nsubs, sizeof(struct fan_sub));
+	struct ipc_client *client = ipc_client_create(BENCH_SERVER);
+	fs.publishes = __cfg.publishes;
+	fs.count	 = 0;
+	fs.ready	 = 0;
+	fs.lat		 = calloc((size_t)nsubs * fs.publishes, sizeof(uint64_t));
+	fs.last		 = calloc(fs.publishes, sizeof(uint64_t));
+	if (!subs || !client || !fs.lat || !fs.last) {
+		rc = json_error(client ? "out of memory" : "connect failed");
+		goto out;
+	}
+	for (i = 0; i < nsubs; i++) {
+		subs[i].fs = &fs;
+		subs[i].subscriber = ipc_subscriber_register(BENCH_SERVER, BENCH_TOPIC, NULL, 0, fan_handler, &subs[i]);
+		if (!subs[i].subscriber) {
+			rc = json_error("subscribe failed");
+			goto out;
+		}
+	}
+	memset(data, 0x5a, sizeof(data));
+	/* Registering completes asynchronously, publish until every subscriber is receiving */
+	uint64_t deadline = now_ns() + 2000000000ull;
+	stamp.seq = FAN_WARMUP;
+	while (*(volatile int *)&fs.ready < nsubs && now_ns() < deadline) {
+		stamp.sent = now_ns();
+		memcpy(data, &stamp, sizeof(stamp));
+		ipc_client_publish(client, IPC_TO_BROADCAST, BENCH_TOPIC, 1, data, sizeof(data), 1);
+		usleep(1000);
+	}
+	for (i = 0; i < fs.publishes; i++) {
+		stamp.seq  = i;
+		stamp.sent = now_ns();
+		memcpy(data, &stamp, sizeof(stamp));
+		if (ipc_client_publish(client, IPC_TO_BROADCAST, BENCH_TOPIC, 1, data, sizeof(data), 1))
+			errors++;
+		usleep(200);	/* Keep publishes apart, measure delivery rather than queueing */
+	}
+	/* Let deliveries drain */
+	deadline = now_ns() + 2000000000ull;
+	while (*(volatile unsigned int *)&fs.count < (unsigned int)(nsubs * fs.publishes) && now_ns() < deadline)
+		usleep(1000);
+	for (i = 0; i < nsubs; i++) {
+		ipc_subscriber_unregister(subs[i].subscriber);
+		subs[i].subscriber = NULL;
+	}
+	unsigned int n = fs.count, nlast = 0;
+	for (i = 0; i < fs.publishes; i++)
+		if (fs.last[i])
+			fs.last[nlast++] = fs.last[i];
+	fprintf(__out, "    {\"subscribers\": %d, \"size\": %d, \"publishes\": %d, \"errors\": %d, "
+				   "\"deliveries\": %u, \"lost\": %u, ",
+		nsubs, BENCH_FANOUT_SIZE, fs.publishes, errors, n, nsubs * fs.publishes - n);
+	json_dist(fs.lat, n);
+	fprintf(__out, ", \"last\": {");
+	json_dist(fs.last, nlast);
+	fprintf(__out, "}}");
+out:
+	for (i = 0; subs && i < nsubs; i++) {
+		if (subs[i].subscriber)
+			ipc_subscriber_unregister(subs[i].subscriber);
+	}
+	free(fs.lat);
+	free(fs.last);
+	free(subs);
+	if (client)
+		ipc_client_destroy(client);
+	return rc;
+}
+
+/*
+ * Reconnect storm
+ */
+/* Threads of the storm are held here until the server is down, or released to quit */
+struct storm_gate {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int state;				/* 0: closed, 1: storm, -1: setup failed */
+};
+struct storm_client {
+	pthread_t tid;
+	struct ipc_client *client;
+	struct storm_gate *gate;
+	uint64_t start;
+	uint64_t recovered;		/* ns after restart, 0 if never */
+	int attempts;
+};
+static void *storm_thread(void *arg)
+{
+	int state;
+	struct storm_client *sc = arg;
+	struct ipc_msg *msg = bench_msg(16);
+	pthread_mutex_lock(&sc->gate->lock);
+	while (!(state = sc->gate->state))
+		pthread_cond_wait(&sc->gate->cond, &sc->gate->lock);
+	pthread_mutex_unlock(&sc->gate->lock);
+	if (!msg || state < 0)
+		goto out;
+	while (now_ns() - sc->start < 10000000000ull) {
+		sc->attempts++;
+		if (bench_request(sc->client, msg, 16) == 0) {
+			sc->recovered = now_ns() - sc->start;
+			break;
+		}
+		if (ipc_client_repair(sc->client) < 0)
+			usleep(100);
+	}
+out:
+	if (msg)
+		ipc_free_msg(msg);
+	return NULL;
+}
+static void storm_release(struct storm_gate *gate, int state)
+{
+	pthread_mutex_lock(&gate->lock);
+	gate->state = state;
+	pthread_cond_broadcast(&gate->cond);
+	pthread_mutex_unlock(&gate->lock);
+}
+static int bench_reconnect(pid_t *server)
+{
+	int i, rc = 0, n = __cfg.clients, started = 0, recovered = 0;
+	uint64_t *times;
+	unsigned long long attempts = 0;
+	struct storm_gate gate = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+	struct storm_client *scs = calloc(n, sizeof(struct storm_client));
+	times = calloc(n, sizeof(uint64_t));
+	if (!scs || !times) {
+		rc = json_error("out of memory");
+		goto out;
+	}
+	for (i = 0; i < n; i++) {
+		scs[i].client = ipc_client_create(BENCH_SERVER);
+		scs[i].gate   = &gate;
+		if (!scs[i].client) {
+			rc = json_error("connect failed");
+			goto out;
+		}
+		if (pthread_create(&scs[i].tid, NULL, storm_thread, &scs[i])) {
+			rc = json_error("thread create failed");
+			goto out;
+		}
+		started++;
+	}
+	server_stop(*server);
+	uint64_t start = now_ns();
+	for (i = 0; i < n; i++)
+		scs[i].start = start;
+	storm_release(&gate, 1);
+	*server = server_start();
+	uint64_t up = now_ns() - start;
+	for (i = 0; i < n; i++) {
+		pthread_join(scs[i].tid, NULL);
+		attempts += scs[i].attempts;
+		if (scs[i].recovered)
+			times[recovered++] = scs[i].recovered;
+	}
+	started = 0;
+	qsort(times, recovered, sizeof(uint64_t), cmp_u64);
+	fprintf(__out, "    {\"clients\": %d, \"recovered\": %d, \"attempts\": %llu, \"server_up_ms\": %.2f, "
+				   "\"p50_ms\": %.2f, \"p99_ms\": %.2f, \"recovery_ms\": %.2f}",
+		n, recovered, attempts, up / 1e6, pct_us(times, recovered, 50) / 1000,
+		pct_us(times, recovered, 99) / 1000, recovered ? times[recovered - 1] / 1e6 : 0);
+out:
+	if (started) {
+		storm_release(&gate, -1);
+		for (i = 0; i < started; i++)
+			pthread_join(scs[i].tid, NULL);
+	}
+	for (i = 0; scs && i < n; i++) {
+		if (scs[i].client)
+			ipc_client_destroy(scs[i].client);
+	}
+	free(times);
+	free(scs);
+	return rc;
+}
+
+static int parse_list(const char *arg, int *list, int max)
+{
+	int n = 0;
+	char *end;
+	while (*arg && n < max) {
+		list[n] = strtol(arg, &end, 0);
+		if (end == arg || list[n] <= 0)
+			return -1;
+		n++;
+		arg = *end == ',' ? end + 1 : end;
+	}
+	return n;
+}
+static int parse_tests(const char *arg)
+{
+	int tests = 0;
+	if (strstr(arg, "latency"))		tests |= BENCH_T_LATENCY;
+	if (strstr(arg, "throughput"))	tests |= BENCH_T_THROUGHPUT;
+	if (strstr(arg, "fanout"))		tests |= BENCH_T_FANOUT;
+	if (strstr(arg, "reconnect"))	tests |= BENCH_T_RECONNECT;
+	return tests;
+}
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"  -s sizes      payload sizes, comma separated, default 16,256,4096\n"
+		"  -n count      round trips per latency run, default 10000\n"
+		"  -d seconds    duration of each throughput run, default 2\n"
+		"  -t threads    throughput threads, default 4\n"
+		"  -c conns      throughput connections, dealt to threads, default 4\n"
+		"  -N subs       fan-out subscriber counts, comma separated, default 1,4,16\n"
+		"  -p count      publishes per fan-out run, default 1000\n"
+		"  -r clients    clients of the reconnect storm, default 32\n"
+		"  -T tests      latency,throughput,fanout,reconnect, default all\n"
+		"  -q            clients connect with SOCK_SEQPACKET\n"
+		"  -o file       write JSON to file, default stdout\n", prog);
+}
+int main(int argc, char **argv)
+{
+	int opt, i, first;
+	pid_t server;
+	const char *output = NULL;
+	__self = argv[0];
+	if (argc == 2 && !strcmp(argv[1], "-S"))
+		return bench_server();
+	while ((opt = getopt(argc, argv, "s:n:d:t:c:N:p:r:T:o:qh")) != -1) {
+		switch (opt) {
+		case 's': __cfg.nsizes	  = parse_list(optarg, __cfg.sizes, BENCH_SIZES_MAX); break;
+		case 'N': __cfg.nsubs	  = parse_list(optarg, __cfg.subs, BENCH_SIZES_MAX); break;
+		case 'n': __cfg.count	  = atoi(optarg); break;
+		case 'd': __cfg.duration  = atoi(optarg); break;
+		case 't': __cfg.threads	  = atoi(optarg); break;
+		case 'c': __cfg.conns	  = atoi(optarg); break;
+		case 'p': __cfg.publishes = atoi(optarg); break;
+		case 'r': __cfg.clients	  = atoi(optarg); break;
+		case 'T': __cfg.tests	  = parse_tests(optarg); break;
+		case 'o': output = optarg; break;
+		case 'q': __cfg.seqpacket = 1; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (__cfg.nsizes <= 0 || __cfg.nsubs <= 0 || __cfg.count <= 0 || __cfg.duration <= 0 ||
+		__cfg.threads <= 0 || __cfg.conns <= 0 || __cfg.publishes <= 0 || __cfg.clients <= 0 || !__cfg.tests) {
+		usage(argv[0]);
+		return 1;
+	}
+	for (i = 0; i < __cfg.nsizes; i++) {
+		if (__cfg.sizes[i] > 0xffff) {
+			fprintf(stderr, "payload size %d over 65535\n", __cfg.sizes[i]);
+			return 1;
+		}
+	}
+	__out = output ? fopen(output, "w") : stdout;
+	if (!__out) {
+		perror(output);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	ipc_client_seqpacket(__cfg.seqpacket);
+	server = server_start();
+	if (server < 0) {
+		fprintf(stderr, "server start failed\n");
+		return 1;
+	}
+	fprintf(__out, "{\n  \"bench\": \"ipc\",\n  \"version\": 1,\n  \"timestamp\": %ld,\n", (long)time(NULL));
+	fprintf(__out, "  \"config\": {\"count\": %d, \"duration\": %d, \"threads\": %d, \"connections\": %d, "
+				   "\"publishes\": %d, \"clients\": %d, \"transport\": \"%s\"},\n",
+		__cfg.count, __cfg.duration, __cfg.threads, __cfg.conns, __cfg.publishes, __cfg.clients,
+		__cfg.seqpacket ? "seqpacket" : "stream");
+	if (__cfg.tests & BENCH_T_LATENCY) {
+		fprintf(__out, "  \"latency\": [\n");
+		for (i = 0, first = 1; i < __cfg.nsizes; i++, first = 0) {
+			fprintf(__out, first ? "" : ",\n");
+			bench_latency(__cfg.sizes[i]);
+		}
+		fprintf(__out, "\n  ],\n");
+	}
+	if (__cfg.tests & BENCH_T_THROUGHPUT) {
+		fprintf(__out, "  \"throughput\": [\n");
+		for (i = 0, first = 1; i < __cfg.nsizes; i++, first = 0) {
+			fprintf(__out, first ? "" : ",\n");
+			bench_throughput(__cfg.sizes[i]);
+		}
+		fprintf(__out, "\n  ],\n");
+	}
+	if (__cfg.tests & BENCH_T_FANOUT) {
+		fprintf(__out, "  \"fanout\": [\n");
+		for (i = 0, first = 1; i < __cfg.nsubs; i++, first = 0) {
+			fprintf(__out, first ? "" : ",\n");
+			bench_fanout(__cfg.subs[i]);
+		}
+		fprintf(__out, "\n  ],\n");
+	}
+	if (__cfg.tests & BENCH_T_RECONNECT) {
+		fprintf(__out, "  \"reconnect\": [\n");
+		bench_reconnect(&server);
+		fprintf(__out, "\n  ],\n");
+	}
+	fprintf(__out, "  \"ok\": true\n}\n");
+	if (server > 0)
+		server_stop(server);
+	if (__out != stdout)
+		fclose(__out);
+	return 0;
+}
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "ipc_base.h"
+#include "ipc_client.h"
+#include "ipc_server.h"
+#include "ipc_capture.h"
+/*
+ * ipc-replay - re-inject traffic captured with IPC_SEROPT_SET_CAPTURE.
+ * Usage: ipc-replay [-s speed] [-t timeout] [-c conns] <capture file> <server>
+ *
+ * Requests, batches and publishes sent by clients are replayed, every captured
+ * connection by its own thread and connection, at the captured pace scaled by
+ * @speed, 0 for as fast as possible. Temporary clients are replayed as temporary
+ * clients. Registering subscribers is not replayed, run them separately.
+ */
+#define REPLAY_CONNS_MAX	1024
+#define REPLAY_MSG_SIZE		ipc_msg_buffer_size(0xffff)
+
+struct replay_conn {
+	int identity;
+	int sock;
+	int clazz;
+	unsigned int count;
+	unsigned int size;
+	const struct ipc_capture_record **recs;
+	struct ipc_msg *batch[IPC_BATCH_MAX];	/* Requests of a batch, allocated on demand */
+	/* Results */
+	pthread_t tid;
+	unsigned int replies;
+	unsigned int errors;
+	uint64_t *latency;		/* ns, one per reply */
+	uint64_t late_max;		/* Worst lag behind schedule, ns */
+};
+static const char *__server;
+static double __speed = 1.0;
+static int __tmo = 1;
+static uint64_t __start;
+static uint64_t __first;		/* Capture time of the first message replayed */
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+static int replayable(const struct ipc_capture_record *rec)
+{
+	const struct ipc_msg *msg = (const struct ipc_msg *)(rec + 1);
+	if (rec->dir != IPC_CAPTURE_IN)
+		return 0;
+	return users_msg(msg) || msg->msg_id == IPC_SDK_MSG_NOTIFY || msg->msg_id == IPC_SDK_MSG_BATCH;
+}
+static struct replay_conn *conn_get(struct replay_conn *conns, int *nconns, const struct ipc_capture_record *rec)
+{
+	int i;
+	struct replay_conn *c;
+	for (i = 0; i < *nconns; i++) {
+		c = &conns[i];
+		if (c->identity == rec->identity && c->sock == rec->sock && c->clazz == rec->clazz)
+			return c;
+	}
+	if (*nconns == REPLAY_CONNS_MAX)
+		return NULL;
+	c = &conns[(*nconns)++];
+	c->identity = rec->identity;
+	c->sock		= rec->sock;
+	c->clazz	= rec->clazz;
+	return c;
+}
+static int conn_add(struct replay_conn *c, const struct ipc_capture_record *rec)
+{
+	if (c->count == c->size) {
+		unsigned int size = c->size ? c->size * 2 : 64;
+		const struct ipc_capture_record **recs = realloc(c->recs, size * sizeof(*recs));
+		if (!recs)
+			return -1;
+		c->recs = recs;
+		c->size = size;
+	}
+	c->recs[c->count++] = rec;
+	return 0;
+}
+/* Split a batch envelope back into requests, see ipc_client_batch() */
+static int replay_batch(struct replay_conn *c, struct ipc_client *client, const struct ipc_msg *envelope)
+{
+	int count = 0;
+	unsigned int offset = 0;
+	while (offset + IPC_MSG_HDRLEN <= envelope->data_len) {
+		const struct ipc_msg *req = (const struct ipc_msg *)(envelope->data + offset);
+		if (count == IPC_BATCH_MAX || offset + __data_len(req) > envelope->data_len)
+			return -1;
+		if (!c->batch[count] && !(c->batch[count] = malloc(REPLAY_MSG_SIZE)))
+			return -1;
+		memcpy(c->batch[count++], req, __data_len(req));
+		offset += __data_len(req);
+	}
+	return count ? ipc_client_batch(client, c->batch, count, REPLAY_MSG_SIZE, __tmo) : -1;
+}
+static int replay_one(struct replay_conn *c, struct ipc_client *client, struct ipc_msg *msg)
+{
+	int rc;
+	struct ipc_client tmp;
+	if (!client) {
+		memset(&tmp, 0, sizeof(tmp));
+		if (ipc_client_init(__server, &tmp) < 0)
+			return -1;
+		client = &tmp;
+	}
+	if (msg->msg_id == IPC_SDK_MSG_NOTIFY) {
+		struct ipc_notify *notify = (struct ipc_notify *)msg->data;
+		rc = ipc_client_publish(client, notify->to, notify->topic, notify->msg_id,
+				notify->data_len ? notify->data : NULL, notify->data_len, __tmo);
+	} else if (msg->msg_id == IPC_SDK_MSG_BATCH)
+		rc = replay_batch(c, client, msg);
+	else
+		rc = ipc_client_request(client, msg, REPLAY_MSG_SIZE, __tmo);
+	if (client == &tmp)
+		ipc_client_close(&tmp);
+	return rc;
+}
+static void *replay_thread(void *arg)
+{
+	unsigned int i;
+	struct replay_conn *c = arg;
+	struct ipc_client *client = NULL;
+	struct ipc_msg *msg = malloc(REPLAY_MSG_SIZE);
+	c->latency = malloc(c->count * sizeof(uint64_t));
+	if (!msg || !c->latency)
+		goto out;
+	if (c->clazz != IPC_CLASS_DUMMY) {
+		client = ipc_client_create(__server);
+		if (!client) {
+			c->errors = c->count;
+			goto out;
+		}
+	}
+	for (i = 0; i < c->count; i++) {
+		const struct ipc_capture_record *rec = c->recs[i];
+		uint64_t due = __start + (__speed > 0 ? (uint64_t)((rec->time - __first) / __speed) : 0);
+		uint64_t t = now_ns();
+		if (t < due) {
+			struct timespec ts = { (due - t) / 1000000000ull, (due - t) % 1000000000ull };
+			while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+			t = now_ns();
+		}
+		if (__speed > 0 && t - due > c->late_max)
+			c->late_max = t - due;
+		memcpy(msg, rec + 1, rec->len);
+		int reply = msg->flags & IPC_FLAG_REPLY;
+		if (replay_one(c, client, msg)) {
+			c->errors++;
+			continue;
+		}
+		if (reply)
+			c->latency[c->replies++] = now_ns() - t;
+	}
+out:
+	if (client)
+		ipc_client_destroy(client);
+	for (i = 0; i < IPC_BATCH_MAX && c->batch[i]; i++)
+		free(c->batch[i]);
+	free(msg);
+	return NULL;
+}
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+static double percentile(const uint64_t *v, unsigned int n, double pct)
+{
+	unsigned int i = (unsigned int)(pct / 100 * n);
+	return n ? (double)v[i < n ? i : n - 1] / 1000 : 0;
+}
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-s speed] [-t timeout] [-c conns] <capture file> <server>\n"
+					"  -s  speed factor of captured pace, default 1, 0 for as fast as possible\n"
+					"  -t  receive timeout in seconds, default 1\n"
+					"  -c  replay at most this many connections\n", prog);
+}
+int main(int argc, char **argv)
+{
+	int opt, i, nconns = 0, maxconns = REPLAY_CONNS_MAX;
+	char *data;
+	size_t off;
+	struct stat st;
+	FILE *fp;
+	struct ipc_capture_header *hdr;
+	struct replay_conn *conns;
+	while ((opt = getopt(argc, argv, "s:t:c:h")) != -1) {
+		switch (opt) {
+		case 's':
+			__speed = atof(optarg);
+			break;
+		case 't':
+			__tmo = atoi(optarg);
+			break;
+		case 'c':
+			maxconns = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	__server = argv[optind + 1];
+	fp = fopen(argv[optind], "rb");
+	if (!fp || fstat(fileno(fp), &st) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	data = malloc(st.st_size);
+	conns = calloc(REPLAY_CONNS_MAX, sizeof(struct replay_conn));
+	if (!data || !conns || fread(data, 1, st.st_size, fp) != (size_t)st.st_size) {
+		fprintf(stderr, "%s: read error\n", argv[optind]);
+		return 1;
+	}
+	fclose(fp);
+	hdr = (struct ipc_capture_header *)data;
+	if (st.st_size < (off_t)sizeof(*hdr) || hdr->magic != IPC_CAPTURE_MAGIC || hdr->version != IPC_CAPTURE_VERSION) {
+		fprintf(stderr, "%s: not a capture file\n", argv[optind]);
+		return 1;
+	}
+	/* Index records of each connection, in file order */
+	unsigned int total = 0, skipped = 0;
+	uint64_t first = 0, last = 0;
+	for (off = sizeof(*hdr); off + sizeof(struct ipc_capture_record) <= (size_t)st.st_size; ) {
+		const struct ipc_capture_record *rec = (const struct ipc_capture_record *)(data + off);
+		if (off + sizeof(*rec) + rec->len > (size_t)st.st_size)
+			break;	/* Truncated tail */
+		off += sizeof(*rec) + rec->len;
+		if (!replayable(rec))
+			continue;
+		struct replay_conn *c = conn_get(conns, &nconns, rec);
+		if (!c || c - conns >= maxconns) {
+			skipped++;
+			continue;
+		}
+		if (conn_add(c, rec) < 0)
+			return 1;
+		if (!total++)
+			first = rec->time;
+		last = rec->time;
+	}
+	if (!total) {
+		fprintf(stderr, "nothing to replay\n");
+		return 1;
+	}
+	__first = first;
+	nconns = nconns < maxconns ? nconns : maxconns;
+	printf("%s: server %s, %u messages on %d connections over %.3fs, %u skipped, speed %g\n",
+		argv[optind], hdr->server, total, nconns, (double)(last - first) / 1e9, skipped, __speed);
+	__start = now_ns() + 100000000ull;	/* Let every thread get ready */
+	for (i = 0; i < nconns; i++) {
+		if (pthread_create(&conns[i].tid, NULL, replay_thread, &conns[i]) != 0) {
+			fprintf(stderr, "pthread_create error\n");
+			return 1;
+		}
+	}
+	unsigned int replies = 0, errors = 0, n = 0;
+	uint64_t late_max = 0, *latency;
+	for (i = 0; i < nconns; i++) {
+		pthread_join(conns[i].tid, NULL);
+		replies += conns[i].replies;
+		errors	+= conns[i].errors;
+		if (conns[i].late_max > late_max)
+			late_max = conns[i].late_max;
+	}
+	double elapsed = (double)(now_ns() - __start) / 1e9;
+	latency = malloc((replies ? replies : 1) * sizeof(uint64_t));
+	if (!latency)
+		return 1;
+	for (i = 0; i < nconns; i++) {
+		memcpy(latency + n, conns[i].latency, conns[i].replies * sizeof(uint64_t));
+		n += conns[i].replies;
+	}
+	qsort(latency, n, sizeof(uint64_t), cmp_u64);
+	printf("replayed in %.3fs, %.0f msg/s, %u replies, %u errors, max lag behind schedule %.1fms\n",
+		elapsed, total / elapsed, replies, errors, (double)late_max / 1e6);
+	printf("latency(us): p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+		percentile(latency, n, 50), percentile(latency, n, 90), percentile(latency, n, 99),
+		percentile(latency, n, 99.9), n ? (double)latency[n - 1] / 1000 : 0);
+	return errors ? 2 : 0;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "ipc_base.h"
+#include "ipc_client.h"
+#include "ipc_server.h"
+/*
+ * ipc-stats - print statistics of IPC servers.
+ * Usage: ipc-stats [-r] [-t timeout] [server...]
+ * Without server names, every socket under UNIX_SOCK_DIR is queried.
+ */
+#define STATS_BUF_SIZE	IPC_STATS_SIZE
+
+static const char *clazz_name(int clazz)
+{
+	switch (clazz) {
+	case IPC_CLASS_DUMMY:		return "temporary";
+	case IPC_CLASS_REQUESTER:	return "requester";
+	case IPC_CLASS_SUBSCRIBER:	return "subscriber";
+	default:					return "unknown";
+	}
+}
+/* Upper bound in us of the bucket holding the @pct percentile, -1 if open-ended */
+static long long hist_percentile(const unsigned int *hist, int pct)
+{
+	int b;
+	unsigned long long n = 0, sum = 0;
+	for (b = 0; b < IPC_STATS_HIST; b++)
+		n += hist[b];
+	if (!n)
+		return 0;
+	for (b = 0; b < IPC_STATS_HIST; b++) {
+		sum += hist[b];
+		if (sum * 100 >= n * pct)
+			break;
+	}
+	return b < IPC_STATS_HIST - 1 ? 1LL << b : -1;
+}
+static void print_percentile(const char *name, long long us)
+{
+	if (us < 0)
+		printf(" %s>%lluus", name, 1ULL << (IPC_STATS_HIST - 2));
+	else
+		printf(" %s<%lldus", name, us);
+}
+static void print_counter(const struct ipc_stat_counter *c)
+{
+	printf("%12llu %12llu %12llu %12llu %8llu %8llu\n",
+		c->msgs_in, c->bytes_in, c->msgs_out, c->bytes_out, c->errors, c->drops);
+}
+static void print_stats(const char *server, const struct ipc_stats *stats)
+{
+	unsigned int i;
+	const struct ipc_stat_client *c = ipc_stats_clients(stats);
+	const struct ipc_stat_msg *m = ipc_stats_msgs(stats);
+	printf("%s: uptime %llu.%03llus, clients %u%s\n", server,
+		stats->uptime / 1000, stats->uptime % 1000, stats->nclients_total,
+		(stats->flags & IPC_STATS_TRUNCATED) ? ", truncated" : "");
+	printf("  %-22s %12s %12s %12s %12s %8s %8s\n", "client", "msgs_in", "bytes_in", "msgs_out", "bytes_out", "errors", "drops");
+	printf("  %-22s ", "total");
+	print_counter(&stats->total);
+	for (i = 0; i < stats->nclients; i++, c++) {
+		printf("  %-10s %-11d ", clazz_name(c->clazz), c->identity);
+		print_counter(&c->counter);
+	}
+	if (stats->timing.fired) {
+		printf("  timings fired %llu, late avg %lluus max %lluus,", stats->timing.fired,
+			stats->timing.late_sum / stats->timing.fired, stats->timing.late_max);
+		print_percentile("p50", hist_percentile(stats->timing.hist, 50));
+		print_percentile("p99", hist_percentile(stats->timing.hist, 99));
+		printf("\n");
+	}
+	if (!stats->nmsgs)
+		return;
+	printf("  %-8s %10s %8s %10s %10s  %s\n", "msg_id", "count", "failed", "avg(us)", "max(us)", "percentiles");
+	for (i = 0; i < stats->nmsgs; i++, m++) {
+		char id[16];
+		if (m->msg_id < 0)
+			strcpy(id, "other");
+		else
+			snprintf(id, sizeof(id), "%04x", m->msg_id);
+		printf("  %-8s %10llu %8llu %10.1f %10.1f ", id, m->count, m->failed,
+			(double)m->time_sum / m->count / 1000, (double)m->time_max / 1000);
+		print_percentile("p50", hist_percentile(m->hist, 50));
+		print_percentile("p99", hist_percentile(m->hist, 99));
+		printf("\n");
+	}
+}
+static int query(const char *server, struct ipc_stats *stats, int flags, int tmo)
+{
+	int rc;
+	struct ipc_client client;
+	memset(&client, 0, sizeof(client));
+	if (ipc_client_init(server, &client) < 0) {
+		fprintf(stderr, "%s: connect failed\n", server);
+		return -1;
+	}
+	rc = ipc_client_stats(&client, stats, STATS_BUF_SIZE, flags, tmo);
+	ipc_client_close(&client);
+	if (rc) {
+		fprintf(stderr, "%s: %d\n", server, rc);
+		return -1;
+	}
+	print_stats(server, stats);
+	return 0;
+}
+int main(int argc, char **argv)
+{
+	int opt, rc = 0, flags = 0, tmo = 1;
+	struct ipc_stats *stats;
+	while ((opt = getopt(argc, argv, "rt:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			flags |= IPC_STATS_RESET;
+			break;
+		case 't':
+			tmo = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-r] [-t timeout] [server...]\n"
+							"  -r  reset counters once read\n"
+							"  -t  receive timeout in seconds, default 1\n", argv[0]);
+			return 1;
+		}
+	}
+	stats = malloc(STATS_BUF_SIZE);
+	if (!stats)
+		return 1;
+	if (optind < argc) {
+		for (; optind < argc; optind++)
+			if (query(argv[optind], stats, flags, tmo) < 0)
+				rc = 1;
+	} else {
+		struct dirent *ent;
+		struct stat st;
+		char path[PATH_MAX];
+		DIR *dir = opendir(UNIX_SOCK_DIR);
+		if (!dir) {
+			perror(UNIX_SOCK_DIR);
+			free(stats);
+			return 1;
+		}
+		while ((ent = readdir(dir)) != NULL) {
+			snprintf(path, sizeof(path), "%s%s", UNIX_SOCK_DIR, ent->d_name);
+			if (stat(path, &st) < 0 || !S_ISSOCK(st.st_mode))
+				continue;
+			size_t len = strlen(ent->d_name);
+			if (len > sizeof(IPC_SEQPACKET_SUFFIX) - 1 &&
+				!strcmp(ent->d_name + len - (sizeof(IPC_SEQPACKET_SUFFIX) - 1), IPC_SEQPACKET_SUFFIX))
+				continue;	/* SOCK_SEQPACKET listener of a server already listed */
+			if (query(ent->d_name, stats, flags, tmo) < 0)
+				rc = 1;
+		}
+		closedir(dir);
+	}
+	free(stats);
+	return rc;
+}
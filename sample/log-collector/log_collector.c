@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "generic_logshm.h"
+#define COLLECTOR_IDLE_US		10000
+#define COLLECTOR_LINE_MAX		1024
+#define COLLECTOR_BUF_SIZE		(64 * 1024)
+
+struct collector {
+	const char *file;
+	long file_size;
+	int  file_count;
+	int  fd;
+	long size;
+	int  used;
+	char buf[COLLECTOR_BUF_SIZE];
+};
+static volatile sig_atomic_t __quit = 0;
+
+static void collector_signal(int sig)
+{
+	__quit = 1;
+}
+
+static int collector_open(struct collector *c)
+{
+	struct stat st;
+	if (!c->file) {
+		c->fd = STDOUT_FILENO;
+		return 0;
+	}
+	c->fd = open(c->file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (c->fd < 0) {
+		fprintf(stderr, "open %s: %s\n", c->file, strerror(errno));
+		return -1;
+	}
+	c->size = fstat(c->fd, &st) == 0 ? st.st_size : 0;
+	return 0;
+}
+
+/*
+ * collector_rotate() -
+ * file -> file.0 -> file.1 ... same naming as GENERIC_LOG backups.
+ */
+static void collector_rotate(struct collector *c)
+{
+	char from[PATH_MAX], to[PATH_MAX];
+	int i;
+	close(c->fd);
+	if (c->file_count > 1) {
+		for (i = c->file_count - 2; i > 0; i--) {
+			snprintf(from, sizeof(from), "%s.%d", c->file, i - 1);
+			snprintf(to,   sizeof(to),   "%s.%d", c->file, i);
+			rename(from, to);
+		}
+		snprintf(to, sizeof(to), "%s.0", c->file);
+		rename(c->file, to);
+	} else {
+		truncate(c->file, 0);
+	}
+	collector_open(c);
+}
+
+static int collector_flush(struct collector *c)
+{
+	int off = 0;
+	while (off < c->used) {
+		int n = write(c->fd, c->buf + off, c->used - off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		off += n;
+	}
+	c->size += c->used;
+	c->used  = 0;
+	if (c->file && c->file_size > 0 && c->size >= c->file_size)
+		collector_rotate(c);
+	return 0;
+}
+
+/*
+ * collector_write() -
+ * Lines are batched, flushed when the buffer fills up or the ring runs dry.
+ */
+static int collector_write(struct collector *c, const char *line, int len)
+{
+	if (c->used + len > COLLECTOR_BUF_SIZE && collector_flush(c) < 0)
+		return -1;
+	memcpy(c->buf + c->used, line, len);
+	c->used += len;
+	return 0;
+}
+
+static void usage()
+{
+	printf("\nUsage: log-collector [options] <name>:\n"
+		"    -o <file>     -- write to file instead of stdout\n"
+		"    -s <size>     -- rotate file when it exceeds size bytes\n"
+		"    -c <count>    -- number of files kept, including the current one\n"
+		"    -r <records>  -- ring size if the segment has to be created\n"
+		"    -d            -- dump records currently in the ring and exit\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct collector c = {NULL, 0, 2, -1, 0, 0};
+	struct logshm_reader *reader;
+	char line[COLLECTOR_LINE_MAX];
+	uint64_t lost = 0;
+	int records = 0;
+	int dump = 0;
+	int len;
+	for (;;) {
+		int opt = getopt(argc, argv, "o:s:c:r:d");
+		if (opt < 0)
+			break;
+		switch (opt) {
+		case 'o':
+			c.file = optarg;
+			break;
+		case 's':
+			c.file_size = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			c.file_count = atoi(optarg);
+			break;
+		case 'r':
+			records = atoi(optarg);
+			break;
+		case 'd':
+			dump = 1;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		return -1;
+	}
+	reader = logshm_reader_open(argv[optind], records);
+	if (!reader) {
+		fprintf(stderr, "attach %s: %s\n", argv[optind], strerror(errno));
+		return -1;
+	}
+	if (collector_open(&c) < 0)
+		goto out;
+	signal(SIGINT,  collector_signal);
+	signal(SIGTERM, collector_signal);
+	while (!__quit) {
+		len = logshm_reader_next(reader, line, sizeof(line));
+		if (len < 0)
+			break;
+		if (len == 0) {
+			if (collector_flush(&c) < 0 || dump)
+				break;
+			usleep(COLLECTOR_IDLE_US);
+			continue;
+		}
+		if (logshm_reader_lost(reader) != lost) {
+			char note[64];
+			int n = snprintf(note, sizeof(note), "<%llu records lost>\n",
+				(unsigned long long)(logshm_reader_lost(reader) - lost));
+			lost = logshm_reader_lost(reader);
+			collector_write(&c, note, n);
+		}
+		if (collector_write(&c, line, len) < 0)
+			break;
+	}
+	collector_flush(&c);
+	if (c.file)
+		close(c.fd);
+out:
+	logshm_reader_close(reader);
+	return 0;
+}
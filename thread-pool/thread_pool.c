@@ -1,17 +1,49 @@
 /*
  * Copyright (c) 2021, Jasonchen
+ * Version: 0.1.0 - 20261019
+ *				  - Add ring mode: bounded lock-free MPMC job queue, idle threads spin then park
+ *				    on a futex, full ring rejects or blocks, see THREAD_POOL_SET_RING.
+ * Version: 0.0.9 - 20261019
+ *				  - Add counters and histograms of queue wait and run time: thread_pool_snapshot(),
+ *				    drop the logs of every thread state change.
+ * Version: 0.0.8 - 20261019
+ *				  - Add adaptive sizing driven by p99 queue delay: THREAD_POOL_SET_ADAPTIVE, thread_pool_adapt_stat().
+ * Version: 0.0.7 - 20261019
+ *				  - Add thread placement and names: THREAD_POOL_SET_CPUSET, THREAD_POOL_SET_NUMA_NODE,
+ *				    THREAD_POOL_SET_NAME.
+ * Version: 0.0.6 - 20261019
+ *				  - Add parallel loops: thread_pool_parallel_for(), thread_pool_parallel_reduce().
+ * Version: 0.0.5 - 20261019
+ *				  - Add priority classes and deadlines to the ready queue, with aging and
+ *				    queue delay statistics: thread_pool_execute_prio(), thread_pool_execute_deadline().
+ * Version: 0.0.4 - 20261019
+ *				  - Add task groups and futures: thread_pool_group_submit(), thread_pool_group_wait(),
+ *				    thread_future_get(), waiters help running the jobs they wait for.
+ * Version: 0.0.3 - 20261019
+ *				  - Jobs of thread_pool_execute() come from a mem_cache, add intrusive jobs:
+ *				    thread_pool_submit(), thread_pool_execute_batch().
+ * Version: 0.0.2 - 20261019
+ *				  - Add work-stealing mode: THREAD_POOL_SET_STEALING, thread_pool_setopt().
  * Version: 0.0.1 - 20211103                
  * Author: Jie Chen <jasonchen0720@163.com>
  * Note  : Implementation of JC easy thread pool.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
 #include <assert.h>
+#include <sched.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "thread_pool.h"
 #include "generic_log.h"
+#include "generic_atomic.h"
+#include "mem_pool.h"
 
 static pthread_condattr_t __cond_attr;
 static pthread_once_t __init_once = PTHREAD_ONCE_INIT;
@@ -25,18 +57,439 @@ struct thread_struct
 	pthread_t tid;
 	struct thread_pool *pool;
 	struct list_head list;
-};
-struct thread_job
-{
-	void *arg;
-	void (*func)(void *);
-	struct list_head list;
+	struct thread_group *group;	/* Group of the running job */
+	uint64_t start;				/* Start time of the running job */
 };
 enum {
 	THREAD_POOL_DESTROY,
 	THREAD_POOL_WAIT,
 };
 #define BIT(nr) (1U << (nr))
+#define THREAD_JOB_POOLED	BIT(0)	/* Allocated from |job_cache| by thread_pool_execute() */
+#define THREAD_AGING_DEFAULT	200		/* Milliseconds */
+static inline uint64_t thread_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+/**
+ * thread_job_set_deadline - put @job in THREAD_PRIO_DEADLINE class, to be started within @msecs.
+ */
+void thread_job_set_deadline(struct thread_job *job, int msecs)
+{
+	job->prio = THREAD_PRIO_DEADLINE;
+	job->deadline = thread_now() + (uint64_t)msecs * 1000000ull;
+}
+static inline int thread_class_urgent(int prio)
+{
+	return prio < THREAD_PRIO_NORMAL;
+}
+static inline int thread_hist_index(uint64_t v)
+{
+	int e, i;
+	if (v < 8)
+		return (int)v;
+	e = 63 - __builtin_clzll(v);
+	i = 8 + (e - 3) * 8 + (int)((v >> (e - 3)) & 7);
+	return i < THREAD_HIST_BUCKETS ? i : THREAD_HIST_BUCKETS - 1;
+}
+/* Highest value falling in bucket @i */
+static inline uint64_t thread_hist_upper(int i)
+{
+	int e;
+	if (i < 8)
+		return i;
+	e = (i - 8) / 8 + 3;
+	return ((uint64_t)(8 + (i - 8) % 8 + 1) << (e - 3)) - 1;
+}
+static inline void thread_hist_add(struct thread_hist *hist, uint64_t v)
+{
+	hist->bucket[thread_hist_index(v)]++;
+	hist->count++;
+	hist->sum += v;
+	if (v > hist->max)
+		hist->max = v;
+}
+static void thread_hist_merge(struct thread_hist *dst, const struct thread_hist *src)
+{
+	int i;
+	for (i = 0; i < THREAD_HIST_BUCKETS; i++)
+		dst->bucket[i] += src->bucket[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+/**
+ * thread_hist_percentile - value under which @percent of the samples of @hist fall, 0 if empty.
+ * Reported as the upper bound of the bucket, at most 12.5% over the exact value.
+ */
+uint64_t thread_hist_percentile(const struct thread_hist *hist, double percent)
+{
+	int i;
+	unsigned long seen = 0, rank;
+	if (hist->count == 0)
+		return 0;
+	rank = (unsigned long)(hist->count * percent / 100.0 + 0.5);
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < THREAD_HIST_BUCKETS; i++) {
+		seen += hist->bucket[i];
+		if (seen >= rank)
+			break;
+	}
+	if (i == THREAD_HIST_BUCKETS || thread_hist_upper(i) > hist->max)
+		return hist->max;
+	return thread_hist_upper(i);
+}
+/**
+ * thread_job_enqueue - add @job to the ready queue, called with |pool->mutex| held.
+ */
+static void thread_job_enqueue(struct thread_pool *pool, struct thread_job *job, uint64_t now)
+{
+	struct list_head *head;
+	if ((unsigned int)job->prio >= THREAD_PRIO_CLASSES)
+		job->prio = THREAD_PRIO_LOW;
+	head = &pool->job_head[job->prio];
+	job->stamp = now;
+	if (job->prio == THREAD_PRIO_DEADLINE) {
+		/* Earliest deadline first, mostly appended: search from the tail */
+		struct list_head *pos;
+		for (pos = head->prev; pos != head; pos = pos->prev) {
+			if (list_entry(pos, struct thread_job, list)->deadline <= job->deadline)
+				break;
+		}
+		list_add(&job->list, pos);
+	} else {
+		list_add_tail(&job->list, head);
+	}
+	pool->queued++;
+	if (pool->queued > pool->queued_max)
+		pool->queued_max = pool->queued;
+	pool->metrics.submitted++;
+	if (thread_class_urgent(job->prio))
+		aop_inc(&pool->urgent);
+	if (job->group)
+		list_add_tail(&job->glist, &job->group->job_head);
+}
+/**
+ * thread_job_unqueue - take @job out of the ready queue, called with |pool->mutex| held.
+ */
+static void thread_job_unqueue(struct thread_pool *pool, struct thread_job *job)
+{
+	list_delete(&job->list);
+	pool->queued--;
+	if (thread_class_urgent(job->prio))
+		aop_dec(&pool->urgent);
+	if (job->group)
+		list_del_init(&job->glist);
+}
+static void thread_adapt_evaluate(struct thread_pool *pool, uint64_t now);
+/**
+ * thread_adapt_sample - account a job taken after @delay microseconds, called with |pool->mutex| held.
+ */
+static inline void thread_adapt_sample(struct thread_pool *pool, uint64_t delay, uint64_t now)
+{
+	struct thread_adapt *adapt = &pool->adapt;
+	int b = delay ? 64 - __builtin_clzll(delay) : 0;
+	adapt->hist[b < THREAD_ADAPT_BUCKETS ? b : THREAD_ADAPT_BUCKETS - 1]++;
+	adapt->jobs++;
+	if (now - adapt->start >= (uint64_t)adapt->window * 1000000ull)
+		thread_adapt_evaluate(pool, now);
+}
+/*
+ * Idle time of threads, for the controller, called with |pool->mutex| held.
+ * Threads still sleeping when a window closes are accounted up to then by thread_adapt_evaluate().
+ */
+static inline uint64_t thread_idle_enter(struct thread_pool *pool)
+{
+	uint64_t now;
+	if (pool->adapt.target <= 0)
+		return 0;
+	now = thread_now();
+	pool->adapt.idlers++;
+	pool->adapt.idle_mark += now;
+	return now;
+}
+static inline void thread_idle_leave(struct thread_pool *pool, uint64_t since)
+{
+	struct thread_adapt *adapt = &pool->adapt;
+	if (!since)
+		return;
+	if (since < adapt->start)
+		since = adapt->start;
+	adapt->idle += thread_now() - since;
+	adapt->idle_mark -= since;
+	adapt->idlers--;
+}
+/**
+ * thread_idle_wait - wait for work with |pool->mutex| held, until CLOCK_MONOTONIC nanoseconds @expire, 0 for ever.
+ * With adaptive sizing and threads above the minimum, the wait is cut at the end of the sampling window,
+ * which is closed here, so that the pool still shrinks when no job comes to close it.
+ * Returns ETIMEDOUT only once @expire has passed.
+ */
+static int thread_idle_wait(struct thread_pool *pool, uint64_t expire)
+{
+	int rc;
+	uint64_t now, end = expire, close = 0;
+	struct timespec tspec;
+	if (pool->adapt.target > 0 && pool->nthreads > pool->minthreads) {
+		close = pool->adapt.start + (uint64_t)pool->adapt.window * 1000000ull;
+		if (!end || close < end)
+			end = close;
+	}
+	if (!end)
+		return pthread_cond_wait(&pool->work_cond, &pool->mutex);
+	tspec.tv_sec  = end / 1000000000ull;
+	tspec.tv_nsec = end % 1000000000ull;
+	rc = pthread_cond_timedwait(&pool->work_cond, &pool->mutex, &tspec);
+	if (rc != ETIMEDOUT)
+		return rc;
+	now = thread_now();
+	/* Not closed meanwhile by a job or by another idle thread */
+	if (close && pool->adapt.target > 0 &&
+		now - pool->adapt.start >= (uint64_t)pool->adapt.window * 1000000ull)
+		thread_adapt_evaluate(pool, now);
+	return expire && now >= expire ? ETIMEDOUT : 0;
+}
+/**
+ * thread_adapt_retire - whether the calling idle thread is to exit, called with |pool->mutex| held.
+ */
+static inline int thread_adapt_retire(struct thread_pool *pool)
+{
+	if (pool->adapt.retire > 0 && pool->nthreads > pool->minthreads) {
+		pool->adapt.retire--;
+		return 1;
+	}
+	return 0;
+}
+/**
+ * thread_job_dequeue - next job to run, called with |pool->mutex| held.
+ * The first job of the highest class, unless the first job of a lower class has waited past
+ * the aging limit: then the lowest such class goes first.
+ */
+static struct thread_job *thread_job_dequeue(struct thread_pool *pool)
+{
+	int c, pick;
+	uint64_t now, delay;
+	struct thread_job *job;
+	struct thread_class_stat *stat;
+	if (pool->queued == 0)
+		return NULL;
+	for (pick = 0; pick < THREAD_PRIO_CLASSES; pick++) {
+		if (!list_empty(&pool->job_head[pick]))
+			break;
+	}
+	now = thread_now();
+	stat = &pool->stat[pick];
+	for (c = THREAD_PRIO_CLASSES - 1; pool->aging > 0 && c > pick; c--) {
+		if (list_empty(&pool->job_head[c]))
+			continue;
+		job = list_first_entry(&pool->job_head[c], struct thread_job, list);
+		if (now - job->stamp >= (uint64_t)pool->aging * 1000000ull) {
+			pick = c;
+			stat = &pool->stat[pick];
+			stat->aged++;
+			break;
+		}
+	}
+	job = list_first_entry(&pool->job_head[pick], struct thread_job, list);
+	thread_job_unqueue(pool, job);
+	delay = (now - job->stamp) / 1000;
+	stat->jobs++;
+	stat->delay += delay;
+	if (delay > stat->max_delay)
+		stat->max_delay = delay;
+	if (pick == THREAD_PRIO_DEADLINE && now > job->deadline)
+		stat->missed++;
+	thread_hist_add(&pool->metrics.wait, delay);
+	job->stamp = 0;		/* Wait accounted */
+	if (pool->adapt.target > 0)
+		thread_adapt_sample(pool, delay, now);
+	return job;
+}
+/*
+ * |job_cache| is guarded by |mutex|: jobs are allocated and freed while holding it anyway.
+ * Except in work-stealing and ring modes, where the cache has its own lock.
+ */
+#define thread_pool_lockfree(pool)	((pool)->workers != NULL || (pool)->ring != NULL)
+static inline void thread_job_release(struct thread_pool *pool, struct thread_job *job)
+{
+	if (job->flags & THREAD_JOB_POOLED)
+		mem_cache_free(pool->job_cache, job);
+}
+/**
+ * thread_group_done - one job of @group finished, called with |pool->mutex| held.
+ * Under the lock, so that a waiter seeing |pending| at 0 may destroy the group right away.
+ */
+static inline void thread_group_done(struct thread_group *group)
+{
+	if (aop_subf(&group->pending, 1) == 0 && group->waiters > 0)
+		pthread_cond_broadcast(&group->cond);
+}
+/*
+ * Work-stealing mode.
+ * Every worker owns a Chase-Lev deque: the owner pushes and pops at the bottom (LIFO) without locks,
+ * idle workers steal from the top (FIFO) of a random victim. Jobs from outside the pool go through
+ * the global injection queue - |job_head| under |mutex|, the only place workers take the lock
+ * besides going to sleep.
+ */
+#define THREAD_DEQUE_SIZE	1024	/* Power of 2, a full deque overflows into the global queue */
+#define THREAD_GLOBAL_BATCH	16		/* Jobs moved from the global queue to a deque at once */
+#define CACHELINE			64
+struct thread_deque
+{
+	volatile long top;
+	char __pad[CACHELINE - sizeof(long)];
+	volatile long bottom;
+	char __pad1[CACHELINE - sizeof(long)];
+	struct thread_job *ring[THREAD_DEQUE_SIZE];
+};
+struct thread_worker
+{
+	struct thread_deque deque;
+	struct thread_pool *pool;
+	pthread_t tid;
+	int  used;		/* Slot taken by a thread, protected by |pool->mutex| */
+	unsigned int seed;
+	struct thread_metrics metrics;	/* Written by the owner only, kept across threads using the slot */
+};
+static __thread struct thread_worker *__worker = NULL;
+/*
+ * Ring mode.
+ * A bounded MPMC ring of Vyukov: the sequence number of a cell tells whether it is free for the
+ * producer of position pos (seq == pos) or holds the job of that position (seq == pos + 1).
+ * Room is reserved in |count| before positions are claimed, so a batch is queued or refused
+ * as a whole, and a claimed cell is always free already.
+ */
+#define THREAD_RING_SIZE	1024
+#define THREAD_RING_SPIN	2000
+struct thread_cell
+{
+	volatile unsigned long seq;
+	struct thread_job *job;
+};
+struct thread_ring_slot
+{
+	struct thread_pool *pool;
+	pthread_t tid;
+	int  used;		/* Slot taken by a thread, protected by |pool->mutex| */
+	struct thread_metrics metrics;	/* Written by the owner only */
+};
+struct thread_ring
+{
+	unsigned long mask;
+	int policy;
+	int spin;
+	struct thread_ring_slot *slots;
+	unsigned long rejected;
+	long count_max;					/* High-water mark of |count|, updated racily */
+	char __pad[CACHELINE];
+	volatile unsigned long head;	/* Next position to fill */
+	char __pad1[CACHELINE - sizeof(long)];
+	volatile unsigned long tail;	/* Next position to take */
+	char __pad2[CACHELINE - sizeof(long)];
+	volatile long count;			/* Positions reserved and not taken yet */
+	char __pad3[CACHELINE - sizeof(long)];
+	volatile int parked;			/* Threads sleeping on |wake| */
+	volatile int waking;			/* A wake-up of a parked thread is on its way */
+	volatile int blocked;			/* Submitters sleeping on |room| */
+	uint32_t wake;					/* Futex words, bumped before every wake-up */
+	uint32_t room;
+	char __pad4[CACHELINE - 5 * sizeof(int)];
+	struct thread_cell cells[];
+};
+static __thread struct thread_ring_slot *__slot = NULL;
+static inline int thread_futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *ts)
+{
+	return syscall(SYS_futex, uaddr, op, val, ts, NULL, 0);
+}
+static inline void thread_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ __volatile__("pause" : : : "memory");
+#else
+	__asm__ __volatile__("" : : : "memory");
+#endif
+}
+/**
+ * thread_ring_pop - take the oldest job, NULL if none (or its producer is not done yet).
+ */
+static struct thread_job *thread_ring_pop(struct thread_ring *ring)
+{
+	struct thread_cell *cell;
+	struct thread_job *job;
+	unsigned long pos = ring->tail, cur;
+	for (;;) {
+		cell = &ring->cells[pos & ring->mask];
+		long diff = (long)(aop_load_acquire(&cell->seq) - (pos + 1));
+		if (diff == 0) {
+			cur = aop_cas(&ring->tail, pos, pos + 1);
+			if (cur == pos)
+				break;
+			pos = cur;
+		} else if (diff < 0) {
+			return NULL;
+		} else {
+			pos = ring->tail;
+		}
+	}
+	job = cell->job;
+	aop_store_release(&cell->seq, pos + ring->mask + 1);
+	aop_dec(&ring->count);
+	/* Read after the locked decrement, pairs with thread_ring_wait_room() */
+	if (ring->blocked > 0) {
+		aop_inc(&ring->room);
+		thread_futex(&ring->room, FUTEX_WAKE_PRIVATE, 1, NULL);
+	}
+	return job;
+}
+
+static int thread_deque_push(struct thread_deque *dq, struct thread_job *job)
+{
+	long b = dq->bottom;
+	long t = aop_get(&dq->top);
+	if (b - t >= THREAD_DEQUE_SIZE)
+		return -1;
+	dq->ring[b & (THREAD_DEQUE_SIZE - 1)] = job;
+	aop_barrier();
+	dq->bottom = b + 1;
+	return 0;
+}
+static struct thread_job *thread_deque_pop(struct thread_deque *dq)
+{
+	struct thread_job *job;
+	long b = dq->bottom - 1;
+	long t;
+	dq->bottom = b;
+	aop_barrier();
+	t = dq->top;
+	if (t > b) {
+		dq->bottom = b + 1;
+		return NULL;
+	}
+	job = dq->ring[b & (THREAD_DEQUE_SIZE - 1)];
+	if (t == b) {
+		/* Last one, race against thieves */
+		if (aop_cas(&dq->top, t, t + 1) != t)
+			job = NULL;
+		dq->bottom = b + 1;
+	}
+	return job;
+}
+static struct thread_job *thread_deque_steal(struct thread_deque *dq)
+{
+	struct thread_job *job;
+	long t = aop_get(&dq->top);
+	long b = aop_get(&dq->bottom);
+	if (t >= b)
+		return NULL;
+	job = dq->ring[t & (THREAD_DEQUE_SIZE - 1)];
+	if (aop_cas(&dq->top, t, t + 1) != t)
+		return NULL;
+	return job;
+}
 
 
 static void thread_attr_init(pthread_attr_t *new_attr, const pthread_attr_t *old_attr)
@@ -72,7 +525,14 @@ void thread_pool_wait(struct thread_pool *pool)
 
 	pthread_cleanup_push(pthread_mutex_unlock, &pool->mutex);
 	
-	while (!list_empty(&pool->job_head) || !list_empty(&pool->active_thread_head)) {
+	if (pool->workers || pool->ring) {
+		/* Flag first, a worker finishing the last job either sees it or is seen */
+		aop_setbit(&pool->flags, BIT(THREAD_POOL_WAIT));
+		while (aop_get(&pool->pending) > 0)
+			pthread_cond_wait(&pool->wait_cond, &pool->mutex);
+		aop_clrbit(&pool->flags, BIT(THREAD_POOL_WAIT));
+	}
+	while (pool->queued > 0 || !list_empty(&pool->active_thread_head)) {
 		pool->flags |= BIT(THREAD_POOL_WAIT);
 		pthread_cond_wait(&pool->wait_cond, &pool->mutex);
 	}
@@ -80,7 +540,7 @@ void thread_pool_wait(struct thread_pool *pool)
 }
 static void thread_pool_wakeup(struct thread_pool *pool) {
 	
-	if (list_empty(&pool->job_head) && list_empty(&pool->active_thread_head)) {
+	if (pool->queued == 0 && list_empty(&pool->active_thread_head)) {
 		pool->flags &= ~(BIT(THREAD_POOL_WAIT));
 		pthread_cond_broadcast(&pool->wait_cond);
 	}
@@ -102,46 +562,85 @@ int thread_pool_init(struct thread_pool * pool, int keepalive,
 		LOGE("Invalid arg, minthreads:%d, maxthreads:%d.", minthreads, maxthreads);
 		return -1;
 	}
+	int i;
 	assert(!pthread_once(&__init_once, thread_pool_setup));
 	memset(pool, 0, sizeof(*pool));
+	pool->job_cache = mem_cache_create(mem_chunk_count(1, sizeof(struct thread_job)), sizeof(struct thread_job), 0);
+	if (!pool->job_cache) {
+		LOGE("No memory.");
+		return -1;
+	}
 	pool->minthreads 	= minthreads;
 	pool->maxthreads 	= maxthreads;
 	pool->keepalive 	= keepalive;
 	pool->flags 		= 0;
 	pool->nthreads 		= 0;
 	pool->idlethreads 	= 0;
+	pool->aging			= THREAD_AGING_DEFAULT;
+	pool->node			= -1;
 
 	assert(!pthread_mutex_init(&pool->mutex, NULL));
 	assert(!pthread_cond_init(&pool->work_cond, &__cond_attr));
 	assert(!pthread_cond_init(&pool->wait_cond, &__cond_attr));
 	assert(!pthread_cond_init(&pool->exit_cond, &__cond_attr));
 	thread_attr_init(&pool->attr, attr);
-	INIT_LIST_HEAD(&pool->job_head);
+	for (i = 0; i < THREAD_PRIO_CLASSES; i++)
+		INIT_LIST_HEAD(&pool->job_head[i]);
 	INIT_LIST_HEAD(&pool->active_thread_head);
 	LOGI("Thread pool create done.");
 	return 0;
 }
 void thread_pool_destroy(int defer, struct thread_pool *pool)
 {
+	int i;
 	pthread_mutex_lock(&pool->mutex);
 
-	pool->flags |= BIT(THREAD_POOL_DESTROY);
+	aop_setbit(&pool->flags, BIT(THREAD_POOL_DESTROY));
 	if (pool->idlethreads > 0)
 		pthread_cond_broadcast(&pool->work_cond);
+	if (pool->ring) {
+		aop_inc(&pool->ring->wake);
+		thread_futex(&pool->ring->wake, FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
+	}
 
 	if (!defer) {
 		struct thread_struct *thr;
 		list_for_each_entry(thr, &pool->active_thread_head, list) {
 			pthread_cancel(thr->tid);
 		}
+		for (i = 0; pool->workers && i < pool->maxthreads; i++) {
+			if (pool->workers[i].used)
+				pthread_cancel(pool->workers[i].tid);
+		}
+		for (i = 0; pool->ring && i < pool->maxthreads; i++) {
+			if (pool->ring->slots[i].used)
+				pthread_cancel(pool->ring->slots[i].tid);
+		}
 	}
 	while (pool->nthreads > 0)
 		pthread_cond_wait(&pool->exit_cond, &pool->mutex);
 
 	struct thread_job *job, *tmp;
-	list_for_each_entry_safe(job, tmp, &pool->job_head, list) {
-		free(job);
+	for (i = 0; i < THREAD_PRIO_CLASSES; i++) {
+		list_for_each_entry_safe(job, tmp, &pool->job_head[i], list) {
+			thread_job_release(pool, job);
+		}
 	}
+	for (i = 0; pool->workers && i < pool->maxthreads; i++) {
+		while ((job = thread_deque_steal(&pool->workers[i].deque)) != NULL)
+			thread_job_release(pool, job);
+	}
+	free(pool->workers);
+	pool->workers = NULL;
+	if (pool->ring) {
+		while ((job = thread_ring_pop(pool->ring)) != NULL)
+			thread_job_release(pool, job);
+		free(pool->ring->slots);
+		free(pool->ring);
+		pool->ring = NULL;
+	}
+	mem_cache_destroy(pool->job_cache);
+	pool->job_cache = NULL;
 	pthread_mutex_unlock(&pool->mutex);
 
 	pthread_mutex_destroy(&pool->mutex);
@@ -161,25 +660,138 @@ static void thread_task_cleanup(void *arg)
 		}
 	} 
 	pthread_mutex_unlock(&pool->mutex);
-	LOGI("Thread cleanup: %d.", pool->nthreads);
 }
 static void thread_job_cleanup(void *arg)
 {
 	struct thread_struct *thread = arg;
+	struct thread_metrics *metrics = &thread->pool->metrics;
+	uint64_t end = thread_now();
 	pthread_mutex_lock(&thread->pool->mutex);
 
 	list_delete(&thread->list);
+	metrics->completed++;
+	thread_hist_add(&metrics->run, (end - thread->start) / 1000);
 
+	if (thread->group) {
+		thread_group_done(thread->group);
+		thread->group = NULL;
+	}
 	if (thread->pool->flags & BIT(THREAD_POOL_WAIT)) 
 		thread_pool_wakeup(thread->pool);
-	
-	//LOGI("Thread job cleanup: %d.", thread->pool->nthreads);
 }
 static void thread_idle_cleanup(void *arg)
 {
 	struct thread_pool *pool = arg;
 	pool->idlethreads--;
 }
+/*
+ * Thread placement, raw syscalls so that libnuma is not needed.
+ */
+#define THREAD_MPOL_PREFERRED	1
+#define THREAD_NODE_MAX			(sizeof(unsigned long) * 8)
+static int thread_mempolicy(int mode, int node)
+{
+	unsigned long mask = node >= 0 ? 1UL << node : 0;
+	return syscall(SYS_set_mempolicy, mode, node >= 0 ? &mask : NULL, THREAD_NODE_MAX);
+}
+/**
+ * thread_setup - name the calling thread of @pool and apply its memory policy.
+ */
+static void thread_setup(struct thread_pool *pool)
+{
+	char name[32];
+	if (pool->name[0]) {
+		/* Kernel keeps 15 characters */
+		snprintf(name, sizeof(name), "%s/%d", pool->name, aop_fadd(&pool->seq, 1));
+		name[15] = '\0';
+		pthread_setname_np(pthread_self(), name);
+	}
+	if (pool->node >= 0 && thread_mempolicy(THREAD_MPOL_PREFERRED, pool->node) < 0)
+		LOGE("set_mempolicy node:%d, errno:%d.", pool->node, errno);
+}
+/* Parse a cpulist like "0-3,8,10-11" */
+static int thread_cpulist_parse(const char *list, cpu_set_t *set)
+{
+	char *end;
+	long first, last;
+	CPU_ZERO(set);
+	while (*list && *list != '\n') {
+		first = last = strtol(list, &end, 10);
+		if (end == list)
+			return -1;
+		if (*end == '-') {
+			list = end + 1;
+			last = strtol(list, &end, 10);
+			if (end == list)
+				return -1;
+		}
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, set);
+		list = *end == ',' ? end + 1 : end;
+	}
+	return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+static int thread_pool_cpuset(struct thread_pool *pool, const cpu_set_t *set)
+{
+	int error;
+	if (!set || CPU_COUNT(set) == 0)
+		return -1;
+	pthread_mutex_lock(&pool->mutex);
+	error = pthread_attr_setaffinity_np(&pool->attr, sizeof(cpu_set_t), set);
+	pthread_mutex_unlock(&pool->mutex);
+	return error ? -1 : 0;
+}
+static int thread_pool_numa(struct thread_pool *pool, const int *node)
+{
+	char path[64], list[256];
+	cpu_set_t nodeset, set;
+	struct mem_cache *cache;
+	FILE *fp;
+	int n, mode = 0;
+	unsigned long mask = 0;
+
+	if (!node || *node < 0 || *node >= THREAD_NODE_MAX)
+		return -1;
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", *node);
+	fp = fopen(path, "r");
+	if (!fp) {
+		LOGE("No NUMA node:%d.", *node);
+		return -1;
+	}
+	n = fgets(list, sizeof(list), fp) ? thread_cpulist_parse(list, &nodeset) : -1;
+	fclose(fp);
+	if (n < 0) {
+		LOGE("NUMA node:%d without CPUs.", *node);
+		return -1;
+	}
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->nthreads > 0 || pool->queued > 0) {
+		pthread_mutex_unlock(&pool->mutex);
+		LOGE("NUMA node must be set before any job.");
+		return -1;
+	}
+	/* Within THREAD_POOL_SET_CPUSET, all CPUs if not set */
+	if (pthread_attr_getaffinity_np(&pool->attr, sizeof(set), &set))
+		CPU_ZERO(&set);
+	CPU_AND(&set, &set, &nodeset);
+	if (CPU_COUNT(&set) == 0 || pthread_attr_setaffinity_np(&pool->attr, sizeof(set), &set)) {
+		pthread_mutex_unlock(&pool->mutex);
+		LOGE("No CPU of NUMA node:%d allowed.", *node);
+		return -1;
+	}
+	/* A new job cache, its first stock is touched under the node's policy */
+	syscall(SYS_get_mempolicy, &mode, &mask, THREAD_NODE_MAX, NULL, 0);
+	thread_mempolicy(THREAD_MPOL_PREFERRED, *node);
+	cache = mem_cache_create(mem_chunk_count(1, sizeof(struct thread_job)), sizeof(struct thread_job), thread_pool_lockfree(pool));
+	syscall(SYS_set_mempolicy, mode, mask ? &mask : NULL, THREAD_NODE_MAX);
+	if (cache) {
+		mem_cache_destroy(pool->job_cache);
+		pool->job_cache = cache;
+	}
+	pool->node = *node;
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
 static void *thread_task(void *arg)
 {
 	int timedout = 0;
@@ -189,34 +801,43 @@ static void *thread_task(void *arg)
 
 	thread.tid = pthread_self();
 	thread.pool = pool;
+	thread.group = NULL;
 	INIT_LIST_HEAD(&thread.list);
 
 	pthread_detach(thread.tid);
 	pthread_sigmask(SIG_SETMASK, &__full_sigset, NULL);
+	thread_setup(pool);
 	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	
 	pthread_mutex_lock(&pool->mutex);
 	pthread_cleanup_push(thread_task_cleanup, pool);
 	while (1) {
+		uint64_t expire = 0;	/* End of keepalive, kept across wake-ups that find no job */
 
 		pool->idlethreads++;
 		
 		pthread_cleanup_push(thread_idle_cleanup, pool);	
 		
-		while (list_empty(&pool->job_head)) {
+		while (pool->queued == 0) {
 			if (pool->flags & BIT(THREAD_POOL_DESTROY))
 				break;
-			LOGI("idlethreads:%d, nthreads:%d, minthreads:%d.", pool->idlethreads, pool->nthreads, pool->minthreads);
+			if (thread_adapt_retire(pool)) {
+				timedout = 1;
+				break;
+			}
 			if (pool->nthreads <= pool->minthreads) {
-				pthread_cond_wait(&pool->work_cond, &pool->mutex);
+				uint64_t since = thread_idle_enter(pool);
+				thread_idle_wait(pool, 0);
+				thread_idle_leave(pool, since);
 			} else {
 				if (pool->keepalive > 0){
-					struct timespec tspec;
-					clock_gettime(CLOCK_MONOTONIC, &tspec);
-					tspec.tv_sec += pool->keepalive;
-					if (pthread_cond_timedwait(
-						&pool->work_cond, &pool->mutex, &tspec) != ETIMEDOUT)
+					if (!expire)
+						expire = thread_now() + (uint64_t)pool->keepalive * 1000000000ull;
+					uint64_t since = thread_idle_enter(pool);
+					int rc = thread_idle_wait(pool, expire);
+					thread_idle_leave(pool, since);
+					if (rc != ETIMEDOUT)
 						continue;
 				}
 				timedout = 1;
@@ -231,18 +852,19 @@ static void *thread_task(void *arg)
 		if (pool->flags & BIT(THREAD_POOL_DESTROY))
 			break;	
 		
-		if (!list_empty(&pool->job_head)) {
-			struct thread_job *job = list_first_entry(&pool->job_head, struct thread_job, list);
-			list_delete(&job->list);
+		if (pool->queued > 0) {
+			struct thread_job *job = thread_job_dequeue(pool);
 
 			void (*func)(void *) = job->func;
 			void * arg = job->arg;
+			thread.group = job->group;
+			thread_job_release(pool, job);
 			
 			list_add_tail(&thread.list, &pool->active_thread_head);
 			pthread_mutex_unlock(&pool->mutex);
 			
+			thread.start = thread_now();
 			pthread_cleanup_push(thread_job_cleanup, &thread);
-			free(job);
 			func(arg);
 			pthread_cleanup_pop(1);
 		}
@@ -251,7 +873,6 @@ static void *thread_task(void *arg)
 			break;
 	}
 	pthread_cleanup_pop(1);
-	LOGI("Thread returning: %d.", pool->nthreads);
 	return NULL;	
 }
 static int thread_create(struct thread_pool *pool)
@@ -264,26 +885,1198 @@ static int thread_create(struct thread_pool *pool)
 
 	return error;
 }
+static int thread_create_counted(struct thread_pool *pool)
+{
+	if (thread_create(pool))
+		return -1;
+	pool->nthreads++;
+	return 0;
+}
+/*
+ * Below is the work-stealing mode.
+ */
+struct thread_done
+{
+	struct thread_pool  *pool;
+	struct thread_group *group;
+	struct thread_metrics *metrics;	/* Own metrics of a worker, NULL to use the pool ones */
+	uint64_t start;
+	uint64_t wait;					/* Microseconds, ~0 if accounted at dequeue */
+};
+static void thread_steal_account(struct thread_metrics *metrics, struct thread_done *done, uint64_t end)
+{
+	metrics->completed++;
+	thread_hist_add(&metrics->run, (end - done->start) / 1000);
+	if (done->wait != ~0ull)
+		thread_hist_add(&metrics->wait, done->wait);
+}
+static void thread_steal_done(void *arg)
+{
+	struct thread_done *done = arg;
+	struct thread_pool *pool = done->pool;
+	uint64_t end = thread_now();
+	if (done->metrics)
+		thread_steal_account(done->metrics, done, end);
+	if (done->group || !done->metrics) {
+		pthread_mutex_lock(&pool->mutex);
+		if (!done->metrics)
+			thread_steal_account(&pool->metrics, done, end);
+		if (done->group)
+			thread_group_done(done->group);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	if (aop_subf(&pool->pending, 1) == 0 && (aop_get(&pool->flags) & BIT(THREAD_POOL_WAIT))) {
+		pthread_mutex_lock(&pool->mutex);
+		pthread_cond_broadcast(&pool->wait_cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+static void thread_steal_run(struct thread_pool *pool, struct thread_job *job)
+{
+	void (*func)(void *) = job->func;
+	void * arg = job->arg;
+	struct thread_done done = { pool, job->group, NULL, thread_now(), ~0ull };
+	if (__worker && __worker->pool == pool)
+		done.metrics = &__worker->metrics;
+	else if (__slot && __slot->pool == pool)
+		done.metrics = &__slot->metrics;
+	if (job->stamp)
+		done.wait = (done.start - job->stamp) / 1000;
+	thread_job_release(pool, job);
+	pthread_cleanup_push(thread_steal_done, &done);
+	func(arg);
+	pthread_cleanup_pop(1);
+}
+/**
+ * thread_steal_global - take a job from the global queue, called with |pool->mutex| held.
+ */
+static struct thread_job *thread_steal_global(struct thread_pool *pool, struct thread_worker *w)
+{
+	int i, n;
+	struct list_head *head = &pool->job_head[THREAD_PRIO_NORMAL];
+	struct thread_job *job = thread_job_dequeue(pool);
+	struct thread_job *next[THREAD_GLOBAL_BATCH];
+	/* Take a few more NORMAL ones into own deque, fewer trips to the lock, the others may steal them */
+	for (n = 0; job && n < THREAD_GLOBAL_BATCH && !list_empty(head) && !pool->urgent; n++) {
+		if (w->deque.bottom - aop_get(&w->deque.top) + n >= THREAD_DEQUE_SIZE)
+			break;
+		next[n] = list_first_entry(head, struct thread_job, list);
+		thread_job_unqueue(pool, next[n]);
+	}
+	/* Pushed backwards, so that they still pop in FIFO order */
+	for (i = n - 1; i >= 0; i--)
+		thread_deque_push(&w->deque, next[i]);
+	return job;
+}
+/**
+ * thread_steal_find - next job of worker @w: own deque, then a random victim, then the global queue.
+ * HIGH and DEADLINE jobs only go through the global queue, which is looked at first when it holds any.
+ * @locked: |pool->mutex| is held by caller
+ */
+static struct thread_job *thread_steal_find(struct thread_pool *pool, struct thread_worker *w, int locked)
+{
+	int i, n = pool->maxthreads;
+	struct thread_job *job = NULL;
+	if (aop_get(&pool->urgent) > 0) {
+		if (!locked)
+			pthread_mutex_lock(&pool->mutex);
+		if (pool->urgent > 0)
+			job = thread_steal_global(pool, w);
+		if (!locked)
+			pthread_mutex_unlock(&pool->mutex);
+		if (job)
+			return job;
+	}
+	job = thread_deque_pop(&w->deque);
+	if (job)
+		return job;
+	int victim = rand_r(&w->seed) % n;
+	for (i = 0; i < n; i++, victim = (victim + 1) % n) {
+		struct thread_worker *v = &pool->workers[victim];
+		if (v == w)
+			continue;
+		job = thread_deque_steal(&v->deque);
+		if (job)
+			return job;
+	}
+	if (aop_get(&pool->queued) == 0)
+		return NULL;
+	if (!locked)
+		pthread_mutex_lock(&pool->mutex);
+	job = thread_steal_global(pool, w);
+	if (!locked)
+		pthread_mutex_unlock(&pool->mutex);
+	return job;
+}
+static void thread_steal_cleanup(void *arg)
+{
+	struct thread_worker *w = arg;
+	struct thread_pool *pool = w->pool;
+	__worker = NULL;
+	pthread_mutex_lock(&pool->mutex);
+	w->used = 0;
+	pool->nthreads--;
+	if ((pool->flags & BIT(THREAD_POOL_DESTROY)) && pool->nthreads == 0)
+		pthread_cond_broadcast(&pool->exit_cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+static void thread_steal_idle_cleanup(void *arg)
+{
+	struct thread_pool *pool = arg;
+	aop_dec(&pool->idlethreads);
+	pthread_mutex_unlock(&pool->mutex);
+}
+static void *thread_steal_task(void *arg)
+{
+	int rc;
+	uint64_t expire = 0;	/* End of keepalive, kept across wake-ups that find no job */
+	struct thread_worker *w = arg;
+	struct thread_pool *pool = w->pool;
+	struct thread_job *job;
+
+	pthread_sigmask(SIG_SETMASK, &__full_sigset, NULL);
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	thread_setup(pool);
+	__worker = w;
+	pthread_cleanup_push(thread_steal_cleanup, w);
+	while (!(aop_get(&pool->flags) & BIT(THREAD_POOL_DESTROY))) {
+		job = thread_steal_find(pool, w, 0);
+		if (job) {
+			expire = 0;
+			thread_steal_run(pool, job);
+			continue;
+		}
+		/*
+		 * Going to sleep: announce it, then look once more.
+		 * A submitter pushes first, then checks idlethreads, so either of us sees the other.
+		 */
+		rc = 0;
+		pthread_mutex_lock(&pool->mutex);
+		aop_inc(&pool->idlethreads);
+		pthread_cleanup_push(thread_steal_idle_cleanup, pool);
+		job = thread_steal_find(pool, w, 1);
+		if (!job && !(pool->flags & BIT(THREAD_POOL_DESTROY))) {
+			uint64_t since = thread_idle_enter(pool);
+			if (thread_adapt_retire(pool)) {
+				rc = ETIMEDOUT;
+			} else if (pool->nthreads <= pool->minthreads || pool->keepalive <= 0) {
+				thread_idle_wait(pool, 0);
+			} else {
+				if (!expire)
+					expire = thread_now() + (uint64_t)pool->keepalive * 1000000000ull;
+				rc = thread_idle_wait(pool, expire);
+			}
+			thread_idle_leave(pool, since);
+		}
+		pthread_cleanup_pop(1);
+		if (job) {
+			expire = 0;
+			thread_steal_run(pool, job);
+		}
+		else if (rc == ETIMEDOUT && pool->nthreads > pool->minthreads)
+			break;
+	}
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+/**
+ * thread_steal_spawn - start one more worker if there is a free slot, called with |pool->mutex| held.
+ */
+static int thread_steal_spawn(struct thread_pool *pool)
+{
+	int i, error;
+	sigset_t oset;
+	for (i = 0; i < pool->maxthreads; i++) {
+		if (!pool->workers[i].used)
+			break;
+	}
+	if (i == pool->maxthreads)
+		return -1;
+	struct thread_worker *w = &pool->workers[i];
+	pthread_sigmask(SIG_SETMASK, &__full_sigset, &oset);
+	error = pthread_create(&w->tid, &pool->attr, thread_steal_task, w);
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
+	if (error)
+		return -1;
+	w->used = 1;
+	pool->nthreads++;
+	return 0;
+}
+/*
+ * Below is the ring mode.
+ */
+static inline int thread_pool_destroying(struct thread_pool *pool)
+{
+	return *(volatile int *)&pool->flags & BIT(THREAD_POOL_DESTROY);
+}
+/* Reserve room for @n jobs, -1 if they do not fit */
+static inline int thread_ring_reserve(struct thread_ring *ring, long n)
+{
+	long c = aop_addf(&ring->count, n);
+	if (c > (long)ring->mask + 1) {
+		aop_sub(&ring->count, n);
+		return -1;
+	}
+	if (c > ring->count_max)
+		ring->count_max = c;
+	return 0;
+}
+/* Publish @n jobs, room reserved */
+static void thread_ring_fill(struct thread_ring *ring, struct thread_job **jobs, int n, uint64_t now)
+{
+	int i;
+	unsigned long pos = aop_fadd(&ring->head, n);
+	for (i = 0; i < n; i++, pos++) {
+		struct thread_cell *cell = &ring->cells[pos & ring->mask];
+		jobs[i]->stamp = now;
+		/* Released before |count| dropped, only waits for the store to be visible */
+		while (aop_load_acquire(&cell->seq) != pos)
+			thread_cpu_relax();
+		cell->job = jobs[i];
+		aop_store_release(&cell->seq, pos + 1);
+	}
+}
+static void thread_ring_cleanup(void *arg)
+{
+	struct thread_ring_slot *slot = arg;
+	struct thread_pool *pool = slot->pool;
+	__slot = NULL;
+	pthread_mutex_lock(&pool->mutex);
+	slot->used = 0;
+	pool->nthreads--;
+	if ((pool->flags & BIT(THREAD_POOL_DESTROY)) && pool->nthreads == 0)
+		pthread_cond_broadcast(&pool->exit_cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+/**
+ * thread_ring_wake - wake one parked thread, unless a wake-up is on its way already.
+ * Further ones are chained: a woken thread finding more jobs wakes the next.
+ */
+static inline void thread_ring_wake(struct thread_ring *ring)
+{
+	if (ring->parked > 0 && !ring->waking && aop_cas(&ring->waking, 0, 1) == 0) {
+		aop_inc(&ring->wake);
+		thread_futex(&ring->wake, FUTEX_WAKE_PRIVATE, 1, NULL);
+	}
+}
+/**
+ * thread_ring_park - sleep until jobs are pushed, returns a job if one shows up meanwhile.
+ * Announces itself in |parked| then looks at the ring once more: a submitter publishes
+ * its jobs first and reads |parked| then, so either of us sees the other.
+ * |waking| is cleared on the way in and out, a stale one only costs a spare wake-up.
+ */
+static struct thread_job *thread_ring_park(struct thread_pool *pool, struct thread_ring *ring, int *timedout)
+{
+	struct timespec ts, *tp = NULL;
+	struct thread_job *job;
+	uint32_t word = aop_get(&ring->wake);
+	aop_set(&ring->waking, 0);
+	aop_inc(&ring->parked);
+	job = thread_ring_pop(ring);
+	if (!job && !thread_pool_destroying(pool)) {
+		if (pool->nthreads > pool->minthreads && pool->keepalive > 0) {
+			ts.tv_sec  = pool->keepalive;
+			ts.tv_nsec = 0;
+			tp = &ts;
+		}
+		if (thread_futex(&ring->wake, FUTEX_WAIT_PRIVATE, word, tp) < 0 && errno == ETIMEDOUT)
+			*timedout = 1;
+	}
+	aop_dec(&ring->parked);
+	aop_set(&ring->waking, 0);
+	return job;
+}
+static void *thread_ring_task(void *arg)
+{
+	int i, timedout;
+	struct thread_ring_slot *slot = arg;
+	struct thread_pool *pool = slot->pool;
+	struct thread_ring *ring = pool->ring;
+	struct thread_job *job;
+
+	pthread_sigmask(SIG_SETMASK, &__full_sigset, NULL);
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	thread_setup(pool);
+	__slot = slot;
+	pthread_cleanup_push(thread_ring_cleanup, slot);
+	while (!thread_pool_destroying(pool)) {
+		job = thread_ring_pop(ring);
+		if (job) {
+			thread_steal_run(pool, job);
+			continue;
+		}
+		/* Poll a while: under a steady load the next job comes before a futex round trip would */
+		timedout = 0;
+		aop_inc(&pool->idlethreads);
+		for (i = 0; i < ring->spin && !(job = thread_ring_pop(ring)); i++)
+			thread_cpu_relax();
+		if (!job)
+			job = thread_ring_park(pool, ring, &timedout);
+		aop_dec(&pool->idlethreads);
+		/* Leaving: look once more, a submitter that still saw this thread idle started none */
+		if (!job && timedout)
+			job = thread_ring_pop(ring);
+		if (job) {
+			if (ring->count > 0)
+				thread_ring_wake(ring);
+			thread_steal_run(pool, job);
+		}
+		else if (timedout && pool->nthreads > pool->minthreads)
+			break;
+	}
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+/**
+ * thread_ring_spawn - start one more thread if there is a free slot, called with |pool->mutex| held.
+ */
+static int thread_ring_spawn(struct thread_pool *pool)
+{
+	int i, error;
+	sigset_t oset;
+	for (i = 0; i < pool->maxthreads; i++) {
+		if (!pool->ring->slots[i].used)
+			break;
+	}
+	if (i == pool->maxthreads)
+		return -1;
+	struct thread_ring_slot *slot = &pool->ring->slots[i];
+	pthread_sigmask(SIG_SETMASK, &__full_sigset, &oset);
+	error = pthread_create(&slot->tid, &pool->attr, thread_ring_task, slot);
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
+	if (error)
+		return -1;
+	slot->used = 1;
+	pool->nthreads++;
+	return 0;
+}
+/**
+ * thread_ring_notify - get @n jobs just pushed running: wake a parked thread, or start
+ * threads if none is idle. Threads polling the ring pick the jobs up on their own.
+ */
+static void thread_ring_notify(struct thread_pool *pool, struct thread_ring *ring, int n)
+{
+	/* Jobs are visible before |parked| is read, pairs with thread_ring_park() */
+	aop_barrier();
+	if (ring->parked > 0)
+		thread_ring_wake(ring);
+	else if (pool->idlethreads == 0 && pool->nthreads < pool->maxthreads) {
+		pthread_mutex_lock(&pool->mutex);
+		for (; n > 0 && pool->nthreads < pool->maxthreads; n--) {
+			if (thread_ring_spawn(pool))
+				break;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+/**
+ * thread_ring_wait_room - wait until the ring is not full, THREAD_RING_BLOCK policy.
+ * A thread of the pool would wait for itself: it runs a queued job instead.
+ */
+static void thread_ring_wait_room(struct thread_pool *pool, struct thread_ring *ring)
+{
+	struct thread_job *job;
+	uint32_t word;
+	if (__slot && __slot->pool == pool) {
+		job = thread_ring_pop(ring);
+		if (job)
+			thread_steal_run(pool, job);
+		return;
+	}
+	word = aop_get(&ring->room);
+	aop_inc(&ring->blocked);
+	/* Read after the locked increment, pairs with thread_ring_pop() */
+	if (ring->count > (long)ring->mask)
+		thread_futex(&ring->room, FUTEX_WAIT_PRIVATE, word, NULL);
+	aop_dec(&ring->blocked);
+}
+/**
+ * thread_ring_execute - queue @n jobs in ring mode.
+ * THREAD_RING_REJECT queues all of them or none. THREAD_RING_BLOCK queues them as room comes.
+ */
+static int thread_ring_execute(struct thread_pool *pool, struct thread_job **jobs, int n)
+{
+	struct thread_ring *ring = pool->ring;
+	uint64_t now = thread_now();
+	int i, k;
+	for (i = 0; i < n; i += k) {
+		k = n - i;
+		while (thread_ring_reserve(ring, k) < 0) {
+			if (ring->policy == THREAD_RING_REJECT) {
+				aop_inc(&ring->rejected);
+				return -1;
+			}
+			if (k > 1)
+				k = 1;		/* Take room as it comes */
+			else
+				thread_ring_wait_room(pool, ring);
+		}
+		/* Before they are visible, so that a worker never finishes one while it is not counted */
+		aop_add(&pool->pending, k);
+		thread_ring_fill(ring, jobs + i, k, now);
+		thread_ring_notify(pool, ring, k);
+	}
+	return 0;
+}
+/**
+ * thread_adapt_evaluate - close the sampling window and size the pool, called with |pool->mutex| held.
+ * Grows by half of the threads (at least one) while the p99 queue delay is over target and jobs wait,
+ * retires one idle thread when threads were idle most of the window and the p99 is well under target.
+ */
+static void thread_adapt_evaluate(struct thread_pool *pool, uint64_t now)
+{
+	int i, n, busy = 0;
+	unsigned long count = 0, rank;
+	uint64_t p99 = 0, elapsed;
+	struct thread_adapt *adapt = &pool->adapt;
+
+	elapsed = now - adapt->start;
+	if (elapsed == 0)
+		return;
+	/* Threads sleeping through the window end, accounted from now on for the next one */
+	adapt->idle += (uint64_t)adapt->idlers * now - adapt->idle_mark;
+	adapt->idle_mark = (uint64_t)adapt->idlers * now;
+	rank = adapt->jobs - adapt->jobs / 100;
+	for (i = 0; i < THREAD_ADAPT_BUCKETS && adapt->jobs > 0; i++) {
+		count += adapt->hist[i];
+		if (count >= rank) {
+			p99 = i ? 1ull << i : 0;
+			break;
+		}
+	}
+	if (pool->nthreads > 0 && adapt->idle < (uint64_t)pool->nthreads * elapsed)
+		busy = 100 - (int)(adapt->idle * 100 / ((uint64_t)pool->nthreads * elapsed));
+
+	adapt->stat.p99  = p99;
+	adapt->stat.rate = (unsigned long)(adapt->jobs * 1000000000ull / elapsed);
+	adapt->stat.busy = busy;
+	adapt->stat.windows++;
+	adapt->retire = 0;
+
+	if (p99 > (uint64_t)adapt->target && pool->queued > pool->idlethreads && pool->nthreads < pool->maxthreads) {
+		n = pool->nthreads / 2;
+		if (n < 1)
+			n = 1;
+		if (n > pool->queued - pool->idlethreads)
+			n = pool->queued - pool->idlethreads;
+		for (i = 0; i < n && pool->nthreads < pool->maxthreads; i++) {
+			if (pool->workers ? thread_steal_spawn(pool) : thread_create_counted(pool))
+				break;
+		}
+		adapt->stat.started += i;
+		adapt->stat.grows++;
+		LOGD("Adaptive grow +%d: p99:%lluus, busy:%d%%, nthreads:%d.", i, (unsigned long long)p99, busy, pool->nthreads);
+	} else if (busy < 50 && p99 <= (uint64_t)adapt->target / 2 &&
+		pool->idlethreads > 0 && pool->nthreads > pool->minthreads) {
+		adapt->retire = 1;
+		pthread_cond_signal(&pool->work_cond);
+		adapt->stat.shrinks++;
+		LOGD("Adaptive shrink: p99:%lluus, busy:%d%%, nthreads:%d.", (unsigned long long)p99, busy, pool->nthreads);
+	}
+	adapt->stat.nthreads = pool->nthreads;
+	adapt->start = now;
+	adapt->idle  = 0;
+	adapt->jobs  = 0;
+	memset(adapt->hist, 0, sizeof(adapt->hist));
+}
+static int thread_pool_adaptive(struct thread_pool *pool, const struct thread_adapt_opts *opts)
+{
+	if ((opts && opts->target <= 0) || pool->ring)
+		return -1;
+	pthread_mutex_lock(&pool->mutex);
+	int idlers = pool->adapt.idlers;	/* Still sleeping, they leave through thread_idle_leave() */
+	memset(&pool->adapt, 0, sizeof(pool->adapt));
+	pool->adapt.idlers = idlers;
+	if (opts) {
+		pool->adapt.target = opts->target;
+		pool->adapt.window = opts->window > 0 ? opts->window : 100;
+	}
+	pool->adapt.start	  = thread_now();
+	pool->adapt.idle_mark = (uint64_t)idlers * pool->adapt.start;
+	/* Sleepers wait again, bounded by the window */
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
+/**
+ * thread_pool_adapt_stat - copy metrics and decisions of the adaptive controller.
+ */
+int thread_pool_adapt_stat(struct thread_pool *pool, struct thread_adapt_stat *stat)
+{
+	pthread_mutex_lock(&pool->mutex);
+	*stat = pool->adapt.stat;
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
+/**
+ * thread_pool_snapshot - copy the counters and histograms of @pool into @snap.
+ * Times are in microseconds. In work-stealing mode, the share of each worker is read while it
+ * may be updating it, so the figures are a close approximation rather than an exact cut.
+ */
+int thread_pool_snapshot(struct thread_pool *pool, struct thread_pool_snapshot *snap)
+{
+	int i;
+	memset(snap, 0, sizeof(*snap));
+	pthread_mutex_lock(&pool->mutex);
+	snap->submitted   = pool->metrics.submitted;
+	snap->completed   = pool->metrics.completed;
+	snap->depth       = pool->queued;
+	snap->depth_max   = pool->queued_max;
+	snap->nthreads    = pool->nthreads;
+	snap->idlethreads = pool->idlethreads;
+	snap->wait = pool->metrics.wait;
+	snap->run  = pool->metrics.run;
+	for (i = 0; pool->ring && i < pool->maxthreads; i++) {
+		struct thread_ring_slot *slot = &pool->ring->slots[i];
+		snap->completed += aop_get(&slot->metrics.completed);
+		thread_hist_merge(&snap->wait, &slot->metrics.wait);
+		thread_hist_merge(&snap->run,  &slot->metrics.run);
+	}
+	if (pool->ring) {
+		snap->submitted += aop_get(&pool->ring->head);
+		snap->depth     += aop_get(&pool->ring->count);
+		snap->rejected   = aop_get(&pool->ring->rejected);
+		if (pool->ring->count_max > snap->depth_max)
+			snap->depth_max = pool->ring->count_max;
+	}
+	for (i = 0; pool->workers && i < pool->maxthreads; i++) {
+		struct thread_worker *w = &pool->workers[i];
+		long size = aop_get(&w->deque.bottom) - aop_get(&w->deque.top);
+		if (size > 0)
+			snap->depth += size;
+		snap->submitted += aop_get(&w->metrics.submitted);
+		snap->completed += aop_get(&w->metrics.completed);
+		thread_hist_merge(&snap->wait, &w->metrics.wait);
+		thread_hist_merge(&snap->run,  &w->metrics.run);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
+/**
+ * thread_pool_wake - get @n new jobs running, called with |pool->mutex| held.
+ * Wakes at most @n idle threads, and starts threads for the rest if allowed.
+ */
+static void thread_pool_wake(struct thread_pool *pool, int n)
+{
+	int i, idle = pool->idlethreads;
+	if (idle > 0) {
+		if (n >= idle) {
+			pthread_cond_broadcast(&pool->work_cond);
+		} else {
+			for (i = 0; i < n; i++)
+				pthread_cond_signal(&pool->work_cond);
+		}
+	}
+	for (n -= idle; n > 0 && pool->nthreads < pool->maxthreads; n--) {
+		if (pool->workers ? thread_steal_spawn(pool) : thread_create_counted(pool))
+			break;
+	}
+}
+/**
+ * thread_steal_execute - queue @n jobs in work-stealing mode.
+ * A worker of this pool pushes to its own deque, the others (and the overflow) go to the global queue.
+ */
+static int thread_steal_execute(struct thread_pool *pool, struct thread_job **jobs, int n)
+{
+	int i = 0;
+	uint64_t now = thread_now();
+	aop_add(&pool->pending, n);
+	if (__worker && __worker->pool == pool) {
+		for (; i < n; i++) {
+			jobs[i]->stamp = now;
+			if (jobs[i]->prio != THREAD_PRIO_NORMAL || thread_deque_push(&__worker->deque, jobs[i]) < 0)
+				break;
+		}
+		__worker->metrics.submitted += i;
+	}
+	if (i < n) {
+		pthread_mutex_lock(&pool->mutex);
+		for (; i < n; i++)
+			thread_job_enqueue(pool, jobs[i], now);
+		thread_pool_wake(pool, n);
+		pthread_mutex_unlock(&pool->mutex);
+		return 0;
+	}
+	/* Pushed, now see if anyone sleeps, pairs with the idle announcement of workers */
+	if (aop_get(&pool->idlethreads) > 0 || aop_get(&pool->nthreads) < pool->maxthreads) {
+		pthread_mutex_lock(&pool->mutex);
+		thread_pool_wake(pool, n);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	return 0;
+}
+static int thread_pool_stealing(struct thread_pool *pool, void *arg)
+{
+	int i;
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->nthreads > 0 || pool->queued > 0 || pool->maxthreads <= 0 || pool->workers || pool->ring) {
+		pthread_mutex_unlock(&pool->mutex);
+		LOGE("Stealing mode must be set before any job, maxthreads:%d.", pool->maxthreads);
+		return -1;
+	}
+	if (arg) {
+		/* Workers free jobs without |mutex| held in this mode */
+		struct mem_cache *cache = mem_cache_create(mem_chunk_count(1, sizeof(struct thread_job)), sizeof(struct thread_job), 1);
+		pool->workers = calloc(pool->maxthreads, sizeof(struct thread_worker));
+		if (!pool->workers || !cache) {
+			free(pool->workers);
+			pool->workers = NULL;
+			if (cache)
+				mem_cache_destroy(cache);
+			pthread_mutex_unlock(&pool->mutex);
+			LOGE("No memory.");
+			return -1;
+		}
+		for (i = 0; i < pool->maxthreads; i++) {
+			pool->workers[i].pool = pool;
+			pool->workers[i].seed = i + 1;
+		}
+		mem_cache_destroy(pool->job_cache);
+		pool->job_cache = cache;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
+static int thread_pool_ring(struct thread_pool *pool, const struct thread_ring_opts *opts)
+{
+	unsigned long i, size = THREAD_RING_SIZE;
+	struct thread_ring *ring;
+	struct mem_cache *cache;
+	if (opts && opts->size > 0) {
+		for (size = 2; size < opts->size && size < (1ul << 30); size <<= 1)
+			;
+	}
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->nthreads > 0 || pool->queued > 0 || pool->maxthreads <= 0 || 
+		pool->workers || pool->ring || pool->adapt.target > 0) {
+		pthread_mutex_unlock(&pool->mutex);
+		LOGE("Ring mode must be set before any job, not with stealing or adaptive sizing, maxthreads:%d.", pool->maxthreads);
+		return -1;
+	}
+	/* Threads free jobs without |mutex| held in this mode */
+	cache = mem_cache_create(mem_chunk_count(1, sizeof(struct thread_job)), sizeof(struct thread_job), 1);
+	if (posix_memalign((void **)&ring, CACHELINE, sizeof(*ring) + size * sizeof(struct thread_cell)))
+		ring = NULL;
+	if (ring) {
+		memset(ring, 0, sizeof(*ring));
+		ring->slots = calloc(pool->maxthreads, sizeof(struct thread_ring_slot));
+	}
+	if (!ring || !ring->slots || !cache) {
+		if (ring)
+			free(ring->slots);
+		free(ring);
+		if (cache)
+			mem_cache_destroy(cache);
+		pthread_mutex_unlock(&pool->mutex);
+		LOGE("No memory.");
+		return -1;
+	}
+	ring->mask	 = size - 1;
+	ring->policy = opts ? opts->policy : THREAD_RING_REJECT;
+	ring->spin	 = !opts || opts->spin == 0 ? THREAD_RING_SPIN : (opts->spin > 0 ? opts->spin : 0);
+	/* Polling only delays the submitter on a single CPU */
+	if (sysconf(_SC_NPROCESSORS_ONLN) <= 1 && (!opts || opts->spin == 0))
+		ring->spin = 0;
+	for (i = 0; i < size; i++)
+		ring->cells[i].seq = i;
+	for (i = 0; i < (unsigned long)pool->maxthreads; i++)
+		ring->slots[i].pool = pool;
+	mem_cache_destroy(pool->job_cache);
+	pool->job_cache = cache;
+	pool->ring = ring;
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
+/**
+ * thread_pool_setopt - set pool options, see enum THREAD_POOL_OPTION.
+ * @pool: pool initialized by thread_pool_init()
+ * @opt: option
+ * @arg: option argument
+ */
+int thread_pool_setopt(struct thread_pool *pool, int opt, void *arg)
+{
+	switch (opt) {
+	case THREAD_POOL_SET_STEALING:
+		return thread_pool_stealing(pool, arg);
+	case THREAD_POOL_SET_AGING:
+		if (!arg || *(int *)arg < 0)
+			return -1;
+		pthread_mutex_lock(&pool->mutex);
+		pool->aging = *(int *)arg;
+		pthread_mutex_unlock(&pool->mutex);
+		return 0;
+	case THREAD_POOL_SET_CPUSET:
+		return thread_pool_cpuset(pool, arg);
+	case THREAD_POOL_SET_NAME:
+		if (!arg)
+			return -1;
+		pthread_mutex_lock(&pool->mutex);
+		strncpy(pool->name, arg, sizeof(pool->name) - 1);
+		pthread_mutex_unlock(&pool->mutex);
+		return 0;
+	case THREAD_POOL_SET_NUMA_NODE:
+		return thread_pool_numa(pool, arg);
+	case THREAD_POOL_SET_ADAPTIVE:
+		return thread_pool_adaptive(pool, arg);
+	case THREAD_POOL_SET_RING:
+		return thread_pool_ring(pool, arg);
+	default:
+		return -1;
+	}
+}
+/**
+ * thread_pool_post - queue @func(@arg) in class @prio, @msecs is the deadline of THREAD_PRIO_DEADLINE.
+ */
+static int thread_pool_post(struct thread_pool *pool, int prio, int msecs, void (*func)(void *), void *arg)
+{
+	struct thread_job *job;
+	uint64_t now = thread_now();
+
+	if (thread_pool_lockfree(pool)) {
+		job = (struct thread_job *)mem_cache_alloc(pool->job_cache);
+		if (!job) {
+			LOGE("No memory.");
+			return -1;
+		}
+		thread_job_init(job, func, arg);
+		job->flags = THREAD_JOB_POOLED;
+		job->prio  = prio;
+		job->deadline = now + (uint64_t)msecs * 1000000ull;
+		if (!pool->ring)
+			return thread_steal_execute(pool, &job, 1);
+		if (thread_ring_execute(pool, &job, 1) < 0) {
+			thread_job_release(pool, job);
+			return -1;
+		}
+		return 0;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	job = (struct thread_job *)mem_cache_alloc(pool->job_cache);
+	if (!job) {
+		pthread_mutex_unlock(&pool->mutex);
+		LOGE("No memory.");
+		return -1;
+	}
+	thread_job_init(job, func, arg);
+	job->flags = THREAD_JOB_POOLED;
+	job->prio  = prio;
+	job->deadline = now + (uint64_t)msecs * 1000000ull;
+	thread_job_enqueue(pool, job, now);
+	thread_pool_wake(pool, 1);
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
 int thread_pool_execute(struct thread_pool *pool, void (*func)(void *), void *arg)
 {
-	struct thread_job *job = (struct thread_job *)malloc(sizeof(struct thread_job));
+	return thread_pool_post(pool, THREAD_PRIO_NORMAL, 0, func, arg);
+}
+/**
+ * thread_pool_execute_prio - like thread_pool_execute(), in class @prio of enum THREAD_PRIORITY.
+ */
+int thread_pool_execute_prio(struct thread_pool *pool, int prio, void (*func)(void *), void *arg)
+{
+	if (prio == THREAD_PRIO_DEADLINE || (unsigned int)prio >= THREAD_PRIO_CLASSES) {
+		LOGE("Invalid priority:%d.", prio);
+		return -1;
+	}
+	return thread_pool_post(pool, prio, 0, func, arg);
+}
+/**
+ * thread_pool_execute_deadline - like thread_pool_execute(), the job should start within @msecs.
+ * Deadline jobs go after HIGH ones and before NORMAL ones, earliest deadline first.
+ */
+int thread_pool_execute_deadline(struct thread_pool *pool, int msecs, void (*func)(void *), void *arg)
+{
+	return thread_pool_post(pool, THREAD_PRIO_DEADLINE, msecs, func, arg);
+}
+/**
+ * thread_pool_class_stat - copy queue delay statistics of class @prio.
+ */
+int thread_pool_class_stat(struct thread_pool *pool, int prio, struct thread_class_stat *stat)
+{
+	if ((unsigned int)prio >= THREAD_PRIO_CLASSES)
+		return -1;
+	pthread_mutex_lock(&pool->mutex);
+	*stat = pool->stat[prio];
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
+/**
+ * thread_pool_queue - queue @n jobs owned by caller, all in @group if not NULL.
+ */
+static int thread_pool_queue(struct thread_pool *pool, struct thread_group *group, struct thread_job **jobs, int n)
+{
+	int i;
+	if (n <= 0)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		jobs[i]->group = group;
+		INIT_LIST_HEAD(&jobs[i]->glist);
+	}
+	if (group)
+		aop_add(&group->pending, n);
 
+	if (pool->workers)
+		return thread_steal_execute(pool, jobs, n);
+	if (pool->ring) {
+		if (thread_ring_execute(pool, jobs, n) == 0)
+			return 0;
+		if (group) {
+			pthread_mutex_lock(&pool->mutex);
+			if (aop_subf(&group->pending, n) == 0 && group->waiters > 0)
+				pthread_cond_broadcast(&group->cond);
+			pthread_mutex_unlock(&pool->mutex);
+		}
+		return -1;
+	}
+
+	uint64_t now = thread_now();
+	pthread_mutex_lock(&pool->mutex);
+	for (i = 0; i < n; i++)
+		thread_job_enqueue(pool, jobs[i], now);
+	thread_pool_wake(pool, n);
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
+/**
+ * thread_pool_submit - queue a job initialized by thread_job_init(), nothing is allocated.
+ * @pool: pool
+ * @job: job owned by caller, not to be touched until its func is called
+ */
+int thread_pool_submit(struct thread_pool *pool, struct thread_job *job)
+{
+	return thread_pool_execute_batch(pool, &job, 1);
+}
+/**
+ * thread_pool_execute_batch - queue @n jobs at once, initialized by thread_job_init().
+ * @pool: pool
+ * @jobs: jobs owned by caller, see thread_pool_submit()
+ * @n: number of jobs
+ * The queue lock is taken once, and only as many workers as needed are woken or started.
+ * In ring mode with THREAD_RING_REJECT, a batch that does not fit is refused as a whole.
+ */
+int thread_pool_execute_batch(struct thread_pool *pool, struct thread_job **jobs, int n)
+{
+	return thread_pool_queue(pool, NULL, jobs, n);
+}
+/*
+ * Below are task groups and futures.
+ */
+int thread_group_init(struct thread_group *group, struct thread_pool *pool)
+{
+	group->pool    = pool;
+	group->pending = 0;
+	group->waiters = 0;
+	INIT_LIST_HEAD(&group->job_head);
+	return pthread_cond_init(&group->cond, &__cond_attr) ? -1 : 0;
+}
+void thread_group_destroy(struct thread_group *group)
+{
+	pthread_cond_destroy(&group->cond);
+}
+/**
+ * thread_pool_group_submit - queue a job initialized by thread_job_init() in @group.
+ * @group: group initialized by thread_group_init()
+ * @job: job owned by caller, see thread_pool_submit()
+ */
+int thread_pool_group_submit(struct thread_group *group, struct thread_job *job)
+{
+	return thread_pool_queue(group->pool, group, &job, 1);
+}
+/**
+ * thread_pool_group_execute - like thread_pool_execute(), the job is in @group.
+ */
+int thread_pool_group_execute(struct thread_group *group, void (*func)(void *), void *arg)
+{
+	struct thread_pool *pool = group->pool;
+	struct thread_job *job;
+	/* Normal mode: |job_cache| is under |pool->mutex| */
+	if (!thread_pool_lockfree(pool))
+		pthread_mutex_lock(&pool->mutex);
+	job = (struct thread_job *)mem_cache_alloc(pool->job_cache);
+	if (!thread_pool_lockfree(pool))
+		pthread_mutex_unlock(&pool->mutex);
 	if (!job) {
 		LOGE("No memory.");
 		return -1;
 	}
+	thread_job_init(job, func, arg);
+	job->flags = THREAD_JOB_POOLED;
+	if (thread_pool_queue(pool, group, &job, 1) < 0) {
+		/* Only a full ring refuses, its cache needs no lock */
+		thread_job_release(pool, job);
+		return -1;
+	}
+	return 0;
+}
+static void thread_mutex_unlock(void *mutex)
+{
+	pthread_mutex_unlock((pthread_mutex_t *)mutex);
+}
+/**
+ * thread_group_help - run @job taken out of the queues by a waiter, normal mode.
+ * Called with |pool->mutex| held, returns with it held.
+ * The waiter stands in |active_thread_head| as a worker would, for thread_pool_wait().
+ */
+static void thread_group_help(struct thread_struct *thread, struct thread_job *job)
+{
+	struct thread_pool *pool = thread->pool;
+	void (*func)(void *) = job->func;
+	void * arg = job->arg;
+	thread->group = job->group;
+	thread->start = thread_now();
+	thread_hist_add(&pool->metrics.wait, (thread->start - job->stamp) / 1000);
+	thread_job_release(pool, job);
+
+	list_add_tail(&thread->list, &pool->active_thread_head);
+	pthread_mutex_unlock(&pool->mutex);
+
+	pthread_cleanup_push(thread_job_cleanup, thread);
+	func(arg);
+	pthread_cleanup_pop(1);
+}
+/**
+ * thread_pool_group_wait - wait for all jobs of @group, helping to run them.
+ * @group: group, may be destroyed or reused once this returns
+ */
+void thread_pool_group_wait(struct thread_group *group)
+{
+	struct thread_pool *pool = group->pool;
+	struct thread_job *job;
+	struct thread_struct thread;
 
-	job->func = func;
-	job->arg  = arg;
+	thread.tid = pthread_self();
+	thread.pool = pool;
+	thread.group = NULL;
+	INIT_LIST_HEAD(&thread.list);
 
 	pthread_mutex_lock(&pool->mutex);
-	list_add_tail(&job->list, &pool->job_head);
+	pthread_cleanup_push(thread_mutex_unlock, &pool->mutex);
+	while (aop_get(&group->pending) > 0) {
+		if (!list_empty(&group->job_head)) {
+			job = list_first_entry(&group->job_head, struct thread_job, glist);
+			thread_job_unqueue(pool, job);
+			if (pool->workers) {
+				pthread_mutex_unlock(&pool->mutex);
+				thread_steal_run(pool, job);
+				pthread_mutex_lock(&pool->mutex);
+			} else {
+				thread_group_help(&thread, job);
+			}
+			continue;
+		}
+		/* Jobs of the ring cannot be picked out: any one of them brings the group's closer */
+		if (pool->ring && (job = thread_ring_pop(pool->ring)) != NULL) {
+			pthread_mutex_unlock(&pool->mutex);
+			thread_steal_run(pool, job);
+			pthread_mutex_lock(&pool->mutex);
+			continue;
+		}
+		/* A worker waiting for jobs it forked: whatever it runs brings them closer */
+		if (pool->workers && __worker && __worker->pool == pool &&
+			(job = thread_steal_find(pool, __worker, 1)) != NULL) {
+			pthread_mutex_unlock(&pool->mutex);
+			thread_steal_run(pool, job);
+			pthread_mutex_lock(&pool->mutex);
+			continue;
+		}
+		group->waiters++;
+		pthread_cond_wait(&group->cond, &pool->mutex);
+		group->waiters--;
+	}
+	pthread_cleanup_pop(1);
+}
+static void thread_future_run(void *arg)
+{
+	struct thread_future *future = arg;
+	future->result = future->func(future->arg);
+}
+/**
+ * thread_future_init - prepare a completion handle for @func(@arg) run by @pool.
+ */
+int thread_future_init(struct thread_future *future, struct thread_pool *pool, void *(*func)(void *), void *arg)
+{
+	future->func   = func;
+	future->arg    = arg;
+	future->result = NULL;
+	thread_job_init(&future->job, thread_future_run, future);
+	return thread_group_init(&future->group, pool);
+}
+void thread_future_destroy(struct thread_future *future)
+{
+	thread_group_destroy(&future->group);
+}
+int thread_future_submit(struct thread_future *future)
+{
+	return thread_pool_group_submit(&future->group, &future->job);
+}
+/**
+ * thread_future_done - whether the result is ready, does not block.
+ */
+int thread_future_done(struct thread_future *future)
+{
+	return aop_get(&future->group.pending) == 0;
+}
+/**
+ * thread_future_get - wait for the job, running it in place if no worker took it yet.
+ * Returns the value returned by its func.
+ */
+void *thread_future_get(struct thread_future *future)
+{
+	thread_pool_group_wait(&future->group);
+	return future->result;
+}
+/*
+ * Below are parallel loops.
+ */
+struct thread_range
+{
+	struct thread_group group;
+	long next;				/* Shared cursor */
+	long end;
+	long grain;
+	int  parts;				/* Participants, caller included */
+	void (*fn)(long, long, void *);
+	void (*rfn)(long, long, void *, void *);
+	void *arg;
+};
+struct thread_range_job
+{
+	struct thread_job job;
+	struct thread_range *range;
+	void *partial;
+};
+/**
+ * thread_range_next - claim the next chunk, guided: half of an even share of what is left, at least @grain.
+ */
+static int thread_range_next(struct thread_range *r, long *begin, long *end)
+{
+	long cur = aop_get(&r->next), prev, left, size;
+	while (1) {
+		left = r->end - cur;
+		if (left <= 0)
+			return 0;
+		size = left / (2 * r->parts);
+		if (size < r->grain)
+			size = r->grain;
+		if (size > left)
+			size = left;
+		prev = aop_cas(&r->next, cur, cur + size);
+		if (prev == cur)
+			break;
+		cur = prev;
+	}
+	*begin = cur;
+	*end   = cur + size;
+	return 1;
+}
+static void thread_range_run(struct thread_range *r, void *partial)
+{
+	long begin, end;
+	while (thread_range_next(r, &begin, &end)) {
+		if (r->rfn)
+			r->rfn(begin, end, partial, r->arg);
+		else
+			r->fn(begin, end, r->arg);
+	}
+}
+static void thread_range_job(void *arg)
+{
+	struct thread_range_job *rjob = arg;
+	thread_range_run(rjob->range, rjob->partial);
+}
+static int thread_pool_range(struct thread_pool *pool, long begin, long end, long grain,
+	void (*fn)(long, long, void *),
+	void (*rfn)(long, long, void *, void *),
+	void (*join)(void *, const void *, void *),
+	void *result, size_t size, void *arg)
+{
+	int i, helpers;
+	long chunks;
+	size_t stride = (size + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+	struct thread_range range;
+	struct thread_range_job *rjobs;
+	struct thread_job **jobs;
+	char *partials;
 
-	if (pool->idlethreads > 0) {
-		pthread_cond_signal(&pool->work_cond);
-	} else if (pool->nthreads < pool->maxthreads && thread_create(pool) == 0) {
-		pool->nthreads++;
+	if (end <= begin)
+		return 0;
+	if (grain <= 0)
+		grain = 1;
+	chunks  = (end - begin + grain - 1) / grain;
+	helpers = pool->maxthreads;
+	if (helpers > chunks - 1)
+		helpers = chunks - 1;
+
+	range.next  = begin;
+	range.end   = end;
+	range.grain = grain;
+	range.parts = helpers + 1;
+	range.fn    = fn;
+	range.rfn   = rfn;
+	range.arg   = arg;
+	if (helpers <= 0)
+		goto inline_run;
+
+	rjobs = malloc(helpers * (sizeof(*rjobs) + sizeof(*jobs)) + helpers * stride + CACHELINE);
+	if (!rjobs) {
+		LOGE("No memory, running in place.");
+		range.parts = 1;
+		goto inline_run;
 	}
-	pthread_mutex_unlock(&pool->mutex);
+	jobs = (struct thread_job **)(rjobs + helpers);
+	partials = (char *)(((unsigned long)(jobs + helpers) + CACHELINE - 1) & ~(unsigned long)(CACHELINE - 1));
+	thread_group_init(&range.group, pool);
+	for (i = 0; i < helpers; i++) {
+		rjobs[i].range   = &range;
+		rjobs[i].partial = NULL;
+		if (rfn) {
+			rjobs[i].partial = partials + i * stride;
+			memcpy(rjobs[i].partial, result, size);
+		}
+		thread_job_init(&rjobs[i].job, thread_range_job, &rjobs[i]);
+		jobs[i] = &rjobs[i].job;
+	}
+	thread_pool_queue(pool, &range.group, jobs, helpers);
+	/* Caller accumulates right into @result */
+	thread_range_run(&range, result);
+	thread_pool_group_wait(&range.group);
+	thread_group_destroy(&range.group);
+	for (i = 0; rfn && i < helpers; i++)
+		join(result, rjobs[i].partial, arg);
+	free(rjobs);
 	return 0;
+
+inline_run:
+	thread_range_run(&range, result);
+	return 0;
+}
+/**
+ * thread_pool_parallel_for - run @fn(chunk begin, chunk end, @arg) over [@begin, @end).
+ * @grain: smallest chunk
+ * Returns when the whole range is done.
+ */
+int thread_pool_parallel_for(struct thread_pool *pool, long begin, long end, long grain,
+	void (*fn)(long, long, void *), void *arg)
+{
+	return thread_pool_range(pool, begin, end, grain, fn, NULL, NULL, NULL, 0, arg);
+}
+/**
+ * thread_pool_parallel_reduce - reduce [@begin, @end) into @result.
+ * @fn: fn(chunk begin, chunk end, partial, @arg) accumulates a chunk into a partial result
+ * @join: join(@result, partial, @arg) merges a partial, called by the caller only
+ * @result: identity value on entry, result on return
+ * @size: size of @result
+ * Every participant has its own partial, on its own cache line, the caller's is @result itself.
+ */
+int thread_pool_parallel_reduce(struct thread_pool *pool, long begin, long end, long grain,
+	void (*fn)(long, long, void *, void *),
+	void (*join)(void *, const void *, void *),
+	void *result, size_t size, void *arg)
+{
+	return thread_pool_range(pool, begin, end, grain, NULL, fn, join, result, size, arg);
 }
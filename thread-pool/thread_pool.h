@@ -1,8 +1,153 @@
 #ifndef __THREAD_POOL_H__
 #define __THREAD_POOL_H__
 #include <pthread.h>
+#include <stdint.h>
 #include "list.h"
 
+struct mem_cache;
+struct thread_worker;
+struct thread_ring;
+struct thread_group;
+/*
+ * Adaptive sizing, see THREAD_POOL_SET_ADAPTIVE.
+ * Every window the controller looks at the p99 queue delay, throughput and idle time of threads:
+ * it starts more threads (up to maxthreads) when the p99 is over target and jobs are waiting,
+ * and retires one idle thread (down to minthreads) when threads were mostly idle.
+ */
+struct thread_adapt_opts
+{
+	int target;					/* p99 queue delay target, microseconds */
+	int window;					/* Sampling window, milliseconds, 0: 100 */
+};
+struct thread_adapt_stat		/* Last window and decisions so far, see thread_pool_adapt_stat() */
+{
+	uint64_t p99;				/* Queue delay, microseconds, upper bound of a power of 2 bucket */
+	unsigned long rate;			/* Jobs taken per second */
+	int busy;					/* Percent of thread time not idle */
+	int nthreads;
+	unsigned long windows;
+	unsigned long grows;		/* Windows that started threads */
+	unsigned long shrinks;		/* Windows that retired a thread */
+	unsigned long started;		/* Threads started by the controller */
+};
+/*
+ * HDR-style histogram of microseconds: linear below 8, then 8 sub-buckets per power of 2,
+ * so any value is known within 12.5%, up to about 71 minutes.
+ */
+#define THREAD_HIST_BUCKETS		240
+struct thread_hist
+{
+	unsigned long count;
+	uint64_t sum;
+	uint64_t max;
+	unsigned int bucket[THREAD_HIST_BUCKETS];
+};
+struct thread_metrics
+{
+	unsigned long submitted;
+	unsigned long completed;
+	struct thread_hist wait;	/* Queue wait, submit to start */
+	struct thread_hist run;		/* Execution time */
+};
+/* See thread_pool_snapshot() */
+struct thread_pool_snapshot
+{
+	unsigned long submitted;
+	unsigned long completed;
+	int depth;					/* Jobs queued now */
+	int depth_max;				/* High-water mark of the ready queue */
+	int nthreads;
+	int idlethreads;
+	unsigned long rejected;		/* Submissions refused by a full ring, see THREAD_POOL_SET_RING */
+	struct thread_hist wait;
+	struct thread_hist run;
+};
+/*
+ * Ring mode, see THREAD_POOL_SET_RING.
+ * Jobs go through a bounded lock-free MPMC ring instead of the ready queue under |mutex|:
+ * submitting or taking a job costs a few atomic operations, idle threads poll for a while
+ * before they park on a futex, and submitters only make a system call to wake parked ones.
+ * The ring is FIFO: priority classes, deadlines, aging and adaptive sizing do not apply.
+ */
+enum THREAD_RING_POLICY
+{
+	THREAD_RING_REJECT,			/* A submission that does not fit fails, a batch as a whole */
+	THREAD_RING_BLOCK,			/* The submitter waits for room, a thread of the pool runs jobs meanwhile */
+};
+struct thread_ring_opts
+{
+	unsigned int size;			/* Slots, rounded up to a power of 2, 0: 1024 */
+	int policy;					/* enum THREAD_RING_POLICY */
+	int spin;					/* Polls of an idle thread before it parks, 0: 2000 (none on a single CPU), < 0: none */
+};
+#define THREAD_ADAPT_BUCKETS	32
+struct thread_adapt
+{
+	int target;
+	int window;
+	int retire;					/* Idle threads asked to exit */
+	uint64_t start;				/* Window start, CLOCK_MONOTONIC nanoseconds */
+	uint64_t idle;				/* Idle time of all threads in the window, nanoseconds */
+	uint64_t idle_mark;			/* Sum of the times the idle time of sleeping threads is accounted from */
+	int idlers;					/* Threads sleeping, accounted in |idle_mark| */
+	unsigned long jobs;
+	unsigned int hist[THREAD_ADAPT_BUCKETS];	/* Queue delay, log2 of microseconds */
+	struct thread_adapt_stat stat;
+};
+/*
+ * Priority classes of the ready queue, FIFO within a class.
+ * Deadline jobs are ordered by deadline (earliest first) and run before NORMAL ones.
+ * A job waiting longer than the aging limit (THREAD_POOL_SET_AGING) runs before
+ * the higher classes, so that LOW jobs are never starved.
+ */
+enum THREAD_PRIORITY
+{
+	THREAD_PRIO_HIGH,
+	THREAD_PRIO_DEADLINE,		/* Set by thread_job_set_deadline() */
+	THREAD_PRIO_NORMAL,
+	THREAD_PRIO_LOW,
+	THREAD_PRIO_CLASSES,
+};
+/* Queue delay statistics of a class, see thread_pool_class_stat() */
+struct thread_class_stat
+{
+	unsigned long jobs;			/* Jobs taken out of the queue */
+	unsigned long aged;			/* Of which taken early by aging */
+	unsigned long missed;		/* Deadline jobs started after their deadline */
+	uint64_t delay;				/* Total queue delay, in microseconds */
+	uint64_t max_delay;			/* Microseconds */
+};
+/*
+ * Job node, intrusive: callers may embed it in their own objects or keep a pool of them
+ * (e.g. from a mem_cache) and submit it with thread_pool_submit()/thread_pool_execute_batch(),
+ * nothing is allocated then. The pool does not touch a job once its func is called,
+ * so func may free or resubmit it. Jobs still queued at thread_pool_destroy() are dropped.
+ */
+struct thread_job
+{
+	void *arg;
+	void (*func)(void *);
+	struct list_head list;
+	int flags;			/* Internal, set by thread_job_init() */
+	struct thread_group *group;
+	struct list_head glist;		/* In |group->job_head| while waiting in the global queue */
+	int prio;					/* enum THREAD_PRIORITY */
+	uint64_t stamp;				/* CLOCK_MONOTONIC nanoseconds when queued */
+	uint64_t deadline;			/* CLOCK_MONOTONIC nanoseconds, THREAD_PRIO_DEADLINE only */
+};
+static inline void thread_job_init(struct thread_job *job, void (*func)(void *), void *arg)
+{
+	job->arg   = arg;
+	job->func  = func;
+	job->flags = 0;
+	job->group = NULL;
+	job->prio  = THREAD_PRIO_NORMAL;
+}
+static inline void thread_job_set_priority(struct thread_job *job, int prio)
+{
+	job->prio  = prio;
+}
+void thread_job_set_deadline(struct thread_job *job, int msecs);
 struct thread_pool
 {
 	int maxthreads;
@@ -15,7 +160,17 @@ struct thread_pool
 	
 	int flags;
 
-	struct list_head job_head;	
+	struct list_head job_head[THREAD_PRIO_CLASSES];	/* Ready queue */
+	int queued;				/* Jobs in |job_head| */
+	int urgent;				/* Of which HIGH and DEADLINE ones */
+	int aging;				/* Milliseconds */
+	struct thread_class_stat stat[THREAD_PRIO_CLASSES];
+	char name[16];			/* Threads are named <name>/<seq>, see THREAD_POOL_SET_NAME */
+	int seq;
+	int node;				/* NUMA node, -1 if none */
+	struct thread_adapt adapt;
+	struct thread_metrics metrics;	/* Protected by |mutex|, workers of stealing mode keep their own */
+	int queued_max;
 	struct list_head active_thread_head;
 
 	pthread_attr_t attr;
@@ -25,11 +180,92 @@ struct thread_pool
 	pthread_cond_t		work_cond;
 	pthread_cond_t  	wait_cond;
 	pthread_cond_t  	exit_cond;
+	/* Work-stealing mode, one worker slot per thread, see THREAD_POOL_SET_STEALING */
+	struct thread_worker *workers;
+	struct thread_ring *ring;	/* Ring mode, see THREAD_POOL_SET_RING */
+	int pending;		/* Jobs submitted but not finished yet */
+	struct mem_cache *job_cache;	/* Jobs of thread_pool_execute() */
+};
+enum THREAD_POOL_OPTION
+{										/* for thread_pool_setopt(pool, opt, arg) */
+	THREAD_POOL_SET_STEALING,			/* arg: Boolean Type, per-worker deques with work stealing, 
+										   set before the first job. Jobs submitted by workers go 
+										   to their own deques, the others to the global queue. */
+	THREAD_POOL_SET_AGING,				/* arg must be int* type, milliseconds a queued job waits at most 
+										   before it goes ahead of higher classes, 0 to disable. */
+	THREAD_POOL_SET_CPUSET,				/* arg must be cpu_set_t* type, threads started afterwards run on these CPUs */
+	THREAD_POOL_SET_NAME,				/* arg: const char * type, thread name prefix shown by top -H */
+	THREAD_POOL_SET_NUMA_NODE,			/* arg must be int* type, set before the first job. Threads run on CPUs of 
+										   the node (within THREAD_POOL_SET_CPUSET if set) and prefer its memory 
+										   for their stacks and allocations, so does the job cache. */
+	THREAD_POOL_SET_ADAPTIVE,			/* arg must be struct thread_adapt_opts* type, NULL to disable */
+	THREAD_POOL_SET_RING,				/* arg must be struct thread_ring_opts* type, NULL for defaults. Set before 
+										   the first job, not together with stealing or adaptive sizing. */
 };
 int thread_pool_init(struct thread_pool * pool, int keepalive, 
 	int minthreads, 
 	int maxthreads, const pthread_attr_t *attr);
 void thread_pool_destroy(int defer, struct thread_pool *pool);
 int thread_pool_execute(struct thread_pool *pool, void (*func)(void *), void *arg);
+int thread_pool_execute_prio(struct thread_pool *pool, int prio, void (*func)(void *), void *arg);
+int thread_pool_execute_deadline(struct thread_pool *pool, int msecs, void (*func)(void *), void *arg);
+int thread_pool_class_stat(struct thread_pool *pool, int prio, struct thread_class_stat *stat);
+int thread_pool_adapt_stat(struct thread_pool *pool, struct thread_adapt_stat *stat);
+int thread_pool_snapshot(struct thread_pool *pool, struct thread_pool_snapshot *snap);
+uint64_t thread_hist_percentile(const struct thread_hist *hist, double percent);
+int thread_pool_submit(struct thread_pool *pool, struct thread_job *job);
+int thread_pool_execute_batch(struct thread_pool *pool, struct thread_job **jobs, int n);
+int thread_pool_setopt(struct thread_pool *pool, int opt, void *arg);
+void thread_pool_wait(struct thread_pool *pool);
+/*
+ * Task group: a set of jobs of one pool that can be waited for on its own,
+ * while other subsystems keep using the same pool.
+ * The waiter does not just sleep: it runs the group's jobs still queued,
+ * and in work-stealing mode a waiting worker runs any job it can find.
+ */
+struct thread_group
+{
+	struct thread_pool *pool;
+	int pending;			/* Jobs submitted but not finished yet */
+	int waiters;
+	struct list_head job_head;	/* Jobs of the group still queued, protected by |pool->mutex| */
+	pthread_cond_t cond;
+};
+int  thread_group_init(struct thread_group *group, struct thread_pool *pool);
+void thread_group_destroy(struct thread_group *group);
+int  thread_pool_group_submit(struct thread_group *group, struct thread_job *job);
+int  thread_pool_group_execute(struct thread_group *group, void (*func)(void *), void *arg);
+void thread_pool_group_wait(struct thread_group *group);
+/*
+ * Completion handle of a single job, with the value returned by @func as result.
+ */
+struct thread_future
+{
+	struct thread_job job;
+	struct thread_group group;
+	void *(*func)(void *);
+	void *arg;
+	void *result;
+};
+int  thread_future_init(struct thread_future *future, struct thread_pool *pool, void *(*func)(void *), void *arg);
+void thread_future_destroy(struct thread_future *future);
+int  thread_future_submit(struct thread_future *future);
+int  thread_future_done(struct thread_future *future);
+void *thread_future_get(struct thread_future *future);
+/*
+ * Parallel loops over [begin, end), the caller takes part in the work.
+ * Chunks are claimed from a shared cursor: large ones first, shrinking down to @grain
+ * as the range runs out, so that participants finish at about the same time.
+ */
+int thread_pool_parallel_for(struct thread_pool *pool, long begin, long end, long grain,
+	void (*fn)(long, long, void *), void *arg);
+/*
+ * @fn accumulates [begin, end) into a partial result of @size bytes, @join merges a partial into @result.
+ * @result holds the identity value on entry: every partial starts as a copy of it.
+ */
+int thread_pool_parallel_reduce(struct thread_pool *pool, long begin, long end, long grain,
+	void (*fn)(long, long, void *, void *),
+	void (*join)(void *, const void *, void *),
+	void *result, size_t size, void *arg);
 
 #endif
@@ -1,9 +1,12 @@
 /*
  * Copyright (c) 2021, Jasonchen
+ * Version: 0.0.2 - 20261019
+ *				  - Add timer_option.cpuset, timer threads are named timer and timer/<n>.
  * Version: 0.0.1 - 20211103                
  * Author: Jie Chen <jasonchen0720@163.com>
  * brief : Implementation of JC-Posix timer.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -131,6 +134,7 @@ static void timer_printer(const struct rb_node *n)
 	  /* thread_min */2, \
 	  /* thread_max */2, \
 	  /* thread_stack_size 1M default */1024 * 1024, \
+	  /* cpuset */NULL, \
 	}
 static struct timer_option __timer_opts = DEFAULT_TIMER_OPTION;
 static const struct timer_option *__users_opts = NULL;
@@ -280,10 +284,15 @@ static void *timer_executor(void *arg)
 	int timedout = 0;
 	struct timer_thread *self = arg;
 	struct timer_base 	*base = self->base;
+	char name[32];
 
 	assert(pthread_equal(self->tid, pthread_self()));
 	
 	pthread_mutex_lock(&base->mutex);
+	/* Counted by creator under the lock, the inspector is the first one */
+	snprintf(name, sizeof(name), "timer/%d", base->nthreads - 1);
+	name[15] = '\0';
+	pthread_setname_np(pthread_self(), name);
 	
 	pthread_cleanup_push(thread_cleanup, self);
 	for (; base->state != TMR_BASE_DESTROY; ) {
@@ -348,6 +357,7 @@ static void * timer_inspector(void *arg)
 	struct timer_base 	*base = self->base;
 
 	assert(pthread_equal(self->tid, pthread_self()));
+	pthread_setname_np(pthread_self(), "timer");
 	pthread_mutex_lock(&base->mutex);
 	
 	pthread_cleanup_push(thread_cleanup, self);
@@ -480,6 +490,8 @@ int timer_setup(const struct timer_option *opt)
 	assert(!pthread_attr_init(&base->tattr));
 	assert(!pthread_attr_setstacksize(&base->tattr, base->opt->thread_stack_size));
 	assert(!pthread_attr_setdetachstate(&base->tattr, PTHREAD_CREATE_DETACHED));
+	if (opt && opt->cpuset && pthread_attr_setaffinity_np(&base->tattr, sizeof(cpu_set_t), opt->cpuset))
+		goto err;
 	
 	base->timerid 		= 0;
 	base->running_timer = NULL;
@@ -1,6 +1,7 @@
 #ifndef __JC_TIMER_H__
 #define __JC_TIMER_H__
 #include <time.h>
+#include <sched.h>
 #include <pthread.h>
 #include "rb_tree.h"
 #include "list.h"
@@ -25,6 +26,7 @@ struct timer_option
 	int 	thread_min;
 	int 	thread_max;
 	size_t 	thread_stack_size;
+	const cpu_set_t *cpuset;	/* Timer threads run on these CPUs, NULL: all */
 };
 enum TIMER_OPTION {
 	TMR_O_CYCLE,